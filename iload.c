@@ -0,0 +1,530 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include "stats.h"
+#include "trace_pool.h"
+#include "trace_reader.h"
+
+/**
+ * Synthetic syscall load generator, driven by an aggregate profile.
+ *
+ * Usage: ./iload [-j threads] [-d seconds] [-x scale | -m] [-w seconds] [-D dir]
+ *                profile [profile2]
+ *   profile   a saved snapshot (cat /proc/interceptor/stats > run.stats)
+ *   profile2  a later snapshot of the same run; the rates are then the
+ *             difference between the two over the time between them
+ *   -w  with a single snapshot: how long it was collected over (required)
+ *   -j  threads to spread the load over (default: number of CPUs)
+ *   -d  how long to run (default 10s)
+ *   -x  multiply every rate by this (default 1)
+ *   -m  ignore the rates and issue the same mix as fast as possible
+ *   -D  directory for the scratch files (default /tmp)
+ *
+ * Each thread issues its share of every syscall's rate, picking calls at
+ * random in proportion to the profile at evenly spaced times, and uses the
+ * average size the profile shows for calls that move bytes. Every pick is
+ * one call of the profiled syscall number itself, made with syscall(2) on
+ * harmless arguments: reads and writes without an offset go to /dev/zero
+ * and /dev/null, those with one to a scratch file at offset 0, stats look
+ * at the scratch file, and so on. The profile's numbers are taken to be
+ * those of the machine iload runs on (i386, like the module).
+ *
+ * Opens and creats add their fd to a per-thread pool that closes take
+ * from, and mmap/mmap2 likewise feed munmap, so each of them runs once
+ * per pick at its own rate. The pools are filled halfway before the run
+ * starts; a close or munmap that finds its pool empty is still issued,
+ * on an invalid fd or address, and shows up as an error. When a pool is
+ * full its oldest entry is released after the timed call. Syscalls with
+ * no safe way to issue them are listed and left out. At the end the
+ * target and achieved rate and the mean latency of each syscall are
+ * printed, so the tool also shows how much of a mix a machine can sustain.
+ */
+
+#define MAX_SIZE                (1 << 20)
+#define MAX_THREADS             256
+#define POOL_FDS                64
+#define POOL_MAPS               64
+
+/* The shape of a syscall's arguments */
+enum gen {
+	GEN_NONE, GEN_READ, GEN_READV, GEN_PREAD, GEN_WRITE, GEN_WRITEV, GEN_PWRITE,
+	GEN_OPEN, GEN_CREAT, GEN_CLOSE, GEN_STAT, GEN_FSTAT, GEN_LSEEK, GEN_LLSEEK,
+	GEN_FSYNC, GEN_NOARGS, GEN_TIMEVAL, GEN_TIME, GEN_CLOCK, GEN_OLD_MMAP, GEN_MMAP,
+	GEN_MUNMAP
+};
+
+/* Profile syscall names and how they are issued */
+static const struct {
+	const char *name;
+	enum gen gen;
+} gens[] = {
+	{ "read", GEN_READ }, { "readv", GEN_READV }, { "pread64", GEN_PREAD },
+	{ "write", GEN_WRITE }, { "writev", GEN_WRITEV }, { "pwrite64", GEN_PWRITE },
+	{ "open", GEN_OPEN }, { "creat", GEN_CREAT }, { "close", GEN_CLOSE },
+	{ "stat", GEN_STAT }, { "lstat", GEN_STAT }, { "stat64", GEN_STAT }, { "lstat64", GEN_STAT },
+	{ "fstat", GEN_FSTAT }, { "fstat64", GEN_FSTAT },
+	{ "lseek", GEN_LSEEK }, { "_llseek", GEN_LLSEEK },
+	{ "fsync", GEN_FSYNC }, { "fdatasync", GEN_FSYNC },
+	{ "getpid", GEN_NOARGS }, { "getppid", GEN_NOARGS }, { "gettid", GEN_NOARGS },
+	{ "getuid", GEN_NOARGS }, { "geteuid", GEN_NOARGS }, { "getgid", GEN_NOARGS },
+	{ "getegid", GEN_NOARGS }, { "getuid32", GEN_NOARGS }, { "geteuid32", GEN_NOARGS },
+	{ "getgid32", GEN_NOARGS }, { "getegid32", GEN_NOARGS },
+	{ "gettimeofday", GEN_TIMEVAL }, { "time", GEN_TIME }, { "clock_gettime", GEN_CLOCK },
+	{ "mmap", GEN_OLD_MMAP }, { "mmap2", GEN_MMAP }, { "munmap", GEN_MUNMAP },
+	{ NULL, GEN_NONE }
+};
+
+/* One syscall of the mix */
+struct load {
+	int nr;
+	enum gen gen;
+	double rate;
+	size_t size;
+};
+
+/* Per-thread, per-syscall results */
+struct result {
+	uint64_t calls, errors, ns;
+};
+
+static struct load *mix;
+static int nmix;
+static double total_rate, duration = 10.0;
+static int nthreads, flat_out, pool_fds;
+static const char *dir = "/tmp";
+static struct result *results;
+
+static uint64_t now_ns(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static enum gen gen_for(int nr) {
+
+	const char *name = trace_syscall_name(nr);
+	int i;
+
+	for (i = 0; name && gens[i].name; i++) {
+		if (strcmp(gens[i].name, name) == 0)
+			return gens[i].gen;
+	}
+	return GEN_NONE;
+}
+
+/**
+ * Build the mix from the counts in b (minus those in a, if given) over
+ * secs seconds. Returns the number of syscalls in the mix.
+ */
+static int build_mix(const struct stats_snapshot *a, const struct stats_snapshot *b, double secs, double scale) {
+
+	static const struct stats_syscall zero;
+	int nr;
+
+	if (!(mix = calloc(STATS_MAX_SYSCALL, sizeof(*mix))))
+		return -ENOMEM;
+
+	for (nr = 0; nr < STATS_MAX_SYSCALL; nr++) {
+		const struct stats_syscall *e = &b->sys[nr], *s = a ? &a->sys[nr] : &zero;
+		uint64_t calls = e->count > s->count ? e->count - s->count : 0;
+		uint64_t bytes = e->bytes > s->bytes ? e->bytes - s->bytes : 0;
+		struct load *l = &mix[nmix];
+
+		if (!calls)
+			continue;
+		if ((l->gen = gen_for(nr)) == GEN_NONE) {
+			fprintf(stderr, "skipping syscall %d (%s): no synthetic equivalent\n", nr,
+				trace_syscall_name(nr) ? trace_syscall_name(nr) : "?");
+			continue;
+		}
+		l->nr = nr;
+		l->rate = calls / secs * scale;
+		l->size = bytes / calls;
+		if (l->size < 1)
+			l->size = 1;
+		if (l->size > MAX_SIZE)
+			l->size = MAX_SIZE;
+		total_rate += l->rate;
+		nmix++;
+	}
+	return nmix;
+}
+
+/* A mapping waiting for its munmap */
+struct mapping {
+	long addr;
+	size_t len;
+};
+
+/* Scratch state of one load thread */
+struct scratch {
+	char path[4096], cpath[4096];
+	int fd, zero_fd, null_fd;
+	char *buf;
+	/* Oldest first */
+	int fds[POOL_FDS], nfds;
+	struct mapping maps[POOL_MAPS];
+	int nmaps;
+};
+
+/* Open or map up to half of each pool before the run */
+static void pool_fill(struct scratch *s) {
+
+	void *p;
+	int fd;
+
+	while (s->nfds < pool_fds / 2 && (fd = open(s->path, O_RDONLY)) >= 0)
+		s->fds[s->nfds++] = fd;
+	while (s->nmaps < POOL_MAPS / 2) {
+		p = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			break;
+		s->maps[s->nmaps].addr = (long)p;
+		s->maps[s->nmaps++].len = 4096;
+	}
+}
+
+static int scratch_open(struct scratch *s, int worker) {
+
+	memset(s, 0, sizeof(*s));
+	snprintf(s->path, sizeof(s->path), "%s/iload.%d.%d", dir, (int)getpid(), worker);
+	snprintf(s->cpath, sizeof(s->cpath), "%s/iload.%d.%d.creat", dir, (int)getpid(), worker);
+	s->zero_fd = open("/dev/zero", O_RDONLY);
+	s->null_fd = open("/dev/null", O_WRONLY);
+	if (s->zero_fd < 0 || s->null_fd < 0 ||
+	    (s->fd = open(s->path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+		return -errno;
+	if (!(s->buf = malloc(MAX_SIZE))) {
+		close(s->fd);
+		return -ENOMEM;
+	}
+	memset(s->buf, 'x', MAX_SIZE);
+	// Reads need data to read
+	if (write(s->fd, s->buf, MAX_SIZE) != MAX_SIZE) {
+		close(s->fd);
+		free(s->buf);
+		return -EIO;
+	}
+	pool_fill(s);
+	return 0;
+}
+
+static void scratch_close(struct scratch *s) {
+
+	while (s->nfds)
+		close(s->fds[--s->nfds]);
+	while (s->nmaps--)
+		munmap((void *)s->maps[s->nmaps].addr, s->maps[s->nmaps].len);
+	close(s->fd);
+	close(s->zero_fd);
+	close(s->null_fd);
+	unlink(s->path);
+	unlink(s->cpath);
+	free(s->buf);
+}
+
+/* Take the oldest fd or mapping of a pool, or -1 / an invalid address if it is empty */
+static int fd_take(struct scratch *s) {
+
+	int fd;
+
+	if (!s->nfds)
+		return -1;
+	fd = s->fds[0];
+	memmove(s->fds, s->fds + 1, --s->nfds * sizeof(*s->fds));
+	return fd;
+}
+
+static struct mapping map_take(struct scratch *s) {
+
+	// Not page aligned, so munmap fails without touching anything
+	struct mapping m = { 1, 4096 };
+
+	if (s->nmaps) {
+		m = s->maps[0];
+		memmove(s->maps, s->maps + 1, --s->nmaps * sizeof(*s->maps));
+	}
+	return m;
+}
+
+/* Add what a call created to its pool; run after the call is timed */
+static void pool_add(const struct load *l, struct scratch *s, long ret) {
+
+	if (ret == -1)
+		return;
+	switch (l->gen) {
+		case GEN_OPEN:
+		case GEN_CREAT:
+			if (s->nfds == pool_fds)
+				close(fd_take(s));
+			s->fds[s->nfds++] = ret;
+			break;
+		case GEN_OLD_MMAP:
+		case GEN_MMAP:
+			if (s->nmaps == POOL_MAPS) {
+				struct mapping m = map_take(s);
+				munmap((void *)m.addr, m.len);
+			}
+			s->maps[s->nmaps].addr = ret;
+			s->maps[s->nmaps++].len = l->size;
+			break;
+		default:
+			break;
+	}
+}
+
+/* Issue one call of l's syscall; returns -1 if it failed */
+static long generate(const struct load *l, struct scratch *s) {
+
+	char st[256];
+	struct iovec iov = { s->buf, l->size };
+	struct timespec ts;
+	struct timeval tv;
+	struct mapping m;
+	long long off;
+	unsigned long args[6];
+
+	// Straight to the kernel, so libc neither caches nor substitutes calls
+	switch (l->gen) {
+		case GEN_READ:
+			return syscall(l->nr, s->zero_fd, s->buf, l->size);
+		case GEN_READV:
+			return syscall(l->nr, s->zero_fd, &iov, 1);
+		case GEN_PREAD:
+			// The offset is split in two words on i386
+			return syscall(l->nr, s->fd, s->buf, l->size, 0, 0);
+		case GEN_WRITE:
+			return syscall(l->nr, s->null_fd, s->buf, l->size);
+		case GEN_WRITEV:
+			return syscall(l->nr, s->null_fd, &iov, 1);
+		case GEN_PWRITE:
+			return syscall(l->nr, s->fd, s->buf, l->size, 0, 0);
+		case GEN_OPEN:
+			return syscall(l->nr, s->path, O_RDONLY);
+		case GEN_CREAT:
+			return syscall(l->nr, s->cpath, 0600);
+		case GEN_CLOSE:
+			return syscall(l->nr, fd_take(s));
+		case GEN_STAT:
+			return syscall(l->nr, s->path, st);
+		case GEN_FSTAT:
+			return syscall(l->nr, s->fd, st);
+		case GEN_LSEEK:
+			return syscall(l->nr, s->fd, 0, SEEK_SET);
+		case GEN_LLSEEK:
+			return syscall(l->nr, s->fd, 0, 0, &off, SEEK_SET);
+		case GEN_FSYNC:
+			return syscall(l->nr, s->fd);
+		case GEN_NOARGS:
+			return syscall(l->nr);
+		case GEN_TIMEVAL:
+			return syscall(l->nr, &tv, NULL);
+		case GEN_TIME:
+			return syscall(l->nr, NULL);
+		case GEN_CLOCK:
+			return syscall(l->nr, CLOCK_MONOTONIC, &ts);
+		case GEN_OLD_MMAP:
+			// The old mmap takes its arguments in a block
+			args[0] = 0;
+			args[1] = l->size;
+			args[2] = PROT_READ | PROT_WRITE;
+			args[3] = MAP_PRIVATE | MAP_ANONYMOUS;
+			args[4] = -1;
+			args[5] = 0;
+			return syscall(l->nr, args);
+		case GEN_MMAP:
+			return syscall(l->nr, 0, l->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		case GEN_MUNMAP:
+			m = map_take(s);
+			return syscall(l->nr, m.addr, m.len);
+		default:
+			return -1;
+	}
+}
+
+/* Pick a syscall of the mix at random, weighted by rate */
+static int pick(unsigned int *seed) {
+
+	double x = (double)rand_r(seed) / ((double)RAND_MAX + 1) * total_rate;
+	int i;
+
+	for (i = 0; i < nmix - 1; i++) {
+		if ((x -= mix[i].rate) < 0)
+			break;
+	}
+	return i;
+}
+
+static void load_thread(void *arg, int worker, int task) {
+
+	struct result *res = &results[task * nmix];
+	struct scratch s;
+	unsigned int seed = task * 7919 + 1;
+	uint64_t start, end, due, t0, t1, gap;
+	long ret;
+	int i, status;
+
+	if ((status = scratch_open(&s, task)) != 0) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(-status));
+		return;
+	}
+
+	// Calls of all kinds are spread evenly at the thread's share of the total rate
+	gap = flat_out ? 0 : (uint64_t)(1e9 * nthreads / total_rate);
+	start = due = now_ns();
+	end = start + (uint64_t)(duration * 1e9);
+
+	while ((t0 = now_ns()) < end) {
+		if (t0 < due) {
+			struct timespec ts = { 0, (long)(due - t0 < 100000000 ? due - t0 : 100000000) };
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		i = pick(&seed);
+		t0 = now_ns();
+		ret = generate(&mix[i], &s);
+		t1 = now_ns();
+		// Mappings above 2GB look negative on i386; syscall() fails with -1
+		if (ret == -1)
+			res[i].errors++;
+		pool_add(&mix[i], &s, ret);
+		res[i].calls++;
+		res[i].ns += t1 - t0;
+		// When behind, catch up without bursting more than a second's worth
+		due += gap;
+		if (due + 1000000000ull < t1)
+			due = t1 - 1000000000ull;
+	}
+	scratch_close(&s);
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-j threads] [-d seconds] [-x scale | -m] [-w seconds] [-D dir] "
+		"profile [profile2]\n", prog);
+}
+
+int main(int argc, char **argv) {
+
+	struct stats_snapshot *a = NULL, *b;
+	struct rlimit rl;
+	long room;
+	double window = 0, scale = 1.0, secs;
+	uint64_t calls, errors, ns;
+	int opt, i, t, status;
+
+	nthreads = trace_pool_cpus();
+	while ((opt = getopt(argc, argv, "j:d:x:mw:D:")) != -1) {
+		switch (opt) {
+			case 'j':
+				nthreads = atoi(optarg);
+				break;
+			case 'd':
+				duration = atof(optarg);
+				break;
+			case 'x':
+				scale = atof(optarg);
+				break;
+			case 'm':
+				flat_out = 1;
+				break;
+			case 'w':
+				window = atof(optarg);
+				break;
+			case 'D':
+				dir = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (argc - optind < 1 || argc - optind > 2 || nthreads < 1 || nthreads > MAX_THREADS ||
+	    scale <= 0 || (argc - optind == 1 && window <= 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	b = malloc(sizeof(*b));
+	if (!b || (argc - optind == 2 && !(a = malloc(sizeof(*a))))) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	if ((status = stats_load(argv[argc - 1], b)) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[argc - 1], strerror(-status));
+		return 1;
+	}
+	if (a) {
+		if ((status = stats_load(argv[optind], a)) != 0) {
+			fprintf(stderr, "%s: %s\n", argv[optind], strerror(-status));
+			return 1;
+		}
+		if (b->time_ns <= a->time_ns) {
+			fprintf(stderr, "%s was not taken after %s\n", argv[optind + 1], argv[optind]);
+			return 1;
+		}
+	}
+	secs = a ? (b->time_ns - a->time_ns) / 1e9 : window;
+
+	// Leave room in the fd limit for stdio and each thread's scratch fds
+	pool_fds = POOL_FDS;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+		room = ((long)rl.rlim_cur - 16) / nthreads - 3;
+		if (room < pool_fds)
+			pool_fds = room > 0 ? room : 1;
+	}
+
+	if ((status = build_mix(a, b, secs, scale)) <= 0) {
+		fprintf(stderr, "%s\n", status ? strerror(-status) : "no syscalls to generate in the profile");
+		return 1;
+	}
+	if (!(results = calloc(nthreads * nmix, sizeof(*results)))) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if (flat_out)
+		fprintf(stderr, "generating %d syscalls flat out on %d threads for %.0fs\n", nmix, nthreads, duration);
+	else
+		fprintf(stderr, "generating %d syscalls at %.0f calls/s on %d threads for %.0fs\n", nmix,
+			total_rate, nthreads, duration);
+	if ((status = trace_pool_run(nthreads, nthreads, load_thread, NULL)) != 0) {
+		fprintf(stderr, "cannot start threads: %s\n", strerror(-status));
+		return 1;
+	}
+
+	printf("%-16s %8s %12s %12s %8s %10s\n", "syscall", "size", "target/s", "achieved/s", "errors", "avg_us");
+	for (i = 0; i < nmix; i++) {
+		calls = errors = ns = 0;
+		for (t = 0; t < nthreads; t++) {
+			calls += results[t * nmix + i].calls;
+			errors += results[t * nmix + i].errors;
+			ns += results[t * nmix + i].ns;
+		}
+		// Flat out, the target is only the share of the mix
+		printf("%-16s %8lu %11.0f%s %12.0f %8llu %10.2f\n", trace_syscall_name(mix[i].nr),
+			(unsigned long)mix[i].size, flat_out ? 100 * mix[i].rate / total_rate : mix[i].rate,
+			flat_out ? "%" : " ", calls / duration, (unsigned long long)errors, calls ? ns / 1e3 / calls : 0);
+	}
+
+	stats_free(b);
+	free(b);
+	if (a) {
+		stats_free(a);
+		free(a);
+	}
+	free(results);
+	free(mix);
+	return 0;
+}
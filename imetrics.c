@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "stats.h"
+#include "trace_reader.h"
+
+/**
+ * Prometheus / OpenMetrics exporter for the module's aggregate counters.
+ *
+ * Usage: ./imetrics [-l [addr:]port | -u socket] [-c seconds]
+ *   -l  listen for HTTP on a TCP port (default 127.0.0.1:9469)
+ *   -u  listen for HTTP on a Unix socket instead
+ *       (curl --unix-socket path http://localhost/metrics)
+ *   -c  how long a snapshot of STATS_PATH is reused (default 1s)
+ *
+ * GET /metrics returns, for every syscall with aggregation data:
+ *   interceptor_syscall_calls_total, _errors_total, _bytes_total,
+ *   interceptor_syscall_duration_seconds (histogram) and
+ *   interceptor_syscall_duration_max_seconds
+ * labelled with the syscall name and number.
+ *
+ * Scrapes are served from a cached response. STATS_PATH is read again at
+ * most once per -c interval, and then only the syscalls whose counters
+ * moved are formatted again; everything else is copied from the last
+ * rendering.
+ */
+
+#define DEFAULT_PORT            9469
+#define REQUEST_MAX             4096
+
+/* Bucket b covers [2^(b-1), 2^b) ns; le labels stop at 2^40 ns (~18 min) */
+#define EXPORT_BUCKETS          41
+
+enum family { FAM_CALLS, FAM_ERRORS, FAM_BYTES, FAM_DURATION, FAM_MAX, NFAMILIES };
+
+static const char *family_header[NFAMILIES] = {
+	"# TYPE interceptor_syscall_calls counter\n"
+	"# HELP interceptor_syscall_calls Calls of syscalls with aggregation on.\n",
+	"# TYPE interceptor_syscall_errors counter\n"
+	"# HELP interceptor_syscall_errors Calls that returned an error.\n",
+	"# TYPE interceptor_syscall_bytes counter\n"
+	"# UNIT interceptor_syscall_bytes bytes\n"
+	"# HELP interceptor_syscall_bytes Bytes moved by read/write-style calls.\n",
+	"# TYPE interceptor_syscall_duration_seconds histogram\n"
+	"# UNIT interceptor_syscall_duration_seconds seconds\n"
+	"# HELP interceptor_syscall_duration_seconds Time spent in the original syscall.\n",
+	"# TYPE interceptor_syscall_duration_max_seconds gauge\n"
+	"# UNIT interceptor_syscall_duration_max_seconds seconds\n"
+	"# HELP interceptor_syscall_duration_max_seconds Slowest call since the counters were reset.\n",
+};
+
+/* Growable text buffer */
+struct text {
+	char *s;
+	size_t len, cap;
+};
+
+/* The samples of one syscall, one text per family, and what they were rendered from */
+struct rendered {
+	struct text fam[NFAMILIES];
+	struct stats_syscall from;
+	int valid;
+};
+
+static struct rendered rendered[STATS_MAX_SYSCALL];
+static struct stats_snapshot snap;
+static struct text body;
+static double body_time;
+static double cache_secs = 1.0;
+static volatile sig_atomic_t done;
+
+static void on_signal(int sig) {
+	done = 1;
+}
+
+static double now_secs(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int text_reserve(struct text *t, size_t n) {
+
+	char *s;
+	size_t cap;
+
+	if (t->len + n + 1 <= t->cap)
+		return 0;
+	for (cap = t->cap ? t->cap : 256; cap < t->len + n + 1; cap *= 2)
+		;
+	if (!(s = realloc(t->s, cap)))
+		return -ENOMEM;
+	t->s = s;
+	t->cap = cap;
+	return 0;
+}
+
+static int text_printf(struct text *t, const char *fmt, ...) {
+
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (text_reserve(t, n) != 0)
+		return -ENOMEM;
+	va_start(ap, fmt);
+	vsnprintf(t->s + t->len, n + 1, fmt, ap);
+	va_end(ap);
+	t->len += n;
+	return 0;
+}
+
+static int text_append(struct text *t, const char *s, size_t n) {
+
+	if (text_reserve(t, n) != 0)
+		return -ENOMEM;
+	memcpy(t->s + t->len, s, n);
+	t->len += n;
+	t->s[t->len] = '\0';
+	return 0;
+}
+
+/* Format the samples of syscall nr into r */
+static int render_syscall(struct rendered *r, int nr, const struct stats_syscall *e) {
+
+	const char *name = trace_syscall_name(nr);
+	char labels[64];
+	uint64_t cum = 0;
+	int b, status = 0;
+
+	for (b = 0; b < NFAMILIES; b++)
+		r->fam[b].len = 0;
+	r->valid = 0;
+
+	if (name)
+		snprintf(labels, sizeof(labels), "syscall=\"%s\",nr=\"%d\"", name, nr);
+	else
+		snprintf(labels, sizeof(labels), "syscall=\"%d\",nr=\"%d\"", nr, nr);
+
+	status |= text_printf(&r->fam[FAM_CALLS], "interceptor_syscall_calls_total{%s} %llu\n",
+		labels, (unsigned long long)e->count);
+	status |= text_printf(&r->fam[FAM_ERRORS], "interceptor_syscall_errors_total{%s} %llu\n",
+		labels, (unsigned long long)e->errors);
+	status |= text_printf(&r->fam[FAM_BYTES], "interceptor_syscall_bytes_total{%s} %llu\n",
+		labels, (unsigned long long)e->bytes);
+
+	for (b = 0; b < EXPORT_BUCKETS; b++) {
+		cum += e->hist[b];
+		status |= text_printf(&r->fam[FAM_DURATION],
+			"interceptor_syscall_duration_seconds_bucket{%s,le=\"%.9g\"} %llu\n",
+			labels, b ? (double)(1ull << b) / 1e9 : 0.0, (unsigned long long)cum);
+	}
+	status |= text_printf(&r->fam[FAM_DURATION],
+		"interceptor_syscall_duration_seconds_bucket{%s,le=\"+Inf\"} %llu\n"
+		"interceptor_syscall_duration_seconds_sum{%s} %.9f\n"
+		"interceptor_syscall_duration_seconds_count{%s} %llu\n",
+		labels, (unsigned long long)e->count, labels, e->total_ns / 1e9,
+		labels, (unsigned long long)e->count);
+
+	status |= text_printf(&r->fam[FAM_MAX], "interceptor_syscall_duration_max_seconds{%s} %.9f\n",
+		labels, e->max_ns / 1e9);
+
+	if (status)
+		return -ENOMEM;
+	r->from = *e;
+	r->valid = 1;
+	return 0;
+}
+
+/**
+ * Make sure body holds an up-to-date response, reading STATS_PATH again
+ * if the cached snapshot is older than cache_secs.
+ */
+static int refresh(void) {
+
+	struct rendered *r;
+	double now = now_secs();
+	int nr, f, status;
+
+	if (body.len && now - body_time < cache_secs)
+		return 0;
+
+	if ((status = stats_load(STATS_PATH, &snap)) != 0)
+		return status;
+	stats_free(&snap);
+
+	for (nr = 0; nr < STATS_MAX_SYSCALL; nr++) {
+		const struct stats_syscall *e = &snap.sys[nr];
+
+		r = &rendered[nr];
+		if (!e->count) {
+			r->valid = 0;
+			continue;
+		}
+		// Unchanged counters: keep the text from last time
+		if (r->valid && r->from.count == e->count && r->from.total_ns == e->total_ns &&
+		    r->from.errors == e->errors)
+			continue;
+		if ((status = render_syscall(r, nr, e)) != 0)
+			return status;
+	}
+
+	body.len = 0;
+	for (f = 0; f < NFAMILIES; f++) {
+		if (text_append(&body, family_header[f], strlen(family_header[f])) != 0)
+			return -ENOMEM;
+		for (nr = 0; nr < STATS_MAX_SYSCALL; nr++) {
+			r = &rendered[nr];
+			if (r->valid && text_append(&body, r->fam[f].s, r->fam[f].len) != 0)
+				return -ENOMEM;
+		}
+	}
+	if (text_append(&body, "# EOF\n", 6) != 0)
+		return -ENOMEM;
+	body_time = now;
+	return 0;
+}
+
+static int write_all(int fd, const char *s, size_t n) {
+
+	ssize_t w;
+
+	while (n) {
+		if ((w = write(fd, s, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		s += w;
+		n -= w;
+	}
+	return 0;
+}
+
+static void respond(int fd, const char *status, const char *type, const char *s, size_t n) {
+
+	char hdr[256];
+	int len;
+
+	len = snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+		"Content-Length: %lu\r\nConnection: close\r\n\r\n", status, type, (unsigned long)n);
+	if (write_all(fd, hdr, len) == 0)
+		write_all(fd, s, n);
+}
+
+/* Read one HTTP request from a client and answer it */
+static void serve(int fd) {
+
+	char req[REQUEST_MAX], msg[128];
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	size_t len = 0;
+	ssize_t n;
+	int status;
+
+	// Only the request line matters; give slow clients a second to send it
+	while (len < sizeof(req) - 1 && !memchr(req, '\n', len)) {
+		if (poll(&pfd, 1, 1000) <= 0 || (n = read(fd, req + len, sizeof(req) - 1 - len)) <= 0)
+			return;
+		len += n;
+	}
+	req[len] = '\0';
+
+	if (strncmp(req, "GET ", 4) != 0) {
+		respond(fd, "405 Method Not Allowed", "text/plain", "", 0);
+	} else if (strncmp(req + 4, "/metrics ", 9) != 0 && strncmp(req + 4, "/ ", 2) != 0) {
+		respond(fd, "404 Not Found", "text/plain", "", 0);
+	} else if ((status = refresh()) != 0) {
+		n = snprintf(msg, sizeof(msg), "%s: %s\n", STATS_PATH, strerror(-status));
+		respond(fd, "503 Service Unavailable", "text/plain", msg, n);
+	} else {
+		respond(fd, "200 OK", "application/openmetrics-text; version=1.0.0; charset=utf-8",
+			body.s, body.len);
+	}
+}
+
+static int listen_tcp(const char *spec) {
+
+	struct sockaddr_in sa;
+	const char *colon = strrchr(spec, ':');
+	char addr[64] = "127.0.0.1";
+	int fd, one = 1;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	if (colon) {
+		snprintf(addr, sizeof(addr), "%.*s", (int)(colon - spec), spec);
+		spec = colon + 1;
+	}
+	sa.sin_port = htons(atoi(spec));
+	if (inet_pton(AF_INET, addr, &sa.sin_addr) != 1)
+		return -EINVAL;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -errno;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(fd, 16) != 0) {
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+static int listen_unix(const char *path) {
+
+	struct sockaddr_un sa;
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sa.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(sa.sun_path, path);
+	unlink(path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -errno;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(fd, 16) != 0) {
+		close(fd);
+		return -errno;
+	}
+	return fd;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-l [addr:]port | -u socket] [-c seconds]\n", prog);
+}
+
+int main(int argc, char **argv) {
+
+	struct sigaction sa;
+	const char *tcp = NULL, *sock = NULL;
+	char port[16];
+	int opt, fd, client;
+
+	while ((opt = getopt(argc, argv, "l:u:c:")) != -1) {
+		switch (opt) {
+			case 'l':
+				tcp = optarg;
+				break;
+			case 'u':
+				sock = optarg;
+				break;
+			case 'c':
+				cache_secs = atof(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (tcp && sock) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!sock && !tcp) {
+		snprintf(port, sizeof(port), "%d", DEFAULT_PORT);
+		tcp = port;
+	}
+
+	fd = sock ? listen_unix(sock) : listen_tcp(tcp);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", sock ? sock : tcp, strerror(-fd));
+		return 1;
+	}
+
+	// No SA_RESTART, so a signal interrupts accept()
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	// One client at a time: a scrape is a memcpy of the cached body
+	while (!done) {
+		if ((client = accept(fd, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+		serve(client);
+		close(client);
+	}
+
+	close(fd);
+	if (sock)
+		unlink(sock);
+	return 0;
+}
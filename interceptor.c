@@ -9,6 +9,28 @@
 #include <linux/spinlock.h>
 #include <linux/semaphore.h>
 #include <linux/syscalls.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/hash.h>
+#include <linux/err.h>
+#include <linux/seqlock.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/net.h>
+#include <linux/percpu.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/un.h>
+#include <linux/uio.h>
+#include <linux/stat.h>
+#include <linux/file.h>
+#include <linux/dcache.h>
+#include <linux/futex.h>
+#include <linux/sort.h>
 #include "interceptor.h"
 
 MODULE_DESCRIPTION("My kernel module");
@@ -49,12 +71,46 @@ void set_addr_ro(unsigned long addr) {
  * It's highly unlikely that you will need any globals other than these.
  */
 
-/* List structure - each intercepted syscall may have a list of monitored pids */
+/**
+ * Monitoring is configured per session (see MAX_SESSIONS in interceptor.h):
+ * session 0 logs with printk as it always has, the others each have their
+ * own buffer. Targets of all sessions are kept together, tagged with the
+ * sessions they belong to, so interceptor() works out every session that
+ * wants a call with a single pass over them.
+ */
+#define SESSION_BIT(s)  (1u << (s))
+
+/* Each syscall can also be monitored for a few uids and gids per session */
+#define MONITOR_IDS     (8 * MAX_SESSIONS)
+#define NO_ID           ((unsigned int)-1)
+#define ID_UID          0
+#define ID_GID          1
+
+/* ... and for tasks whose command or executable matches a few patterns */
+#define MONITOR_PATTERNS        8
+#define MONITOR_PATTERN_LEN     256
+
+/**
+ * List structure - each intercepted syscall may have a list of monitored pids.
+ * Pids are held as struct pid references rather than numbers: a number
+ * means different tasks in different pid namespaces, and can be reused
+ * once its task is gone, while the struct pid a task is started with is
+ * the same one interceptor() finds with task_pid(current).
+ */
 struct pid_list {
-	pid_t pid;
+	struct pid *pid;
+	/* SESSION_BIT()s of the sessions that listed this pid */
+	unsigned int sessions;
 	struct list_head list;
 };
 
+/* A monitoring limit of one session on one syscall (see clear_monitoring) */
+struct session_limit {
+	struct delayed_work expire_work;
+	atomic_t budget;
+	int sysc, session;
+};
+
 
 /* Store info about intercepted/replaced system calls */
 typedef struct {
@@ -70,13 +126,50 @@ typedef struct {
 	/* Status: 1=intercepted, 0=not intercepted */
 	int intercepted;
 
-	/* Are any PIDs being monitored for this syscall? */
-	int monitored;
-	/* List of monitored PIDs */
-	int listcount;
+	/* Are any PIDs being monitored for this syscall, per session? */
+	int monitored[MAX_SESSIONS];
+	/* The same as masks: sessions with monitored == 1 and == 2 */
+	unsigned int some_mask, all_mask;
+	/* Are calls being timed and counted in the per-CPU stats? */
+	int aggregated;
+	/* ... and in the per-process exit summaries? */
+	int summarized;
+	/* Rate limit on the calls, or NULL (see throttle_take) */
+	struct throttle *throttle;
+	/* Delay added to the calls, or NULL (see injection_delay) */
+	struct injection *injection;
+	/* Bytes of the user buffer logged with each call, 0 for none */
+	int capture;
+	/* Whether struct arguments are decoded into the events */
+	int decode;
+	/* FDPATH_TAG and FDPATH_TRACK bits, or 0 (see Fd paths) */
+	int fdpath;
+	/* Whether futex waits are profiled (see Futex contention) */
+	int contention;
+	/* Whether calls keep the lineage table (see Process lineage) */
+	int lineage;
+	/* Whether calls keep the fd lifetime table (see Fd lifetimes) */
+	int fdlife;
+	/* List of monitored PIDs, shared by all sessions, and each session's count */
+	int listcount[MAX_SESSIONS];
 	struct list_head my_list;
+	/* Monitored uids (ids[ID_UID]) and gids (ids[ID_GID]), NO_ID if free,
+	 * and the session each slot belongs to */
+	unsigned int ids[2][MONITOR_IDS];
+	unsigned char id_session[2][MONITOR_IDS];
+	int nids;
+	/* Bit i set if a session monitors tasks matching exec_patterns[i], and
+	 * which sessions those are */
+	unsigned int patterns;
+	unsigned char pattern_sessions[MONITOR_PATTERNS];
+	/* Sessions with an event budget, and each session's limits */
+	unsigned int budget_mask;
+	struct session_limit limits[MAX_SESSIONS];
 }mytable;
 
+struct throttle;
+struct injection;
+
 /* An entry for each system call */
 mytable table[NR_syscalls+1];
 
@@ -93,84 +186,125 @@ spinlock_t calltable_lock = SPIN_LOCK_UNLOCKED;
  */
 
 /**
- * Add a pid to a syscall's list of monitored pids.
- * Returns -ENOMEM if the operation is unsuccessful.
+ * Recompute a syscall's session masks after its monitored[] flags changed.
  */
-static int add_pid_sysc(pid_t pid, int sysc)
-{
-	struct pid_list *ple=(struct pid_list*)kmalloc(sizeof(struct pid_list), GFP_KERNEL);
+static void update_masks(int sysc) {
 
-	if (!ple)
-		return -ENOMEM;
+	int s;
 
-	INIT_LIST_HEAD(&ple->list);
-	ple->pid=pid;
+	table[sysc].some_mask = 0;
+	table[sysc].all_mask = 0;
+	for (s = 0; s < MAX_SESSIONS; s++) {
+		if (table[sysc].monitored[s] == 1)
+			table[sysc].some_mask |= SESSION_BIT(s);
+		else if (table[sysc].monitored[s] == 2)
+			table[sysc].all_mask |= SESSION_BIT(s);
+	}
+}
 
-	list_add(&ple->list, &(table[sysc].my_list));
-	table[sysc].listcount++;
+/* A pid's entry in a syscall's list, or NULL */
+static struct pid_list *find_pid_sysc(struct pid *pid, int sysc) {
 
-	return 0;
+	struct list_head *i;
+	struct pid_list *ple;
+
+	list_for_each(i, &(table[sysc].my_list)) {
+
+		ple=list_entry(i, struct pid_list, list);
+		if(ple->pid == pid)
+			return ple;
+	}
+	return NULL;
 }
 
 /**
- * Remove a pid from a system call's list of monitored pids.
- * Returns -EINVAL if no such pid was found in the list.
+ * Add a pid to a syscall's list of monitored pids for a session.
+ * Returns -ENOMEM if the operation is unsuccessful.
  */
-static int del_pid_sysc(pid_t pid, int sysc)
+static int add_pid_sysc(struct pid *pid, int sysc, int session)
 {
-	struct list_head *i;
-	struct pid_list *ple;
+	struct pid_list *ple = find_pid_sysc(pid, sysc);
 
-	list_for_each(i, &(table[sysc].my_list)) {
+	// Another session may have listed the pid already
+	if (!ple) {
+		ple=(struct pid_list*)kmalloc(sizeof(struct pid_list), GFP_KERNEL);
+		if (!ple)
+			return -ENOMEM;
 
-		ple=list_entry(i, struct pid_list, list);
-		if(ple->pid == pid) {
+		INIT_LIST_HEAD(&ple->list);
+		ple->pid=get_pid(pid);
+		ple->sessions=0;
+		list_add(&ple->list, &(table[sysc].my_list));
+	}
 
-			list_del(i);
-			kfree(ple);
+	ple->sessions |= SESSION_BIT(session);
+	table[sysc].listcount[session]++;
 
-			table[sysc].listcount--;
-			/* If there are no more pids in sysc's list of pids, then
-			 * stop the monitoring only if it's not for all pids (monitored=2) */
-			if(table[sysc].listcount == 0 && table[sysc].monitored == 1) {
-				table[sysc].monitored = 0;
-			}
+	return 0;
+}
 
-			return 0;
-		}
+/**
+ * Drop a session from a list entry, freeing the entry if no session is
+ * left, and stop the session's monitoring if its list became empty.
+ */
+static void unlist_pid_sysc(struct pid_list *ple, int sysc, int session)
+{
+	ple->sessions &= ~SESSION_BIT(session);
+	if (!ple->sessions) {
+		list_del(&ple->list);
+		put_pid(ple->pid);
+		kfree(ple);
 	}
 
-	return -EINVAL;
+	table[sysc].listcount[session]--;
+	/* If there are no more pids in sysc's list of pids, then
+	 * stop the monitoring only if it's not for all pids (monitored=2) */
+	if(table[sysc].listcount[session] == 0 && table[sysc].monitored[session] == 1) {
+		table[sysc].monitored[session] = 0;
+		update_masks(sysc);
+	}
+}
+
+/**
+ * Remove a pid from a system call's list of monitored pids for a session.
+ * Returns -EINVAL if no such pid was found in the list.
+ */
+static int del_pid_sysc(struct pid *pid, int sysc, int session)
+{
+	struct pid_list *ple = find_pid_sysc(pid, sysc);
+
+	if (!ple || !(ple->sessions & SESSION_BIT(session)))
+		return -EINVAL;
+
+	unlist_pid_sysc(ple, sysc, session);
+	return 0;
 }
 
 /**
- * Remove a pid from all the lists of monitored pids (for all intercepted syscalls).
+ * Remove a pid from all the lists of monitored pids (for all intercepted
+ * syscalls and all sessions).
  * Returns -1 if this process is not being monitored in any list.
  */
-static int del_pid(pid_t pid)
+static int del_pid(struct pid *pid)
 {
-	struct list_head *i, *n;
 	struct pid_list *ple;
-	int ispid = 0, s = 0;
+	int ispid = 0, s = 0, session;
 
 	for(s = 1; s < NR_syscalls; s++) {
 
-		list_for_each_safe(i, n, &(table[s].my_list)) {
-
-			ple=list_entry(i, struct pid_list, list);
-			if(ple->pid == pid) {
+		ple = find_pid_sysc(pid, s);
+		if (!ple)
+			continue;
 
-				list_del(i);
-				ispid = 1;
-				kfree(ple);
-
-				table[s].listcount--;
-				/* If there are no more pids in sysc's list of pids, then
-				 * stop the monitoring only if it's not for all pids (monitored=2) */
-				if(table[s].listcount == 0 && table[s].monitored == 1) {
-					table[s].monitored = 0;
-				}
+		ispid = 1;
+		for (session = 0; session < MAX_SESSIONS; session++) {
+			// The last session frees the entry
+			if (ple->sessions == SESSION_BIT(session)) {
+				unlist_pid_sysc(ple, s, session);
+				break;
 			}
+			if (ple->sessions & SESSION_BIT(session))
+				unlist_pid_sysc(ple, s, session);
 		}
 	}
 
@@ -179,9 +313,9 @@ static int del_pid(pid_t pid)
 }
 
 /**
- * Clear the list of monitored pids for a specific syscall.
+ * Clear a session's list of monitored pids for a specific syscall.
  */
-static void destroy_list(int sysc) {
+static void destroy_list(int sysc, int session) {
 
 	struct list_head *i, *n;
 	struct pid_list *ple;
@@ -189,12 +323,17 @@ static void destroy_list(int sysc) {
 	list_for_each_safe(i, n, &(table[sysc].my_list)) {
 
 		ple=list_entry(i, struct pid_list, list);
-		list_del(i);
-		kfree(ple);
+		ple->sessions &= ~SESSION_BIT(session);
+		if (!ple->sessions) {
+			list_del(i);
+			put_pid(ple->pid);
+			kfree(ple);
+		}
 	}
 
-	table[sysc].listcount = 0;
-	table[sysc].monitored = 0;
+	table[sysc].listcount[session] = 0;
+	table[sysc].monitored[session] = 0;
+	update_masks(sysc);
 }
 
 /**
@@ -203,70 +342,3123 @@ static void destroy_list(int sysc) {
  * Remember that when requesting to start monitoring for a pid, only the
  * owner of that pid is allowed to request that.
  */
-static int check_pid_from_list(pid_t pid1, pid_t pid2) {
+static int check_pid_from_list(struct pid *pid1, struct pid *pid2) {
 
-	struct task_struct *p1 = pid_task(find_vpid(pid1), PIDTYPE_PID);
-	struct task_struct *p2 = pid_task(find_vpid(pid2), PIDTYPE_PID);
-	if(p1->real_cred->uid != p2->real_cred->uid)
+	struct task_struct *p1 = pid_task(pid1, PIDTYPE_PID);
+	struct task_struct *p2 = pid_task(pid2, PIDTYPE_PID);
+	if(!p1 || !p2 || p1->real_cred->uid != p2->real_cred->uid)
 		return -EPERM;
 	return 0;
 }
 
 /**
- * Check if a pid is already being monitored for a specific syscall.
+ * Check if a pid is already being monitored for a specific syscall by a session.
  * Returns 1 if it already is, or 0 if pid is not in sysc's list.
  */
-static int check_pid_monitored(int sysc, pid_t pid) {
+static int check_pid_monitored(int sysc, struct pid *pid, int session) {
 
-	struct list_head *i;
-	struct pid_list *ple;
+	struct pid_list *ple = find_pid_sysc(pid, sysc);
 
-	list_for_each(i, &(table[sysc].my_list)) {
+	return ple && (ple->sessions & SESSION_BIT(session));
+}
 
-		ple=list_entry(i, struct pid_list, list);
-		if(ple->pid == pid)
+/**
+ * The sessions that listed a pid for a syscall, with one walk of the list.
+ */
+static unsigned int pid_sessions(int sysc, struct pid *pid) {
+
+	struct pid_list *ple = find_pid_sysc(pid, sysc);
+
+	return ple ? ple->sessions : 0;
+}
+//----------------------------------------------------------------
+
+//----- Uid/gid monitoring targets -------------------------------
+/**
+ * Besides pids, a syscall can be monitored for every process running as a
+ * given uid or gid. The targets live in small fixed arrays in the table
+ * entry, each slot tagged with the session it belongs to. They are only
+ * changed under calltable_lock, one slot at a time, and a slot's session
+ * is set before its id is published, so interceptor() can scan them
+ * without taking any lock.
+ */
+
+/**
+ * Add id to a session's uid or gid targets for a syscall.
+ * Returns -EBUSY if it is already there, or -ENOMEM if all slots are taken.
+ */
+static int add_id_sysc(int sysc, int which, unsigned int id, int session) {
+
+	unsigned int *ids = table[sysc].ids[which];
+	int i, slot = -1;
+
+	for (i = 0; i < MONITOR_IDS; i++) {
+		if (ids[i] == id && table[sysc].id_session[which][i] == session)
+			return -EBUSY;
+		if (ids[i] == NO_ID && slot < 0)
+			slot = i;
+	}
+	if (slot < 0)
+		return -ENOMEM;
+
+	table[sysc].id_session[which][slot] = session;
+	smp_wmb();
+	ids[slot] = id;
+	table[sysc].nids++;
+	return 0;
+}
+
+/**
+ * Remove id from a session's uid or gid targets for a syscall.
+ * Returns -EINVAL if it was not there.
+ */
+static int del_id_sysc(int sysc, int which, unsigned int id, int session) {
+
+	unsigned int *ids = table[sysc].ids[which];
+	int i;
+
+	for (i = 0; i < MONITOR_IDS; i++) {
+		if (ids[i] == id && table[sysc].id_session[which][i] == session) {
+			ids[i] = NO_ID;
+			table[sysc].nids--;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+/* Does a session have any uid or gid targets for sysc? */
+static int has_id_targets(int sysc, int session) {
+
+	int which, i;
+
+	for (which = ID_UID; which <= ID_GID; which++) {
+		for (i = 0; i < MONITOR_IDS; i++) {
+			if (table[sysc].ids[which][i] != NO_ID && table[sysc].id_session[which][i] == session)
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * The sessions monitoring the current process's uid or gid for sysc.
+ * Called without locks: a target being changed concurrently is either
+ * seen or not, never half-written.
+ */
+static unsigned int id_sessions(int sysc) {
+
+	uid_t uid = current_uid();
+	gid_t gid = current_gid();
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; i < MONITOR_IDS; i++) {
+		if (ACCESS_ONCE(table[sysc].ids[ID_UID][i]) == uid) {
+			smp_rmb();
+			mask |= SESSION_BIT(table[sysc].id_session[ID_UID][i]);
+		}
+		if (ACCESS_ONCE(table[sysc].ids[ID_GID][i]) == gid) {
+			smp_rmb();
+			mask |= SESSION_BIT(table[sysc].id_session[ID_GID][i]);
+		}
+	}
+	return mask;
+}
+//----------------------------------------------------------------
+
+//----- Executable name monitoring targets -----------------------
+/**
+ * A syscall can be monitored for every task whose command name, or
+ * executable path for patterns starting with '/', matches a shell-style
+ * pattern ('*' and '?'). Patterns are shared between syscalls and
+ * sessions: each syscall has a bitmask of the exec_patterns[] it is
+ * monitored for, and for each of those the sessions that want it.
+ *
+ * Matching strings on every call would be far too slow, so the set of
+ * patterns a task matches is worked out once per exec and kept in a
+ * table indexed by pid, with the task's start time and exec count
+ * (self_exec_id) to tell when it is stale. Every live task has its own
+ * pid, so a task's entry is never taken by another one, and only the
+ * task itself reads or writes it: no locking is needed. Changing the
+ * patterns bumps exec_patterns_gen, which invalidates every stored
+ * result; the patterns are read under exec_patterns_seq, so a match that
+ * raced with a change is done again. A task renaming itself after exec
+ * is not noticed.
+ */
+
+struct exec_pattern {
+	char pattern[MONITOR_PATTERN_LEN];
+	int used;
+};
+
+struct exec_task {
+	u64 start_ns;
+	u32 exec_id;
+	unsigned int gen;
+	unsigned int match;
+};
+
+/* Written under calltable_lock, inside exec_patterns_seq */
+static struct exec_pattern exec_patterns[MONITOR_PATTERNS];
+static unsigned int exec_patterns_gen;
+static seqcount_t exec_patterns_seq;
+
+/* PID_MAX_LIMIT entries, so that pid_max can never outgrow it */
+static struct exec_task *exec_tasks;
+
+/* Shell-style match of str against pattern, with '*' and '?' */
+static int glob_match(const char *pattern, const char *str) {
+
+	const char *star = NULL, *retry = NULL;
+
+	while (*str) {
+		if (*pattern == '*') {
+			// Remember where to resume if the rest does not match
+			star = ++pattern;
+			retry = str;
+		} else if (*pattern == '?' || *pattern == *str) {
+			pattern++;
+			str++;
+		} else if (star) {
+			pattern = star;
+			str = ++retry;
+		} else {
+			return 0;
+		}
+	}
+	while (*pattern == '*')
+		pattern++;
+	return *pattern == '\0';
+}
+
+/**
+ * Work out which patterns the current task matches, and the
+ * exec_patterns_gen they were matched against. Only called once per exec
+ * (or pattern change), so it may take the mmap semaphore.
+ */
+static unsigned int exec_match_patterns(unsigned int *gen) {
+
+	char comm[TASK_COMM_LEN], buf[MONITOR_PATTERN_LEN];
+	struct mm_struct *mm = current->mm;
+	char *path = NULL;
+	unsigned int match, seq;
+	int i, paths;
+
+	get_task_comm(comm, current);
+
+	// Path of the executable, if any pattern wants it
+	do {
+		seq = read_seqcount_begin(&exec_patterns_seq);
+		for (i = 0, paths = 0; i < MONITOR_PATTERNS; i++)
+			paths |= exec_patterns[i].used && exec_patterns[i].pattern[0] == '/';
+	} while (read_seqcount_retry(&exec_patterns_seq, seq));
+	if (paths && mm) {
+		down_read(&mm->mmap_sem);
+		if (mm->exe_file) {
+			path = d_path(&mm->exe_file->f_path, buf, sizeof(buf));
+			if (IS_ERR(path))
+				path = NULL;
+		}
+		up_read(&mm->mmap_sem);
+	}
+
+	// A torn pattern still ends in a NUL: its last byte is never written otherwise
+	do {
+		seq = read_seqcount_begin(&exec_patterns_seq);
+		*gen = exec_patterns_gen;
+		match = 0;
+		for (i = 0; i < MONITOR_PATTERNS; i++) {
+			const char *pattern = exec_patterns[i].pattern;
+
+			if (!exec_patterns[i].used)
+				continue;
+			if (pattern[0] == '/' ? path && glob_match(pattern, path) : glob_match(pattern, comm))
+				match |= 1 << i;
+		}
+	} while (read_seqcount_retry(&exec_patterns_seq, seq));
+	return match;
+}
+
+/* Bitmask of the patterns the current task matches, matching only after an exec */
+static unsigned int exec_match(void) {
+
+	struct exec_task *t = &exec_tasks[current->pid];
+	u64 start_ns = timespec_to_ns(&current->start_time);
+
+	if (t->start_ns != start_ns || t->exec_id != current->self_exec_id ||
+			t->gen != ACCESS_ONCE(exec_patterns_gen)) {
+		t->match = exec_match_patterns(&t->gen);
+		t->start_ns = start_ns;
+		t->exec_id = current->self_exec_id;
+	}
+	return t->match;
+}
+
+/**
+ * Monitor sysc for tasks matching pattern in a session.
+ * Returns -EBUSY if it already is, or -ENOMEM if all pattern slots are taken.
+ */
+static int add_pattern_sysc(int sysc, const char *pattern, int session) {
+
+	int i, slot = -1;
+
+	for (i = 0; i < MONITOR_PATTERNS; i++) {
+		if (exec_patterns[i].used && strcmp(exec_patterns[i].pattern, pattern) == 0)
+			break;
+		if (!exec_patterns[i].used && slot < 0)
+			slot = i;
+	}
+	if (i == MONITOR_PATTERNS) {
+		if (slot < 0)
+			return -ENOMEM;
+		write_seqcount_begin(&exec_patterns_seq);
+		strcpy(exec_patterns[slot].pattern, pattern);
+		exec_patterns[slot].used = 1;
+		exec_patterns_gen++;
+		write_seqcount_end(&exec_patterns_seq);
+		i = slot;
+	}
+
+	if (table[sysc].pattern_sessions[i] & SESSION_BIT(session))
+		return -EBUSY;
+	table[sysc].pattern_sessions[i] |= SESSION_BIT(session);
+	table[sysc].patterns |= 1 << i;
+	return 0;
+}
+
+/**
+ * Drop a session from pattern i on sysc, freeing the pattern once no
+ * syscall uses it.
+ */
+static void drop_pattern_sysc(int sysc, int i, int session) {
+
+	int s;
+
+	table[sysc].pattern_sessions[i] &= ~SESSION_BIT(session);
+	if (table[sysc].pattern_sessions[i])
+		return;
+	table[sysc].patterns &= ~(1 << i);
+
+	for (s = 0; s < NR_syscalls; s++) {
+		if (table[s].patterns & (1 << i))
+			return;
+	}
+	write_seqcount_begin(&exec_patterns_seq);
+	exec_patterns[i].used = 0;
+	exec_patterns_gen++;
+	write_seqcount_end(&exec_patterns_seq);
+}
+
+/**
+ * Stop monitoring sysc for tasks matching pattern in a session.
+ * Returns -EINVAL if sysc was not monitored for it.
+ */
+static int del_pattern_sysc(int sysc, const char *pattern, int session) {
+
+	int i;
+
+	for (i = 0; i < MONITOR_PATTERNS; i++) {
+		if (exec_patterns[i].used && strcmp(exec_patterns[i].pattern, pattern) == 0)
+			break;
+	}
+	if (i == MONITOR_PATTERNS || !(table[sysc].pattern_sessions[i] & SESSION_BIT(session)))
+		return -EINVAL;
+
+	drop_pattern_sysc(sysc, i, session);
+	return 0;
+}
+
+/**
+ * The sessions monitoring sysc for the patterns the current task matches.
+ */
+static unsigned int exec_sessions(int sysc) {
+
+	unsigned int match = exec_match() & table[sysc].patterns;
+	unsigned int mask = 0;
+	int i;
+
+	for (i = 0; match; i++, match >>= 1) {
+		if (match & 1)
+			mask |= table[sysc].pattern_sessions[i];
+	}
+	return mask;
+}
+
+static int exec_match_init(void) {
+
+	seqcount_init(&exec_patterns_seq);
+	exec_tasks = vmalloc(PID_MAX_LIMIT * sizeof(*exec_tasks));
+	if (!exec_tasks)
+		return -ENOMEM;
+	memset(exec_tasks, 0, PID_MAX_LIMIT * sizeof(*exec_tasks));
+	return 0;
+}
+
+static void exec_match_cleanup(void) {
+
+	vfree(exec_tasks);
+	exec_tasks = NULL;
+}
+//----------------------------------------------------------------
+
+//----- Monitoring limits ----------------------------------------
+/**
+ * A session's monitoring of a syscall can be given a time limit or an
+ * event budget. When either runs out, the limit's expire_work clears all
+ * of the session's targets for the syscall (pids, all-pids, uids/gids and
+ * patterns) at once. The timeout is the delay of the work itself; the
+ * budget is counted down in interceptor(), which stops logging for the
+ * session as soon as it is spent and leaves the clearing to the work.
+ */
+
+/* Stop all of a session's monitoring of sysc. Called with both locks held. */
+static void clear_monitoring(int sysc, int session) {
+
+	int which, i;
+
+	destroy_list(sysc, session);
+	for (which = ID_UID; which <= ID_GID; which++) {
+		for (i = 0; i < MONITOR_IDS; i++) {
+			if (table[sysc].ids[which][i] != NO_ID && table[sysc].id_session[which][i] == session) {
+				table[sysc].ids[which][i] = NO_ID;
+				table[sysc].nids--;
+			}
+		}
+	}
+	for (i = 0; i < MONITOR_PATTERNS; i++) {
+		if (table[sysc].pattern_sessions[i] & SESSION_BIT(session))
+			drop_pattern_sysc(sysc, i, session);
+	}
+
+	table[sysc].budget_mask &= ~SESSION_BIT(session);
+}
+
+static void monitoring_expire(struct work_struct *work) {
+
+	struct session_limit *limit = container_of(work, struct session_limit, expire_work.work);
+
+	spin_lock(&calltable_lock);
+	spin_lock(&pidlist_lock);
+	clear_monitoring(limit->sysc, limit->session);
+	spin_unlock(&pidlist_lock);
+	spin_unlock(&calltable_lock);
+
+	printk(KERN_INFO "interceptor: session %d monitoring of syscall %d expired\n",
+		limit->session, limit->sysc);
+}
+
+/**
+ * Count down the budgets of the sessions in mask that have one, and drop
+ * the sessions whose budget is spent. The last event of a budget hands
+ * over to expire_work.
+ */
+static unsigned int spend_budget(int sysc, unsigned int mask) {
+
+	unsigned int budgeted = mask & table[sysc].budget_mask;
+	struct session_limit *limit;
+	long left;
+	int s;
+
+	for (s = 0; budgeted; s++, budgeted >>= 1) {
+		if (!(budgeted & 1))
+			continue;
+		limit = &table[sysc].limits[s];
+		left = atomic_dec_return(&limit->budget);
+		if (left < 0) {
+			mask &= ~SESSION_BIT(s);
+		} else if (left == 0) {
+			// Bring a pending timeout forward to now
+			cancel_delayed_work(&limit->expire_work);
+			schedule_delayed_work(&limit->expire_work, 0);
+		}
+	}
+	return mask;
+}
+
+/* Is anything being monitored for sysc by a session? */
+static int is_monitored(int sysc, int session) {
+
+	int i;
+
+	if (table[sysc].monitored[session] || has_id_targets(sysc, session))
+		return 1;
+	for (i = 0; i < MONITOR_PATTERNS; i++) {
+		if (table[sysc].pattern_sessions[i] & SESSION_BIT(session))
 			return 1;
+	}
+	return 0;
+}
+//----------------------------------------------------------------
+
+//----- Intercepting exit_group ----------------------------------
+/**
+ * Since a process can exit without its owner specifically requesting
+ * to stop monitoring it, we must intercept the exit_group system call
+ * so that we can remove the exiting process's pid from *all* syscall lists.
+ */
+
+/**
+ * Stores original exit_group function - after all, we must restore it
+ * when our kernel module exits.
+ */
+void (*orig_exit_group)(int);
+
+static void summary_exit_group(int status);
+static void fdpath_exit_group(void);
+static void lineage_exit_group(int status);
+static void fdlife_exit_group(void);
+
+/**
+ * Our custom exit_group system call.
+ *
+ * TODO: When a process exits, make sure to remove that pid from all lists.
+ * The exiting process's pid is task_pid(current), as in interceptor().
+ * Don't forget to call the original exit_group.
+ */
+void my_exit_group(int status)
+{
+	// Lock Access
+    spin_lock(&calltable_lock);
+    spin_lock(&pidlist_lock);
 
+	// Delete the pid from all list of monitored pids.
+	del_pid(task_pid(current));
+
+	// Unlock Access
+    spin_unlock(&pidlist_lock);
+    spin_unlock(&calltable_lock);
+
+	// Write out the process's syscall profile, if it has one
+	summary_exit_group(status);
+	// Its fds are about to be closed without close
+	fdpath_exit_group();
+	fdlife_exit_group();
+	lineage_exit_group(status);
+
+	// Original Exit Group Call
+	orig_exit_group(status);
+}
+//----------------------------------------------------------------
+
+
+
+//----- In-kernel aggregation ------------------------------------
+/**
+ * When aggregation is turned on for an intercepted syscall, interceptor()
+ * times every call and adds it to counters that belong to the current CPU,
+ * so the hot path takes no lock and shares no cache lines. Per-process
+ * totals go into a small per-CPU hash of tgids. Readers add up all CPUs
+ * when /proc/interceptor/stats is read (see interceptor.h for the format).
+ * Counters are read without locking, so a snapshot may be slightly torn.
+ * Aggregated mmap, mmap2, munmap, mremap and brk calls also add the bytes
+ * they map or unmap, worked out from their lengths and return values, to
+ * their process, as an address space growth profile.
+ */
+
+#define STATS_PROC_SLOTS        512
+#define STATS_PROC_PROBES       8
+
+struct syscall_stats {
+	u64 count;
+	u64 errors;
+	u64 total_ns;
+	u64 max_ns;
+	u64 bytes;
+	u64 hist[STATS_HIST_BUCKETS];
+	/* Calls held back by a throttle, and for how long, or failed by one */
+	u64 delayed;
+	u64 delay_ns;
+	u64 rejected;
+};
+
+struct proc_stats {
+	pid_t tgid;
+	char comm[TASK_COMM_LEN];
+	u64 count;
+	u64 total_ns;
+	u64 bytes;
+	/* Calls that map or unmap memory, and the bytes they did */
+	u64 mem_calls;
+	u64 mapped;
+	u64 unmapped;
+};
+
+struct cpu_stats {
+	struct syscall_stats sys[NR_syscalls+1];
+	struct proc_stats procs[STATS_PROC_SLOTS];
+};
+
+/* One block per possible CPU, only ever written by that CPU */
+static struct cpu_stats *stats_cpu[NR_CPUS];
+
+static struct proc_dir_entry *proc_dir;
+
+/**
+ * Does the return value of this syscall count bytes transferred?
+ */
+static int syscall_moves_bytes(int sysc) {
+
+	switch (sysc) {
+		case __NR_read:
+		case __NR_write:
+		case __NR_pread64:
+		case __NR_pwrite64:
+		case __NR_readv:
+		case __NR_writev:
+		case __NR_sendfile:
+		case __NR_sendfile64:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Does this syscall map or unmap memory?
+ */
+static int syscall_maps_memory(int sysc) {
+
+	switch (sysc) {
+		case __NR_mmap:
+		case __NR_mmap2:
+		case __NR_munmap:
+		case __NR_mremap:
+		case __NR_brk:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Bytes a successful call of sysc mapped (> 0) or unmapped (< 0), from
+ * its arguments and its return value ret. brk is the break before a brk
+ * call. Mappings replaced by MAP_FIXED or unmapped twice are not noticed.
+ */
+static s64 memory_growth(int sysc, const struct pt_regs *reg, long ret, unsigned long brk) {
+
+	unsigned long args[2];
+
+	if (IS_ERR_VALUE(ret)) {
+		return 0;
+	}
+
+	switch (sysc) {
+		case __NR_mmap:
+			// old_mmap takes its arguments in a struct: addr, len, ...
+			if (copy_from_user(args, (const void __user *)reg->bx, sizeof(args)))
+				return 0;
+			return PAGE_ALIGN(args[1]);
+		case __NR_mmap2:
+			return PAGE_ALIGN(reg->cx);
+		case __NR_munmap:
+			return -(s64)PAGE_ALIGN(reg->cx);
+		case __NR_mremap:
+			return (s64)PAGE_ALIGN(reg->dx) - (s64)PAGE_ALIGN(reg->cx);
+		case __NR_brk:
+			// brk returns the new break, or the old one if it failed
+			return (s64)(unsigned long)ret - (s64)brk;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Find (or claim) the slot for tgid in a CPU's process table.
+ * If all probed slots are taken, the one with the fewest calls is evicted.
+ */
+static struct proc_stats *proc_slot(struct cpu_stats *cs, pid_t tgid) {
+
+	struct proc_stats *p, *victim = NULL;
+	unsigned long h = hash_long(tgid, 9);
+	int i;
+
+	for (i = 0; i < STATS_PROC_PROBES; i++) {
+		p = &cs->procs[(h + i) % STATS_PROC_SLOTS];
+		if (p->tgid == tgid)
+			return p;
+		if (p->tgid == 0 || !victim || p->count < victim->count)
+			victim = p;
+		if (p->tgid == 0)
+			break;
+	}
+
+	memset(victim, 0, sizeof(*victim));
+	victim->tgid = tgid;
+	memcpy(victim->comm, current->comm, TASK_COMM_LEN);
+	return victim;
+}
+
+/**
+ * Account one completed call of sysc that returned ret after ns nanoseconds,
+ * and grew the address space by grown bytes (see memory_growth).
+ */
+static void stats_account(int sysc, long ret, u64 ns, s64 grown) {
+
+	struct cpu_stats *cs = stats_cpu[get_cpu()];
+	struct syscall_stats *s = &cs->sys[sysc];
+	struct proc_stats *p;
+	u64 bytes = (ret > 0 && syscall_moves_bytes(sysc)) ? ret : 0;
+
+	s->count++;
+	if (IS_ERR_VALUE(ret))
+		s->errors++;
+	s->total_ns += ns;
+	if (ns > s->max_ns)
+		s->max_ns = ns;
+	s->bytes += bytes;
+	s->hist[min_t(int, fls64(ns), STATS_HIST_BUCKETS - 1)]++;
+
+	p = proc_slot(cs, current->tgid);
+	p->count++;
+	p->total_ns += ns;
+	p->bytes += bytes;
+	if (syscall_maps_memory(sysc)) {
+		p->mem_calls++;
+		if (grown > 0)
+			p->mapped += grown;
+		else
+			p->unmapped -= grown;
+	}
+
+	put_cpu();
+}
+
+static void stats_reset(void) {
+
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(stats_cpu[cpu], 0, sizeof(struct cpu_stats));
+}
+
+/* Print comm with spaces replaced, so each record stays whitespace-separated */
+static void stats_show_comm(struct seq_file *m, const char *comm) {
+
+	char buf[TASK_COMM_LEN];
+	int i;
+
+	for (i = 0; i < TASK_COMM_LEN - 1 && comm[i]; i++)
+		buf[i] = (comm[i] == ' ') ? '_' : comm[i];
+	buf[i] = '\0';
+	seq_printf(m, "%s", i ? buf : "-");
+}
+
+static int stats_show(struct seq_file *m, void *v) {
+
+	struct syscall_stats *sum;
+	struct proc_stats *merged, *p, *q;
+	unsigned long nslots = STATS_PROC_SLOTS * 2 * num_possible_cpus(), h;
+	int cpu, sysc, i, b;
+
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	merged = vmalloc(nslots * sizeof(*merged));
+	if (!sum || !merged) {
+		kfree(sum);
+		vfree(merged);
+		return -ENOMEM;
+	}
+	memset(merged, 0, nslots * sizeof(*merged));
+
+	seq_printf(m, "time %llu\n", (unsigned long long)ktime_to_ns(ktime_get()));
+
+	for (sysc = 1; sysc <= NR_syscalls; sysc++) {
+		memset(sum, 0, sizeof(*sum));
+		for_each_possible_cpu(cpu) {
+			struct syscall_stats *s = &stats_cpu[cpu]->sys[sysc];
+			sum->delayed += s->delayed;
+			sum->delay_ns += s->delay_ns;
+			sum->rejected += s->rejected;
+			sum->count += s->count;
+			sum->errors += s->errors;
+			sum->total_ns += s->total_ns;
+			sum->bytes += s->bytes;
+			if (s->max_ns > sum->max_ns)
+				sum->max_ns = s->max_ns;
+			for (b = 0; b < STATS_HIST_BUCKETS; b++)
+				sum->hist[b] += s->hist[b];
+		}
+		// Throttles count even without aggregation
+		if (sum->delayed || sum->rejected)
+			seq_printf(m, "throttle %d %llu %llu %llu\n", sysc,
+				sum->delayed, sum->rejected, sum->delay_ns);
+		if (!sum->count)
+			continue;
+
+		seq_printf(m, "syscall %d %llu %llu %llu %llu %llu", sysc,
+			sum->count, sum->errors, sum->total_ns, sum->max_ns, sum->bytes);
+		for (b = 0; b < STATS_HIST_BUCKETS; b++) {
+			if (sum->hist[b])
+				seq_printf(m, " %d:%llu", b, sum->hist[b]);
+		}
+		seq_printf(m, "\n");
+	}
+
+	// The same tgid can have a slot on several CPUs; merge them first
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < STATS_PROC_SLOTS; i++) {
+			p = &stats_cpu[cpu]->procs[i];
+			if (!p->tgid)
+				continue;
+			h = hash_long(p->tgid, 16) % nslots;
+			for (q = &merged[h]; q->tgid && q->tgid != p->tgid; q = &merged[h]) {
+				h = (h + 1) % nslots;
+			}
+			if (!q->tgid) {
+				q->tgid = p->tgid;
+				memcpy(q->comm, p->comm, TASK_COMM_LEN);
+			}
+			q->count += p->count;
+			q->total_ns += p->total_ns;
+			q->bytes += p->bytes;
+			q->mem_calls += p->mem_calls;
+			q->mapped += p->mapped;
+			q->unmapped += p->unmapped;
+		}
+	}
+	for (h = 0; h < nslots; h++) {
+		q = &merged[h];
+		if (!q->tgid)
+			continue;
+		seq_printf(m, "process %d ", q->tgid);
+		stats_show_comm(m, q->comm);
+		seq_printf(m, " %llu %llu %llu\n", q->count, q->total_ns, q->bytes);
+		if (q->mem_calls)
+			seq_printf(m, "memory %d %llu %llu %llu\n", q->tgid, q->mem_calls, q->mapped, q->unmapped);
+	}
+
+	vfree(merged);
+	kfree(sum);
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file) {
+	return single_open(file, stats_show, NULL);
+}
+
+/* Any write resets the counters */
+static ssize_t stats_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+
+	if (current_uid() != 0)
+		return -EPERM;
+	stats_reset();
+	return count;
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.write = stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int stats_init(void) {
+
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stats_cpu[cpu] = vmalloc(sizeof(struct cpu_stats));
+		if (!stats_cpu[cpu])
+			return -ENOMEM;
+	}
+	stats_reset();
+
+	proc_dir = proc_mkdir("interceptor", NULL);
+	if (!proc_dir)
+		return -ENOMEM;
+	if (!proc_create("stats", 0644, proc_dir, &stats_fops))
+		return -ENOMEM;
+	return 0;
+}
+
+static void stats_exit(void) {
+
+	int cpu;
+
+	if (proc_dir) {
+		remove_proc_entry("stats", proc_dir);
+		remove_proc_entry("interceptor", NULL);
+		proc_dir = NULL;
+	}
+	for_each_possible_cpu(cpu) {
+		vfree(stats_cpu[cpu]);
+		stats_cpu[cpu] = NULL;
+	}
+}
+//----------------------------------------------------------------
+
+
+
+//----- Rate throttling ------------------------------------------
+/**
+ * An intercepted syscall can be given a rate limit, either for a single
+ * process or for every process separately. Each process has a token
+ * bucket of burst calls refilled at rate calls per second, kept as the
+ * time at which the bucket will be full again (tat, as in GCRA), so a
+ * bucket is a single timestamp. A call that finds the bucket empty is
+ * either delayed until its token is due, or failed with -EAGAIN without
+ * calling the original syscall. Rules and buckets are only touched under
+ * calltable_lock, which interceptor() holds anyway; the sleep happens
+ * after the lock is dropped. Throttle hits go into the per-CPU stats.
+ */
+
+#define THROTTLE_BUCKETS        256
+#define THROTTLE_PROBES         8
+
+struct throttle_bucket {
+	pid_t tgid;
+	u64 tat;
+};
+
+struct throttle {
+	/* The process throttled, or NULL for every process */
+	struct pid *pid;
+	u64 interval_ns;
+	/* How far ahead of now tat may run: (burst - 1) intervals */
+	u64 slack_ns;
+	int policy;
+	struct throttle_bucket buckets[THROTTLE_BUCKETS];
+};
+
+/* The current process's bucket; idle buckets (full again) are reused */
+static struct throttle_bucket *throttle_bucket(struct throttle *t, u64 now) {
+
+	struct throttle_bucket *b, *victim = NULL;
+	pid_t tgid = current->tgid;
+	unsigned long h = hash_long(tgid, 8);
+	int i;
+
+	if (t->pid)
+		return &t->buckets[0];
+
+	for (i = 0; i < THROTTLE_PROBES; i++) {
+		b = &t->buckets[(h + i) % THROTTLE_BUCKETS];
+		if (b->tgid == tgid)
+			return b;
+		if (!victim || b->tat < victim->tat)
+			victim = b;
+	}
+	// All probed buckets busy: the fullest one is reset
+	victim->tgid = tgid;
+	victim->tat = now;
+	return victim;
+}
+
+/**
+ * Take a token for the current call of a throttled syscall.
+ * Returns 0 if the call may go ahead, the delay in ns if it must wait for
+ * its token, or -EAGAIN if it must fail. Called with calltable_lock held.
+ */
+static s64 throttle_take(struct throttle *t) {
+
+	struct throttle_bucket *b;
+	u64 now, tat;
+
+	if (t->pid && t->pid != task_tgid(current))
+		return 0;
+
+	now = ktime_to_ns(ktime_get());
+	b = throttle_bucket(t, now);
+	tat = max(b->tat, now);
+	if (tat - now > t->slack_ns && t->policy == THROTTLE_FAIL)
+		return -EAGAIN;
+
+	// Delayed calls queue up: each one takes the next token
+	b->tat = tat + t->interval_ns;
+	return tat - now > t->slack_ns ? tat - now - t->slack_ns : 0;
+}
+
+/**
+ * Sleep for ns in the calling task, on a high resolution timer since
+ * delays can be far shorter than a jiffy. A fatal signal cuts it short.
+ */
+static void sleep_ns(u64 ns) {
+
+	ktime_t expires = ns_to_ktime(ns);
+
+	set_current_state(TASK_KILLABLE);
+	schedule_hrtimeout(&expires, HRTIMER_MODE_REL);
+}
+
+/* Count a throttle hit and wait out a delay */
+static void throttle_wait(int sysc, s64 wait) {
+
+	struct syscall_stats *s = &stats_cpu[get_cpu()]->sys[sysc];
+
+	if (wait < 0) {
+		s->rejected++;
+	} else {
+		s->delayed++;
+		s->delay_ns += wait;
+	}
+	put_cpu();
+
+	if (wait > 0)
+		sleep_ns(wait);
+}
+
+static long request_start_throttle(int syscall, struct pid *pid, const struct throttle_request *req) {
+
+	struct throttle *t;
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+	if (req->rate == 0 || (req->policy != THROTTLE_DELAY && req->policy != THROTTLE_FAIL)) {
+		return -EINVAL;
+	}
+
+	// Allocate before locking: this can sleep
+	t = vmalloc(sizeof(*t));
+	if (!t) {
+		return -ENOMEM;
+	}
+	memset(t, 0, sizeof(*t));
+	t->pid = get_pid(pid);
+	t->interval_ns = div_u64(NSEC_PER_SEC, req->rate) ?: 1;
+	t->slack_ns = (req->burst ? req->burst - 1 : 0) * t->interval_ns;
+	t->policy = req->policy;
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else if (table[syscall].throttle) {
+		status = -EBUSY;
+	} else {
+		table[syscall].throttle = t;
+	}
+	spin_unlock(&calltable_lock);
+
+	if (status) {
+		put_pid(t->pid);
+		vfree(t);
+	}
+	return status;
+}
+
+/* Remove sysc's throttle; the caller frees it once calltable_lock is dropped */
+static struct throttle *unset_throttle(int sysc) {
+
+	struct throttle *t = table[sysc].throttle;
+
+	table[sysc].throttle = NULL;
+	return t;
+}
+
+static void free_throttle(struct throttle *t) {
+
+	if (t) {
+		put_pid(t->pid);
+		vfree(t);
+	}
+}
+
+static long request_stop_throttle(int syscall) {
+
+	struct throttle *t;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+	t = unset_throttle(syscall);
+	spin_unlock(&calltable_lock);
+
+	if (!t) {
+		return -EINVAL;
+	}
+	free_throttle(t);
+	return 0;
+}
+//----------------------------------------------------------------
+
+
+
+//----- Latency injection ----------------------------------------
+/**
+ * For testing how programs cope with slow calls, an intercepted syscall
+ * can be given an extra delay before the original runs: fixed, uniform
+ * over [base, base + spread], or base plus an exponential tail with mean
+ * spread, for one process or all of them, on a given share of the calls.
+ * As with throttles, the rule is read under calltable_lock and the sleep
+ * happens after it is dropped, so a syscall without a rule only pays for
+ * a NULL check.
+ */
+
+/* Longest delay injected into a single call */
+#define INJECT_MAX_NS           (10 * NSEC_PER_SEC)
+
+struct injection {
+	/* The process delayed, or NULL for every process */
+	struct pid *pid;
+	int distribution;
+	u64 base_ns;
+	u64 spread_ns;
+	/* Share of the calls delayed, out of 2^32 */
+	u32 chance;
+};
+
+/**
+ * -ln(u / 2^32) in 16.16 fixed point, for u > 0: the log2 comes from the
+ * position of the top bit, with the bits below it as a linear
+ * interpolation (at most 9% off), then scaled by ln 2.
+ */
+static u64 neg_log_q16(u32 u) {
+
+	int k = fls(u) - 1;
+	u32 frac = k >= 16 ? (u - (1u << k)) >> (k - 16) : (u - (1u << k)) << (16 - k);
+	u64 neg_log2 = (32ull << 16) - (((u64)k << 16) + frac);
+
+	return (neg_log2 * 45426) >> 16;
+}
+
+/* Delay to add to the current call, in ns (0 for none). Called with calltable_lock held. */
+static u64 injection_delay(struct injection *inj) {
+
+	u64 ns = inj->base_ns;
+	u32 u;
+
+	if (inj->pid && inj->pid != task_tgid(current))
+		return 0;
+	if (inj->chance && random32() >= inj->chance)
+		return 0;
+
+	switch (inj->distribution) {
+		case INJECT_UNIFORM:
+			ns += (inj->spread_ns * (random32() >> 8)) >> 24;
+			break;
+		case INJECT_EXPONENTIAL:
+			u = random32() ?: 1;
+			ns += (inj->spread_ns * neg_log_q16(u)) >> 16;
+			break;
+	}
+	return min_t(u64, ns, INJECT_MAX_NS);
+}
+
+static long request_start_injection(int syscall, struct pid *pid, const struct inject_request *req) {
+
+	struct injection *inj;
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+	if (req->distribution < INJECT_FIXED || req->distribution > INJECT_EXPONENTIAL ||
+	    req->percent > 100 || (req->delay_us == 0 && req->spread_us == 0) ||
+	    req->delay_us > INJECT_MAX_NS / NSEC_PER_USEC || req->spread_us > INJECT_MAX_NS / NSEC_PER_USEC) {
+		return -EINVAL;
+	}
+
+	inj = kmalloc(sizeof(*inj), GFP_KERNEL);
+	if (!inj) {
+		return -ENOMEM;
+	}
+	inj->pid = get_pid(pid);
+	inj->distribution = req->distribution;
+	inj->base_ns = (u64)req->delay_us * NSEC_PER_USEC;
+	inj->spread_ns = (u64)req->spread_us * NSEC_PER_USEC;
+	// 0 and 100 both mean every call
+	inj->chance = req->percent % 100 ? div_u64((u64)req->percent << 32, 100) : 0;
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else if (table[syscall].injection) {
+		status = -EBUSY;
+	} else {
+		table[syscall].injection = inj;
+	}
+	spin_unlock(&calltable_lock);
+
+	if (status) {
+		put_pid(inj->pid);
+		kfree(inj);
+	}
+	return status;
+}
+
+/* Remove sysc's injection; the caller frees it once calltable_lock is dropped */
+static struct injection *unset_injection(int sysc) {
+
+	struct injection *inj = table[sysc].injection;
+
+	table[sysc].injection = NULL;
+	return inj;
+}
+
+static void free_injection(struct injection *inj) {
+
+	if (inj) {
+		put_pid(inj->pid);
+		kfree(inj);
+	}
+}
+
+static long request_stop_injection(int syscall) {
+
+	struct injection *inj;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+	inj = unset_injection(syscall);
+	spin_unlock(&calltable_lock);
+
+	if (!inj) {
+		return -EINVAL;
+	}
+	free_injection(inj);
+	return 0;
+}
+//----------------------------------------------------------------
+
+
+
+//----- Session buffers ------------------------------------------
+/**
+ * Sessions other than 0 log into their own ring buffer instead of the
+ * kernel log. Each buffer is read (and emptied) through
+ * /proc/interceptor/session<N>, with the same line format as the kernel
+ * log. When a buffer is full new lines are dropped, and the next read
+ * starts with "# lost <n>".
+ */
+
+#define SESSION_BUF_SIZE        (64 * 1024)
+#define SESSION_READ_MAX        (16 * 1024)
+
+struct session_buf {
+	char *data;
+	size_t head, len;
+	unsigned long lost;
+	spinlock_t lock;
+};
+
+/* Entry 0 is unused: session 0 logs with printk */
+static struct session_buf session_bufs[MAX_SESSIONS];
+
+/* Append a line to b; returns -ENOSPC if it was dropped */
+static int session_write(struct session_buf *b, const char *line, size_t n) {
+
+	size_t tail, first;
+	int status = 0;
+
+	spin_lock(&b->lock);
+	if (b->len + n > SESSION_BUF_SIZE) {
+		b->lost++;
+		status = -ENOSPC;
+	} else {
+		tail = (b->head + b->len) % SESSION_BUF_SIZE;
+		first = min(n, SESSION_BUF_SIZE - tail);
+		memcpy(b->data + tail, line, first);
+		memcpy(b->data, line + first, n - first);
+		b->len += n;
+	}
+	spin_unlock(&b->lock);
+	return status;
+}
+
+/* Write a formatted line once to every buffered session in mask */
+static void session_log(unsigned int mask, const char *line, size_t n) {
+
+	int s;
+
+	for (s = 1; s < MAX_SESSIONS; s++) {
+		if (mask & SESSION_BIT(s))
+			session_write(&session_bufs[s], line, n);
+	}
+}
+
+static ssize_t session_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos) {
+
+	struct session_buf *b = PDE(file->f_path.dentry->d_inode)->data;
+	size_t n = 0, take, first;
+	char *tmp;
+
+	count = min(count, (size_t)SESSION_READ_MAX);
+	tmp = kmalloc(count, GFP_KERNEL);
+	if (!tmp)
+		return -ENOMEM;
+
+	spin_lock(&b->lock);
+	if (b->lost && count >= 32) {
+		n = snprintf(tmp, count, "# lost %lu\n", b->lost);
+		b->lost = 0;
+	}
+	take = min(b->len, count - n);
+	first = min(take, SESSION_BUF_SIZE - b->head);
+	memcpy(tmp + n, b->data + b->head, first);
+	memcpy(tmp + n + first, b->data, take - first);
+	b->head = (b->head + take) % SESSION_BUF_SIZE;
+	b->len -= take;
+	n += take;
+	spin_unlock(&b->lock);
+
+	// Copy out after unlocking: this can fault
+	if (n && copy_to_user(ubuf, tmp, n))
+		n = -EFAULT;
+	kfree(tmp);
+	return n;
+}
+
+static const struct file_operations session_fops = {
+	.owner = THIS_MODULE,
+	.read = session_read,
+};
+
+static int sessions_init(void) {
+
+	char name[16];
+	int s;
+
+	for (s = 1; s < MAX_SESSIONS; s++) {
+		spin_lock_init(&session_bufs[s].lock);
+		session_bufs[s].data = vmalloc(SESSION_BUF_SIZE);
+		if (!session_bufs[s].data)
+			return -ENOMEM;
+		sprintf(name, "session%d", s);
+		if (!proc_create_data(name, 0400, proc_dir, &session_fops, &session_bufs[s]))
+			return -ENOMEM;
+	}
+	return 0;
+}
+
+static void sessions_exit(void) {
+
+	char name[16];
+	int s;
+
+	for (s = 1; s < MAX_SESSIONS; s++) {
+		if (proc_dir) {
+			sprintf(name, "session%d", s);
+			remove_proc_entry(name, proc_dir);
+		}
+		vfree(session_bufs[s].data);
+		session_bufs[s].data = NULL;
+	}
+}
+
+/**
+ * Event lines are formatted once, then go to the kernel log for session 0
+ * and to the buffers of the other sessions. A task in a child pid
+ * namespace is logged as [pid/vpid]: its global pid, then its pid in its
+ * own namespace, which is what a containerised reader knows it by.
+ */
+static int format_call(char *line, pid_t vpid, const struct pt_regs *reg) {
+
+	int n;
+
+	if (vpid)
+		n = snprintf(line, LOG_LINE_MAX, LOG_NS_PID_FMT LOG_CALL_FMT, current->pid, vpid,
+			reg->ax, reg->bx, reg->cx, reg->dx, reg->si, reg->di, reg->bp);
+	else
+		n = snprintf(line, LOG_LINE_MAX, LOG_MESSAGE_FMT, current->pid,
+			reg->ax, reg->bx, reg->cx, reg->dx, reg->si, reg->di, reg->bp);
+	return min(n, LOG_LINE_MAX - 1);
+}
+
+static int format_return(char *line, pid_t vpid, long sysc, long ret, s64 ns) {
+
+	int n;
+
+	if (vpid)
+		n = snprintf(line, LOG_LINE_MAX, LOG_NS_PID_FMT LOG_RESULT_FMT, current->pid, vpid,
+			sysc, ret, (unsigned long long)ns);
+	else
+		n = snprintf(line, LOG_LINE_MAX, LOG_RETURN_FMT, current->pid,
+			sysc, ret, (unsigned long long)ns);
+	return min(n, LOG_LINE_MAX - 1);
+}
+
+static void log_line(unsigned int sessions, const char *line, int len) {
+
+	if (sessions & SESSION_BIT(0))
+		printk(KERN_DEBUG "%s", line);
+	if (sessions & ~SESSION_BIT(0))
+		session_log(sessions, line, len);
+}
+//----------------------------------------------------------------
+
+
+
+//----- Payload capture ------------------------------------------
+/**
+ * With capture turned on for read/write-style syscalls, the first bytes
+ * of the user buffer are appended to the event's line as " data=<hex>":
+ * on the call line for data going out (write, send), and on the return
+ * line for data coming in (read, recv), limited to what the call
+ * returned. The bytes are copied with page faults disabled, so a buffer
+ * that is not resident is simply not captured, and the line is built in
+ * per-CPU scratch space rather than on the stack or the heap.
+ */
+
+#define CAPTURE_IN              1
+#define CAPTURE_OUT             2
+/* Room for decoded arguments and path ids as well (see Argument decoding) */
+#define DECODE_MAX              160
+#define CAPTURE_LINE_MAX        (LOG_LINE_MAX + 8 + 2 * CAPTURE_MAX + DECODE_MAX)
+
+struct capture_scratch {
+	u8 data[CAPTURE_MAX];
+	char line[CAPTURE_LINE_MAX];
+};
+
+static DEFINE_PER_CPU(struct capture_scratch, capture_scratch);
+
+/* Copy from user memory without sleeping or faulting; returns the bytes copied */
+static size_t copy_nofault(void *dst, unsigned long src, size_t n) {
+
+	size_t left;
+
+	pagefault_disable();
+	left = __copy_from_user_inatomic(dst, (const void __user *)src, n);
+	pagefault_enable();
+	return n - left;
+}
+
+/* Can sysc's buffer be captured? */
+static int capturable(int sysc) {
+
+	switch (sysc) {
+		case __NR_read:
+		case __NR_write:
+		case __NR_pread64:
+		case __NR_pwrite64:
+		case __NR_socketcall:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Find the buffer of a call and which way its data goes.
+ * Returns CAPTURE_IN, CAPTURE_OUT, or 0 if the call has no buffer.
+ */
+static int capture_buffer(int sysc, const struct pt_regs *reg, unsigned long *buf, unsigned long *len) {
+
+	unsigned long args[3];
+
+	switch (sysc) {
+		case __NR_read:
+		case __NR_pread64:
+			*buf = reg->cx;
+			*len = reg->dx;
+			return CAPTURE_IN;
+		case __NR_write:
+		case __NR_pwrite64:
+			*buf = reg->cx;
+			*len = reg->dx;
+			return CAPTURE_OUT;
+		case __NR_socketcall:
+			// i386 passes socket calls as an array of arguments: fd, buf, len, ...
+			if (reg->bx < SYS_SEND || reg->bx > SYS_RECVFROM)
+				return 0;
+			if (copy_nofault(args, reg->cx, sizeof(args)) != sizeof(args))
+				return 0;
+			*buf = args[1];
+			*len = args[2];
+			return reg->bx == SYS_SEND || reg->bx == SYS_SENDTO ? CAPTURE_OUT : CAPTURE_IN;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Append up to n bytes of the user buffer at buf to the line being built
+ * at p, or nothing if none of them can be read. Returns the new end.
+ */
+static char *capture_data(struct capture_scratch *cs, char *p, unsigned long buf, size_t n) {
+
+	static const char hex[] = "0123456789abcdef";
+	size_t got = copy_nofault(cs->data, buf, min_t(size_t, n, CAPTURE_MAX)), i;
+
+	if (!got) {
+		return p;
+	}
+
+	memcpy(p, " data=", 6);
+	p += 6;
+	for (i = 0; i < got; i++) {
+		*p++ = hex[cs->data[i] >> 4];
+		*p++ = hex[cs->data[i] & 0xf];
+	}
+	return p;
+}
+
+static long request_set_capture(int syscall, int bytes) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+	if (bytes < 0 || bytes > CAPTURE_MAX || !capturable(syscall)) {
+		return -EINVAL;
+	}
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else {
+		table[syscall].capture = bytes;
+	}
+	spin_unlock(&calltable_lock);
+	return status;
+}
+//----------------------------------------------------------------
+
+
+
+//----- Fd paths -------------------------------------------------
+/**
+ * With fd paths turned on, events of syscalls that take a file descriptor
+ * carry " path=<id>" for the file it was opened as, and each path is
+ * written once to FDPATH_PATH as "path <id> <path>". A cache maps
+ * (tgid, fd) to path ids. It is filled on the return of open, openat
+ * and creat (one d_path() per open, none per I/O call), carried over
+ * by dup, dup2 and dup3, and emptied by close and exit_group; so these
+ * need fd paths turned on too. Both tables are fixed size and only
+ * touched under fdpath_lock. When all probed slots are taken one is
+ * reused, and its fd or path is then simply looked up or written again.
+ * A path whose record is dropped from a full FDPATH_PATH buffer gets no
+ * id, and is written again the next time it is opened.
+ */
+
+#define FDPATH_TAG              1
+#define FDPATH_TRACK            2
+#define FDPATH_SLOTS            1024
+#define FDPATH_NAMES            1024
+#define FDPATH_PROBES           8
+#define FDPATH_LEN              256
+
+struct fdpath_entry {
+	/* 0 for a free entry */
+	pid_t tgid;
+	int fd;
+	u32 id;
+};
+
+/* A path already written out, found by its hash and checked against its copy */
+struct fdpath_name {
+	u32 hash;
+	/* 0 for a free name */
+	u32 id;
+	int len;
+	char path[FDPATH_LEN];
+};
+
+struct fdpath_scratch {
+	char path[FDPATH_LEN];
+	char line[FDPATH_LEN + 32];
+};
+
+static struct fdpath_entry fdpath_entries[FDPATH_SLOTS];
+static struct fdpath_name fdpath_names[FDPATH_NAMES];
+static u32 fdpath_next_id = 1;
+static spinlock_t fdpath_lock = SPIN_LOCK_UNLOCKED;
+static struct session_buf fdpath_buf;
+static DEFINE_PER_CPU(struct fdpath_scratch, fdpath_scratch);
+
+/* What fd paths do for sysc: tag its events, track its fds, or neither */
+static int fdpath_flags(int sysc) {
+
+	switch (sysc) {
+		case __NR_open:
+		case __NR_openat:
+		case __NR_creat:
+		case __NR_close:
+		case __NR_dup:
+		case __NR_dup2:
+		case __NR_dup3:
+			return FDPATH_TAG | FDPATH_TRACK;
+		case __NR_read:
+		case __NR_write:
+		case __NR_pread64:
+		case __NR_pwrite64:
+		case __NR_readv:
+		case __NR_writev:
+		case __NR_preadv:
+		case __NR_pwritev:
+		case __NR_lseek:
+		case __NR__llseek:
+		case __NR_fsync:
+		case __NR_fdatasync:
+		case __NR_ftruncate:
+		case __NR_ftruncate64:
+		case __NR_fstat64:
+		case __NR_fchmod:
+		case __NR_fchown:
+		case __NR_getdents:
+		case __NR_getdents64:
+		case __NR_ioctl:
+		case __NR_fcntl:
+		case __NR_fcntl64:
+		case __NR_flock:
+			return FDPATH_TAG;
+		default:
+			return 0;
+	}
+}
+
+static int fdpath_opens(int sysc) {
+
+	return sysc == __NR_open || sysc == __NR_openat || sysc == __NR_creat;
+}
+
+/**
+ * The entry of (tgid, fd), or NULL; with claim, a new one if there is
+ * none. Free entries do not end the probe, since close leaves holes.
+ */
+static struct fdpath_entry *fdpath_slot(pid_t tgid, int fd, int claim) {
+
+	unsigned long h = hash_long(tgid ^ ((unsigned long)fd << 16), 10);
+	struct fdpath_entry *e, *victim = NULL;
+	int i;
+
+	for (i = 0; i < FDPATH_PROBES; i++) {
+		e = &fdpath_entries[(h + i) % FDPATH_SLOTS];
+		if (e->tgid == tgid && e->fd == fd)
+			return e;
+		if (!victim && e->tgid == 0)
+			victim = e;
+	}
+	if (!claim)
+		return NULL;
+
+	if (!victim)
+		victim = &fdpath_entries[h % FDPATH_SLOTS];
+	victim->tgid = tgid;
+	victim->fd = fd;
+	return victim;
+}
+
+/**
+ * The id of a path, written out the first time it is seen, or 0 if its
+ * record could not be written.
+ */
+static u32 fdpath_name_id(struct fdpath_scratch *fs, const char *path) {
+
+	int plen = strlen(path);
+	u32 hash = full_name_hash((const unsigned char *)path, plen);
+	unsigned long h = hash_long(hash, 10);
+	struct fdpath_name *n, *victim = NULL;
+	int i, len;
+
+	for (i = 0; i < FDPATH_PROBES; i++) {
+		n = &fdpath_names[(h + i) % FDPATH_NAMES];
+		if (n->id && n->hash == hash && n->len == plen && !memcmp(n->path, path, plen))
+			return n->id;
+		if (!victim && !n->id)
+			victim = n;
+	}
+	if (!victim)
+		victim = &fdpath_names[h % FDPATH_NAMES];
+
+	len = snprintf(fs->line, sizeof(fs->line), "path %u %s\n", fdpath_next_id, path);
+	len = min_t(int, len, sizeof(fs->line) - 1);
+	// Keep the record on one line
+	for (i = 0; i < len - 1; i++) {
+		if (fs->line[i] == '\n')
+			fs->line[i] = '?';
+	}
+	// Readers never saw the id; leave the name unknown so it is written again
+	if (session_write(&fdpath_buf, fs->line, len)) {
+		return 0;
+	}
+	victim->hash = hash;
+	victim->id = fdpath_next_id++;
+	victim->len = plen;
+	memcpy(victim->path, path, plen);
+	return victim->id;
+}
+
+/* The path id of fd in the current process, or 0 if it is not known */
+static u32 fdpath_lookup(int fd) {
+
+	struct fdpath_entry *e;
+	u32 id = 0;
+
+	spin_lock(&fdpath_lock);
+	e = fdpath_slot(current->tgid, fd, 0);
+	if (e)
+		id = e->id;
+	spin_unlock(&fdpath_lock);
+	return id;
+}
+
+/* Make newfd refer to the path of oldfd, or to none if oldfd has none */
+static void fdpath_copy(int oldfd, int newfd) {
+
+	struct fdpath_entry *e;
+	u32 id = 0;
+
+	spin_lock(&fdpath_lock);
+	e = fdpath_slot(current->tgid, oldfd, 0);
+	if (e)
+		id = e->id;
+	e = fdpath_slot(current->tgid, newfd, id != 0);
+	if (e && id)
+		e->id = id;
+	else if (e)
+		e->tgid = 0;
+	spin_unlock(&fdpath_lock);
+}
+
+/**
+ * The path id of a file, written out if it is new, or 0 if its path is
+ * too long or its record was dropped.
+ */
+static u32 fdpath_file_id(struct file *file) {
+
+	struct fdpath_scratch *fs = &get_cpu_var(fdpath_scratch);
+	char *path = d_path(&file->f_path, fs->path, sizeof(fs->path));
+	u32 id = 0;
+
+	if (!IS_ERR(path)) {
+		spin_lock(&fdpath_lock);
+		id = fdpath_name_id(fs, path);
+		spin_unlock(&fdpath_lock);
+	}
+	put_cpu_var(fdpath_scratch);
+	return id;
+}
+
+/* Record the file that fd of the current process was just opened as */
+static void fdpath_open(int fd) {
+
+	struct fdpath_entry *e;
+	struct file *file = fget(fd);
+	u32 id;
+
+	if (!file) {
+		return;
+	}
+	id = fdpath_file_id(file);
+	fput(file);
+
+	spin_lock(&fdpath_lock);
+	e = fdpath_slot(current->tgid, fd, id != 0);
+	if (e && id)
+		e->id = id;
+	else if (e)
+		// No id to record: forget the fd's old path
+		e->tgid = 0;
+	spin_unlock(&fdpath_lock);
+}
+
+/* Update the cache after a call of sysc that tracks fds returned ret */
+static void fdpath_update(int sysc, const struct pt_regs *reg, long ret) {
+
+	if (ret < 0) {
+		return;
+	}
+
+	switch (sysc) {
+		case __NR_open:
+		case __NR_openat:
+		case __NR_creat:
+			fdpath_open(ret);
+			break;
+		case __NR_close:
+			// Copying from fd -1 clears the entry
+			fdpath_copy(-1, reg->bx);
+			break;
+		case __NR_dup:
+			fdpath_copy(reg->bx, ret);
+			break;
+		case __NR_dup2:
+		case __NR_dup3:
+			if (reg->bx != reg->cx)
+				fdpath_copy(reg->bx, reg->cx);
+			break;
+	}
+}
+
+/**
+ * Append " path=<id>" for the fd argument of a call line, or for the new
+ * fd on the return line of an open.
+ */
+static char *fdpath_tag(char *p, char *end, int sysc, const struct pt_regs *reg, int returned, long ret) {
+
+	int opens = fdpath_opens(sysc);
+	u32 id;
+
+	if (returned != opens || (opens && ret < 0)) {
+		return p;
+	}
+	id = fdpath_lookup(returned ? ret : (int)reg->bx);
+	return id ? p + scnprintf(p, end - p, " path=%u", id) : p;
+}
+
+/* Forget every fd of an exiting process */
+static void fdpath_exit_group(void) {
+
+	pid_t tgid = current->tgid;
+	int i;
+
+	// Nothing was ever recorded
+	if (fdpath_next_id == 1) {
+		return;
+	}
+
+	spin_lock(&fdpath_lock);
+	for (i = 0; i < FDPATH_SLOTS; i++) {
+		if (fdpath_entries[i].tgid == tgid)
+			fdpath_entries[i].tgid = 0;
+	}
+	spin_unlock(&fdpath_lock);
+}
+
+static long request_set_fdpath(int syscall, int on) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+	if (!fdpath_flags(syscall)) {
+		return -EINVAL;
+	}
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else {
+		table[syscall].fdpath = on ? fdpath_flags(syscall) : 0;
+	}
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static int fdpath_init(void) {
+
+	// Read and drained like a session buffer
+	spin_lock_init(&fdpath_buf.lock);
+	fdpath_buf.data = vmalloc(SESSION_BUF_SIZE);
+	if (!fdpath_buf.data)
+		return -ENOMEM;
+	if (!proc_create_data("paths", 0400, proc_dir, &session_fops, &fdpath_buf))
+		return -ENOMEM;
+	return 0;
+}
+
+static void fdpath_cleanup(void) {
+
+	if (proc_dir)
+		remove_proc_entry("paths", proc_dir);
+	vfree(fdpath_buf.data);
+	fdpath_buf.data = NULL;
+}
+//----------------------------------------------------------------
+
+
+
+//----- Process lineage ------------------------------------------
+/**
+ * With lineage turned on for a syscall, its calls keep a table of the
+ * processes they come from: tgid, parent, start time, comm and the id of
+ * the executable's path (written to FDPATH_PATH, as for fd paths). Each
+ * change goes to the sessions the call is logged to as a one-line record
+ * (see interceptor.h), so the tree can be rebuilt from the event stream:
+ * fork, vfork and clone returns add the child, exit_group removes the
+ * process. An exec is noticed on the next call with lineage turned on,
+ * by self_exec_id: execve cannot be wrapped by interceptor(), since it
+ * sets up the new program in the registers it is passed. A session also
+ * gets an exec record for a process the first time it logs one of its
+ * calls. The table is fixed size, under lineage_lock; when all probed
+ * slots are taken the oldest process is dropped, and recorded again if
+ * it is seen again. LINEAGE_PATH lists the table.
+ */
+
+#define LINEAGE_SLOTS           1024
+#define LINEAGE_PROBES          8
+
+struct lineage_entry {
+	/* 0 for a free entry */
+	pid_t tgid;
+	pid_t ppid;
+	u64 start_ns;
+	u32 exec_id;
+	/* Path id of the executable, or 0 if not known */
+	u32 exe;
+	/* Sessions told about the process */
+	unsigned int sessions;
+	char comm[TASK_COMM_LEN];
+};
+
+static struct lineage_entry lineage_entries[LINEAGE_SLOTS];
+static spinlock_t lineage_lock = SPIN_LOCK_UNLOCKED;
+static int lineage_used;
+
+/* Does sysc create processes? */
+static int lineage_spawns(int sysc) {
+
+	return sysc == __NR_fork || sysc == __NR_vfork || sysc == __NR_clone;
+}
+
+/**
+ * The entry of tgid, or NULL; with claim, a new one if there is none,
+ * evicting the oldest process if all probed slots are taken.
+ */
+static struct lineage_entry *lineage_slot(pid_t tgid, int claim) {
+
+	unsigned long h = hash_long(tgid, 10);
+	struct lineage_entry *e, *victim = NULL;
+	int i;
+
+	for (i = 0; i < LINEAGE_PROBES; i++) {
+		e = &lineage_entries[(h + i) % LINEAGE_SLOTS];
+		if (e->tgid == tgid)
+			return e;
+		if (!victim || (victim->tgid && (!e->tgid || e->start_ns < victim->start_ns)))
+			victim = e;
+	}
+	if (!claim)
+		return NULL;
+
+	memset(victim, 0, sizeof(*victim));
+	victim->tgid = tgid;
+	return victim;
+}
+
+/* Copy comm with spaces replaced, so records stay whitespace-separated */
+static void lineage_comm(char *dst, const char *comm) {
+
+	int i;
+
+	for (i = 0; i < TASK_COMM_LEN - 1 && comm[i]; i++)
+		dst[i] = comm[i] == ' ' ? '_' : comm[i];
+	dst[i] = '\0';
+}
+
+/* Path id of the current process's executable, or 0; may sleep */
+static u32 lineage_exe_id(void) {
+
+	struct mm_struct *mm = current->mm;
+	struct file *exe = NULL;
+	u32 id = 0;
+
+	if (!mm) {
+		return 0;
+	}
+	down_read(&mm->mmap_sem);
+	if (mm->exe_file) {
+		exe = mm->exe_file;
+		get_file(exe);
+	}
+	up_read(&mm->mmap_sem);
+	if (exe) {
+		id = fdpath_file_id(exe);
+		fput(exe);
+	}
+	return id;
+}
+
+/**
+ * Record the child a fork, vfork or clone returned, for the sessions logging
+ * the call. After a vfork (or clone with CLONE_VFORK) the parent only
+ * returns once the child has exec'd, so the child may already be in the
+ * table with its new program; it is then left as it is, and only the
+ * sessions that have not heard of it get the fork record.
+ */
+static void lineage_fork(pid_t child, unsigned int sessions) {
+
+	struct task_struct *task;
+	struct lineage_entry *e, *parent;
+	char line[LOG_LINE_MAX];
+	u64 start_ns;
+	int len = 0;
+
+	rcu_read_lock();
+	// The pid returned is in the caller's namespace
+	task = pid_task(find_vpid(child), PIDTYPE_PID);
+	if (task) {
+		start_ns = timespec_to_ns(&task->start_time);
+		spin_lock(&lineage_lock);
+		e = lineage_slot(task->tgid, 0);
+		if (e && e->start_ns == start_ns) {
+			sessions &= ~e->sessions;
+			if (!e->ppid)
+				e->ppid = task->real_parent->tgid;
+		} else {
+			// New, or a reused pid
+			e = lineage_slot(task->tgid, 1);
+			e->ppid = task->real_parent->tgid;
+			e->start_ns = start_ns;
+			e->exec_id = task->self_exec_id;
+			lineage_comm(e->comm, task->comm);
+			// The child runs the parent's program
+			parent = lineage_slot(current->tgid, 0);
+			e->exe = parent ? parent->exe : 0;
+			e->sessions = 0;
+		}
+		e->sessions |= sessions;
+		len = snprintf(line, sizeof(line), "fork %d %d %llu %s\n", e->tgid, e->ppid,
+			(unsigned long long)e->start_ns, e->comm);
+		spin_unlock(&lineage_lock);
+	}
+	rcu_read_unlock();
+
+	if (sessions && len)
+		log_line(sessions, line, min(len, LOG_LINE_MAX - 1));
+}
+
+/**
+ * Record the current process if it has exec'd since it was last seen, or
+ * if some of the sessions logging its call have not been told about it.
+ */
+static void lineage_exec(unsigned int sessions) {
+
+	struct lineage_entry *e;
+	char line[LOG_LINE_MAX];
+	unsigned int to;
+	int len, execd;
+	u32 exe;
+
+	spin_lock(&lineage_lock);
+	e = lineage_slot(current->tgid, 0);
+	execd = !e || e->exec_id != current->self_exec_id;
+	to = e ? sessions & ~e->sessions : sessions;
+	spin_unlock(&lineage_lock);
+	if (!execd && !to) {
+		return;
+	}
+
+	exe = lineage_exe_id();
+
+	spin_lock(&lineage_lock);
+	e = lineage_slot(current->tgid, 1);
+	if (e->exec_id != current->self_exec_id || !e->start_ns) {
+		// Everyone told about the old program hears about the new one
+		sessions |= e->sessions;
+		e->ppid = current->real_parent->tgid;
+		e->start_ns = timespec_to_ns(&current->group_leader->start_time);
+		e->exec_id = current->self_exec_id;
+		lineage_comm(e->comm, current->comm);
+	} else {
+		sessions &= ~e->sessions;
+	}
+	e->exe = exe;
+	e->sessions |= sessions;
+	len = snprintf(line, sizeof(line), "exec %d %d %llu %u %s\n", e->tgid, e->ppid,
+		(unsigned long long)e->start_ns, e->exe, e->comm);
+	spin_unlock(&lineage_lock);
+
+	if (sessions)
+		log_line(sessions, line, min(len, LOG_LINE_MAX - 1));
+}
+
+/* Keep the table after a call of sysc with lineage on that returned ret */
+static void lineage_update(int sysc, const struct pt_regs *reg, long ret, unsigned int sessions) {
+
+	lineage_used = 1;
+	lineage_exec(sessions);
+	// Threads are not processes
+	if (lineage_spawns(sysc) && ret > 0 && !(sysc == __NR_clone && (reg->bx & CLONE_THREAD)))
+		lineage_fork(ret, sessions);
+}
+
+/* Drop an exiting process, telling the sessions that knew it */
+static void lineage_exit_group(int status) {
+
+	struct lineage_entry *e;
+	char line[LOG_LINE_MAX];
+	unsigned int to = 0;
+	int len;
+
+	// Nothing was ever recorded
+	if (!lineage_used) {
+		return;
+	}
+
+	spin_lock(&lineage_lock);
+	e = lineage_slot(current->tgid, 0);
+	if (e) {
+		to = e->sessions;
+		e->tgid = 0;
+	}
+	spin_unlock(&lineage_lock);
+
+	if (to) {
+		len = snprintf(line, sizeof(line), "exit %d %d\n", current->tgid, status);
+		log_line(to, line, len);
+	}
+}
+
+static int lineage_show(struct seq_file *m, void *v) {
+
+	struct lineage_entry e;
+	int i;
+
+	for (i = 0; i < LINEAGE_SLOTS; i++) {
+		// Copy the entry out, so the lock is not held while printing
+		spin_lock(&lineage_lock);
+		e = lineage_entries[i];
+		spin_unlock(&lineage_lock);
+		if (e.tgid)
+			seq_printf(m, "proc %d %d %llu %u %s\n", e.tgid, e.ppid,
+				(unsigned long long)e.start_ns, e.exe, e.comm);
+	}
+	return 0;
+}
+
+static int lineage_open(struct inode *inode, struct file *file) {
+	return single_open(file, lineage_show, NULL);
+}
+
+static const struct file_operations lineage_fops = {
+	.owner = THIS_MODULE,
+	.open = lineage_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static long request_set_lineage(int syscall, int on) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else {
+		table[syscall].lineage = !!on;
+	}
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static int lineage_init(void) {
+
+	if (!proc_create("lineage", 0444, proc_dir, &lineage_fops))
+		return -ENOMEM;
+	return 0;
+}
+
+static void lineage_cleanup(void) {
+
+	if (proc_dir)
+		remove_proc_entry("lineage", proc_dir);
+}
+//----------------------------------------------------------------
+
+
+
+//----- Fd lifetimes ---------------------------------------------
+/**
+ * With fd lifetimes turned on for the syscalls that create and close
+ * fds, each process's open fds are kept in a table with the syscall that
+ * created them and when. A close (or exit_group) adds the fd's lifetime
+ * to a log2 histogram for the kind of call that created it. FDLIFE_PATH
+ * reports those histograms, the ages of the fds still open, and the
+ * oldest of them, which is where leaks show up (see interceptor.h).
+ * Nothing is logged, and each call costs one probe of a fixed table
+ * under fdlife_lock, so it can stay on. When all probed slots are taken
+ * the new fd is counted as untracked rather than evicting an old one.
+ * Fds closed behind our back (close-on-exec, dup2 onto them, or a process
+ * killed before exit_group) stay in the table until their number is
+ * reused, which then ends their lifetime.
+ */
+
+#define FDLIFE_SLOTS            4096
+#define FDLIFE_PROBES           8
+#define FDLIFE_OLDEST           32
+
+enum fdlife_kind {
+	FDLIFE_OPEN,
+	FDLIFE_SOCKET,
+	FDLIFE_ACCEPT,
+	FDLIFE_PIPE,
+	FDLIFE_DUP,
+	FDLIFE_KINDS
+};
+
+static const char *fdlife_names[FDLIFE_KINDS] = { "open", "socket", "accept", "pipe", "dup" };
+
+struct fdlife_entry {
+	/* 0 for a free entry */
+	pid_t tgid;
+	int fd;
+	/* The syscall that created the fd, and its kind */
+	u16 nr;
+	u16 kind;
+	u64 opened_ns;
+};
+
+struct fdlife_report {
+	u64 closed[FDLIFE_KINDS][STATS_HIST_BUCKETS];
+	u64 live[FDLIFE_KINDS][STATS_HIST_BUCKETS];
+	struct fdlife_entry oldest[FDLIFE_OLDEST];
+	int noldest;
+	u64 untracked;
+};
+
+static struct fdlife_entry fdlife_entries[FDLIFE_SLOTS];
+static u64 fdlife_closed[FDLIFE_KINDS][STATS_HIST_BUCKETS];
+static u64 fdlife_untracked;
+static spinlock_t fdlife_lock = SPIN_LOCK_UNLOCKED;
+static int fdlife_used;
+
+/* Can sysc create or close fds? */
+static int fdlife_tracks(int sysc) {
+
+	switch (sysc) {
+		case __NR_open:
+		case __NR_openat:
+		case __NR_creat:
+		case __NR_socketcall:
+		case __NR_pipe:
+		case __NR_pipe2:
+		case __NR_dup:
+		case __NR_dup2:
+		case __NR_dup3:
+		case __NR_fcntl:
+		case __NR_fcntl64:
+		case __NR_close:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static int fdlife_bucket(u64 ns) {
+
+	return min_t(int, fls64(ns), STATS_HIST_BUCKETS - 1);
+}
+
+/* The entry of (tgid, fd), or NULL; with claim, a free one if there is any */
+static struct fdlife_entry *fdlife_slot(pid_t tgid, int fd, int claim) {
+
+	unsigned long h = hash_long(tgid ^ ((unsigned long)fd << 16), 12);
+	struct fdlife_entry *e, *empty = NULL;
+	int i;
+
+	for (i = 0; i < FDLIFE_PROBES; i++) {
+		e = &fdlife_entries[(h + i) % FDLIFE_SLOTS];
+		if (e->tgid == tgid && e->fd == fd)
+			return e;
+		if (!empty && e->tgid == 0)
+			empty = e;
+	}
+	return claim ? empty : NULL;
+}
+
+/* End the life of an entry at now; called with fdlife_lock held */
+static void fdlife_end(struct fdlife_entry *e, u64 now) {
+
+	fdlife_closed[e->kind][fdlife_bucket(now - e->opened_ns)]++;
+	e->tgid = 0;
+}
+
+/* Record that fd of the current process was closed */
+static void fdlife_close(int fd, u64 now) {
+
+	struct fdlife_entry *e;
+
+	spin_lock(&fdlife_lock);
+	e = fdlife_slot(current->tgid, fd, 0);
+	if (e)
+		fdlife_end(e, now);
+	spin_unlock(&fdlife_lock);
+}
+
+/* Record that fd of the current process was created by a call of nr */
+static void fdlife_open(int fd, int nr, int kind, u64 now) {
+
+	struct fdlife_entry *e;
+
+	spin_lock(&fdlife_lock);
+	// An fd still in the table was closed without us seeing it (or by dup2)
+	e = fdlife_slot(current->tgid, fd, 0);
+	if (e)
+		fdlife_end(e, now);
+	e = fdlife_slot(current->tgid, fd, 1);
+	if (e) {
+		e->tgid = current->tgid;
+		e->fd = fd;
+		e->nr = nr;
+		e->kind = kind;
+		e->opened_ns = now;
+	} else {
+		fdlife_untracked++;
+	}
+	spin_unlock(&fdlife_lock);
+}
+
+/* Record the two fds a pipe or socketpair call wrote to the user array at fds */
+static void fdlife_open_pair(unsigned long fds, int nr, int kind, u64 now) {
+
+	int pair[2];
+
+	if (copy_from_user(pair, (const void __user *)fds, sizeof(pair))) {
+		return;
+	}
+	fdlife_open(pair[0], nr, kind, now);
+	fdlife_open(pair[1], nr, kind, now);
+}
+
+/* Update the table after a call of sysc with fd lifetimes on that returned ret */
+static void fdlife_update(int sysc, const struct pt_regs *reg, long ret) {
+
+	u64 now = ktime_to_ns(ktime_get());
+	unsigned long args[4];
+
+	if (ret < 0) {
+		return;
+	}
+	fdlife_used = 1;
+
+	switch (sysc) {
+		case __NR_open:
+		case __NR_openat:
+		case __NR_creat:
+			fdlife_open(ret, sysc, FDLIFE_OPEN, now);
+			break;
+		case __NR_socketcall:
+			if (reg->bx == SYS_SOCKET) {
+				fdlife_open(ret, sysc, FDLIFE_SOCKET, now);
+			} else if (reg->bx == SYS_ACCEPT || reg->bx == SYS_ACCEPT4) {
+				fdlife_open(ret, sysc, FDLIFE_ACCEPT, now);
+			} else if (reg->bx == SYS_SOCKETPAIR) {
+				// socketpair(domain, type, protocol, sv)
+				if (!copy_from_user(args, (const void __user *)reg->cx, sizeof(args)))
+					fdlife_open_pair(args[3], sysc, FDLIFE_SOCKET, now);
+			}
+			break;
+		case __NR_pipe:
+		case __NR_pipe2:
+			fdlife_open_pair(reg->bx, sysc, FDLIFE_PIPE, now);
+			break;
+		case __NR_dup:
+			fdlife_open(ret, sysc, FDLIFE_DUP, now);
+			break;
+		case __NR_dup2:
+		case __NR_dup3:
+			if (reg->bx == reg->cx)
+				break;
+			// An open newfd is closed first
+			fdlife_close(reg->cx, now);
+			fdlife_open(reg->cx, sysc, FDLIFE_DUP, now);
+			break;
+		case __NR_fcntl:
+		case __NR_fcntl64:
+			if (reg->cx == F_DUPFD || reg->cx == F_DUPFD_CLOEXEC)
+				fdlife_open(ret, sysc, FDLIFE_DUP, now);
+			break;
+		case __NR_close:
+			fdlife_close(reg->bx, now);
+			break;
+	}
+}
+
+/* End the lives of every fd of an exiting process */
+static void fdlife_exit_group(void) {
+
+	pid_t tgid = current->tgid;
+	u64 now;
+	int i;
+
+	// Nothing was ever recorded
+	if (!fdlife_used) {
+		return;
+	}
+
+	now = ktime_to_ns(ktime_get());
+	spin_lock(&fdlife_lock);
+	for (i = 0; i < FDLIFE_SLOTS; i++) {
+		if (fdlife_entries[i].tgid == tgid)
+			fdlife_end(&fdlife_entries[i], now);
+	}
+	spin_unlock(&fdlife_lock);
+}
+
+/* Gather the report under the lock, keeping the FDLIFE_OLDEST oldest live fds in order */
+static void fdlife_gather(struct fdlife_report *r, u64 now) {
+
+	struct fdlife_entry *e;
+	int i, j;
+
+	spin_lock(&fdlife_lock);
+	memcpy(r->closed, fdlife_closed, sizeof(r->closed));
+	r->untracked = fdlife_untracked;
+	for (i = 0; i < FDLIFE_SLOTS; i++) {
+		e = &fdlife_entries[i];
+		if (!e->tgid)
+			continue;
+		r->live[e->kind][fdlife_bucket(now - e->opened_ns)]++;
+		if (r->noldest == FDLIFE_OLDEST && e->opened_ns >= r->oldest[FDLIFE_OLDEST - 1].opened_ns)
+			continue;
+		// Insertion into the sorted list of oldest fds
+		j = min(r->noldest, FDLIFE_OLDEST - 1);
+		for (; j > 0 && r->oldest[j - 1].opened_ns > e->opened_ns; j--)
+			r->oldest[j] = r->oldest[j - 1];
+		r->oldest[j] = *e;
+		if (r->noldest < FDLIFE_OLDEST)
+			r->noldest++;
+	}
+	spin_unlock(&fdlife_lock);
+}
+
+/* Print a histogram record if it has any entries */
+static void fdlife_show_hist(struct seq_file *m, const char *type, int kind, const u64 *hist) {
+
+	u64 n = 0;
+	int b;
+
+	for (b = 0; b < STATS_HIST_BUCKETS; b++)
+		n += hist[b];
+	if (!n)
+		return;
+
+	seq_printf(m, "%s %s %llu", type, fdlife_names[kind], n);
+	for (b = 0; b < STATS_HIST_BUCKETS; b++) {
+		if (hist[b])
+			seq_printf(m, " %d:%llu", b, hist[b]);
+	}
+	seq_printf(m, "\n");
+}
+
+static int fdlife_show(struct seq_file *m, void *v) {
+
+	struct fdlife_report *r = kzalloc(sizeof(*r), GFP_KERNEL);
+	u64 now = ktime_to_ns(ktime_get());
+	int i;
+
+	if (!r) {
+		return -ENOMEM;
+	}
+	fdlife_gather(r, now);
+
+	seq_printf(m, "time %llu\n", (unsigned long long)now);
+	seq_printf(m, "untracked %llu\n", r->untracked);
+	for (i = 0; i < FDLIFE_KINDS; i++) {
+		fdlife_show_hist(m, "closed", i, r->closed[i]);
+		fdlife_show_hist(m, "live", i, r->live[i]);
+	}
+	for (i = 0; i < r->noldest; i++) {
+		seq_printf(m, "oldest %d %d %u %s %llu\n", r->oldest[i].tgid, r->oldest[i].fd,
+			r->oldest[i].nr, fdlife_names[r->oldest[i].kind],
+			(unsigned long long)(now - r->oldest[i].opened_ns));
+	}
+
+	kfree(r);
+	return 0;
+}
+
+static int fdlife_open_proc(struct inode *inode, struct file *file) {
+	return single_open(file, fdlife_show, NULL);
+}
+
+/* Any write resets the histograms of closed fds; live fds stay tracked */
+static ssize_t fdlife_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+
+	if (current_uid() != 0)
+		return -EPERM;
+	spin_lock(&fdlife_lock);
+	memset(fdlife_closed, 0, sizeof(fdlife_closed));
+	fdlife_untracked = 0;
+	spin_unlock(&fdlife_lock);
+	return count;
+}
+
+static const struct file_operations fdlife_fops = {
+	.owner = THIS_MODULE,
+	.open = fdlife_open_proc,
+	.read = seq_read,
+	.write = fdlife_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static long request_set_fdlife(int syscall, int on) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+	if (!fdlife_tracks(syscall)) {
+		return -EINVAL;
+	}
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else {
+		table[syscall].fdlife = !!on;
+	}
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static int fdlife_init(void) {
+
+	if (!proc_create("fds", 0644, proc_dir, &fdlife_fops))
+		return -ENOMEM;
+	return 0;
+}
+
+static void fdlife_cleanup(void) {
+
+	if (proc_dir)
+		remove_proc_entry("fds", proc_dir);
+}
+//----------------------------------------------------------------
+
+
+
+//----- Argument decoding ----------------------------------------
+/**
+ * With decoding turned on, the struct arguments of a few syscalls are
+ * copied in and appended to the event's line in a compact typed form,
+ * so that a trace can be read without the process's memory:
+ *
+ *      sa=inet:<ip>:<port>     sockaddr of connect, bind and sendto
+ *      iov=<count>:<len>,...   iovec lengths of readv, writev, preadv, pwritev
+ *      ts=<sec>.<nsec>         timespec of nanosleep
+ *      st=<mode>:<size>        stat64 result of stat64, lstat64, fstat64
+ *
+ * Arguments go on the call line and results on the return line. Like
+ * capture, decoding copies with page faults disabled into the per-CPU
+ * scratch space, and never allocates.
+ */
+
+/* Lengths decoded from an iovec array; the rest are elided */
+#define DECODE_IOVS             8
+
+/* Can sysc's arguments be decoded? */
+static int decodable(int sysc) {
+
+	switch (sysc) {
+		case __NR_socketcall:
+		case __NR_readv:
+		case __NR_writev:
+		case __NR_preadv:
+		case __NR_pwritev:
+		case __NR_nanosleep:
+		case __NR_stat64:
+		case __NR_lstat64:
+		case __NR_fstat64:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/* Append a sockaddr of n bytes, e.g. " sa=inet:127.0.0.1:80" */
+static char *decode_sockaddr(char *p, char *end, const u8 *data, size_t n) {
+
+	const struct sockaddr_in *in = (const struct sockaddr_in *)data;
+	const struct sockaddr_in6 *in6 = (const struct sockaddr_in6 *)data;
+	const struct sockaddr_un *un = (const struct sockaddr_un *)data;
+	size_t i, off = offsetof(struct sockaddr_un, sun_path);
+
+	if (n < sizeof(sa_family_t)) {
+		return p;
+	}
+
+	switch (((const struct sockaddr *)data)->sa_family) {
+		case AF_INET:
+			if (n < sizeof(*in))
+				break;
+			return p + scnprintf(p, end - p, " sa=inet:%pI4:%u", &in->sin_addr, ntohs(in->sin_port));
+		case AF_INET6:
+			if (n < sizeof(*in6))
+				break;
+			return p + scnprintf(p, end - p, " sa=inet6:[%pI6]:%u", &in6->sin6_addr, ntohs(in6->sin6_port));
+		case AF_UNIX:
+			p += scnprintf(p, end - p, " sa=unix:");
+			// Abstract names start with a NUL; show it as '@'
+			for (i = off; i < n && p < end && (i == off || un->sun_path[i - off]); i++) {
+				char c = un->sun_path[i - off];
+				*p++ = c == '\0' ? '@' : (c > ' ' && c < 0x7f ? c : '?');
+			}
+			return p;
+	}
+	return p + scnprintf(p, end - p, " sa=af%u", ((const struct sockaddr *)data)->sa_family);
+}
+
+/* Append the lengths of the iovec array at iov, e.g. " iov=2:512,4096" */
+static char *decode_iovec(struct capture_scratch *cs, char *p, char *end, unsigned long iov, unsigned long count) {
+
+	const struct iovec *v = (const struct iovec *)cs->data;
+	size_t n = min_t(unsigned long, count, DECODE_IOVS), i;
+
+	n = copy_nofault(cs->data, iov, n * sizeof(*v)) / sizeof(*v);
+	p += scnprintf(p, end - p, " iov=%lu:", count);
+	for (i = 0; i < n; i++) {
+		p += scnprintf(p, end - p, i ? ",%zu" : "%zu", v[i].iov_len);
+	}
+	if (n < count) {
+		p += scnprintf(p, end - p, n ? ",..." : "...");
+	}
+	return p;
+}
+
+/* Append what can be decoded from the arguments of a call */
+static char *decode_call(struct capture_scratch *cs, char *p, char *end, int sysc, const struct pt_regs *reg) {
+
+	unsigned long args[6], addr, len;
+	const struct timespec *ts = (const struct timespec *)cs->data;
+
+	switch (sysc) {
+		case __NR_socketcall:
+			// connect(fd, addr, len), bind(fd, addr, len), sendto(fd, buf, n, flags, addr, len)
+			if (reg->bx != SYS_CONNECT && reg->bx != SYS_BIND && reg->bx != SYS_SENDTO)
+				return p;
+			if (copy_nofault(args, reg->cx, sizeof(args)) != sizeof(args))
+				return p;
+			addr = reg->bx == SYS_SENDTO ? args[4] : args[1];
+			len = reg->bx == SYS_SENDTO ? args[5] : args[2];
+			if (!addr)
+				return p;
+			len = copy_nofault(cs->data, addr, min_t(unsigned long, len, sizeof(struct sockaddr_un)));
+			return decode_sockaddr(p, end, cs->data, len);
+		case __NR_readv:
+		case __NR_writev:
+		case __NR_preadv:
+		case __NR_pwritev:
+			return decode_iovec(cs, p, end, reg->cx, reg->dx);
+		case __NR_nanosleep:
+			if (copy_nofault(cs->data, reg->bx, sizeof(*ts)) != sizeof(*ts))
+				return p;
+			return p + scnprintf(p, end - p, " ts=%ld.%09ld", ts->tv_sec, ts->tv_nsec);
+		default:
+			return p;
+	}
+}
+
+/* Append what can be decoded from the results of a call that returned ret */
+static char *decode_return(struct capture_scratch *cs, char *p, char *end, int sysc, const struct pt_regs *reg, long ret) {
+
+	const struct stat64 *st = (const struct stat64 *)cs->data;
+
+	switch (sysc) {
+		case __NR_stat64:
+		case __NR_lstat64:
+		case __NR_fstat64:
+			if (ret != 0 || copy_nofault(cs->data, reg->cx, sizeof(*st)) != sizeof(*st))
+				return p;
+			return p + scnprintf(p, end - p, " st=%o:%lld", st->st_mode, (long long)st->st_size);
+		default:
+			return p;
+	}
+}
+
+/**
+ * Log a call line (returned == 0) or a return line with its captured
+ * payload, decoded arguments and path id appended, as set up for sysc.
+ */
+static void log_line_extended(unsigned int sessions, const char *line, int len, int sysc,
+		const struct pt_regs *reg, int returned, long ret) {
+
+	struct capture_scratch *cs = &get_cpu_var(capture_scratch);
+	// Leave room for the newline and the terminator
+	char *p = cs->line + len - 1, *end = cs->line + CAPTURE_LINE_MAX - 2;
+	unsigned long buf, buflen;
+	int capture = table[sysc].capture;
+	int dir = capture ? capture_buffer(sysc, reg, &buf, &buflen) : 0;
+
+	// Replace the newline with the tail
+	memcpy(cs->line, line, len - 1);
+	if (!returned && dir == CAPTURE_OUT) {
+		p = capture_data(cs, p, buf, min_t(unsigned long, buflen, capture));
+	} else if (returned && dir == CAPTURE_IN && ret > 0) {
+		// Only the bytes the call actually read
+		p = capture_data(cs, p, buf, min_t(unsigned long, min_t(unsigned long, ret, buflen), capture));
+	}
+	if (table[sysc].decode) {
+		p = returned ? decode_return(cs, p, end, sysc, reg, ret) : decode_call(cs, p, end, sysc, reg);
+	}
+	if (table[sysc].fdpath & FDPATH_TAG) {
+		p = fdpath_tag(p, end, sysc, reg, returned, ret);
+	}
+	*p++ = '\n';
+	*p = '\0';
+	log_line(sessions, cs->line, p - cs->line);
+	put_cpu_var(capture_scratch);
+}
+
+static long request_set_decode(int syscall, int on) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+	if (!decodable(syscall)) {
+		return -EINVAL;
+	}
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else {
+		table[syscall].decode = !!on;
+	}
+	spin_unlock(&calltable_lock);
+	return status;
+}
+//----------------------------------------------------------------
+
+
+
+//----- Futex contention -----------------------------------------
+/**
+ * With contention profiling turned on for futex, interceptor() times the
+ * waiting calls (FUTEX_WAIT, FUTEX_WAIT_BITSET, FUTEX_LOCK_PI and
+ * FUTEX_WAIT_REQUEUE_PI) and adds them to a per-CPU hash keyed by tgid
+ * and futex address, so the hot path takes no lock. Wakes and other
+ * operations are not counted. FUTEX_PATH lists the sites with the most
+ * time spent waiting, merged over all CPUs when it is read (see
+ * interceptor.h for the format); writing to it resets.
+ */
+
+#define CONTENTION_SLOTS        512
+#define CONTENTION_PROBES       8
+#define CONTENTION_TOP          64
+
+struct contention_site {
+	pid_t tgid;
+	unsigned long uaddr;
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+struct cpu_contention {
+	struct contention_site sites[CONTENTION_SLOTS];
+};
+
+static struct cpu_contention *contention_cpu[NR_CPUS];
+
+static int contention_waits(int op) {
+
+	switch (op & FUTEX_CMD_MASK) {
+		case FUTEX_WAIT:
+		case FUTEX_WAIT_BITSET:
+		case FUTEX_LOCK_PI:
+		case FUTEX_WAIT_REQUEUE_PI:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/**
+ * Find (or claim) the slot for a site in a CPU's table.
+ * If all probed slots are taken, the one with the least waiting is evicted.
+ */
+static struct contention_site *contention_slot(struct cpu_contention *cc, pid_t tgid,
+		unsigned long uaddr) {
+
+	struct contention_site *c, *victim = NULL;
+	unsigned long h = hash_long(uaddr ^ tgid, 9);
+	int i;
+
+	for (i = 0; i < CONTENTION_PROBES; i++) {
+		c = &cc->sites[(h + i) % CONTENTION_SLOTS];
+		if (c->tgid == tgid && c->uaddr == uaddr)
+			return c;
+		if (c->tgid == 0 || !victim || c->total_ns < victim->total_ns)
+			victim = c;
+		if (c->tgid == 0)
+			break;
+	}
+
+	memset(victim, 0, sizeof(*victim));
+	victim->tgid = tgid;
+	victim->uaddr = uaddr;
+	return victim;
+}
+
+/**
+ * Account one completed futex call that waited ns nanoseconds, if it is
+ * a waiting operation.
+ */
+static void contention_account(const struct pt_regs *reg, u64 ns) {
+
+	struct cpu_contention *cc;
+	struct contention_site *c;
+
+	if (!contention_waits(reg->cx)) {
+		return;
+	}
+
+	cc = contention_cpu[get_cpu()];
+	c = contention_slot(cc, current->tgid, reg->bx);
+	c->count++;
+	c->total_ns += ns;
+	if (ns > c->max_ns)
+		c->max_ns = ns;
+	put_cpu();
+}
+
+static int contention_cmp(const void *a, const void *b) {
+
+	const struct contention_site *x = a, *y = b;
+
+	if (x->total_ns == y->total_ns)
+		return 0;
+	return x->total_ns < y->total_ns ? 1 : -1;
+}
+
+static int contention_show(struct seq_file *m, void *v) {
+
+	struct contention_site *merged, *c, *q;
+	unsigned long nslots = CONTENTION_SLOTS * 2 * num_possible_cpus(), h, n = 0;
+	int cpu, i;
+
+	merged = vmalloc(nslots * sizeof(*merged));
+	if (!merged) {
+		return -ENOMEM;
+	}
+	memset(merged, 0, nslots * sizeof(*merged));
+
+	// The same site can have a slot on several CPUs; merge them first
+	for_each_possible_cpu(cpu) {
+		for (i = 0; i < CONTENTION_SLOTS; i++) {
+			c = &contention_cpu[cpu]->sites[i];
+			if (!c->tgid)
+				continue;
+			h = hash_long(c->uaddr ^ c->tgid, 16) % nslots;
+			for (q = &merged[h]; q->tgid && (q->tgid != c->tgid || q->uaddr != c->uaddr);
+					q = &merged[h]) {
+				h = (h + 1) % nslots;
+			}
+			if (!q->tgid) {
+				q->tgid = c->tgid;
+				q->uaddr = c->uaddr;
+				n++;
+			}
+			q->count += c->count;
+			q->total_ns += c->total_ns;
+			if (c->max_ns > q->max_ns)
+				q->max_ns = c->max_ns;
+		}
+	}
+
+	// Hottest first: free slots have no waiting, so they sort last
+	sort(merged, nslots, sizeof(*merged), contention_cmp, NULL);
+	for (i = 0; i < min_t(unsigned long, n, CONTENTION_TOP); i++) {
+		q = &merged[i];
+		seq_printf(m, "futex %d %lx %llu %llu %llu\n", q->tgid, q->uaddr,
+			q->count, q->total_ns, q->max_ns);
+	}
+
+	vfree(merged);
+	return 0;
+}
+
+static int contention_open(struct inode *inode, struct file *file) {
+	return single_open(file, contention_show, NULL);
+}
+
+/* Any write resets the counters */
+static ssize_t contention_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) {
+
+	int cpu;
+
+	if (current_uid() != 0)
+		return -EPERM;
+	for_each_possible_cpu(cpu)
+		memset(contention_cpu[cpu], 0, sizeof(struct cpu_contention));
+	return count;
+}
+
+static const struct file_operations contention_fops = {
+	.owner = THIS_MODULE,
+	.open = contention_open,
+	.read = seq_read,
+	.write = contention_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static long request_start_futex_profile(int syscall) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+	if (syscall != __NR_futex) {
+		return -EINVAL;
+	}
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else if (table[syscall].contention) {
+		status = -EBUSY;
+	} else {
+		table[syscall].contention = 1;
+	}
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static long request_stop_futex_profile(int syscall) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+	if (table[syscall].contention == 0) {
+		status = -EINVAL;
+	} else {
+		table[syscall].contention = 0;
+	}
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static int contention_init(void) {
+
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		contention_cpu[cpu] = vmalloc(sizeof(struct cpu_contention));
+		if (!contention_cpu[cpu])
+			return -ENOMEM;
+		memset(contention_cpu[cpu], 0, sizeof(struct cpu_contention));
+	}
+	if (!proc_create("futex", 0644, proc_dir, &contention_fops))
+		return -ENOMEM;
+	return 0;
+}
+
+static void contention_cleanup(void) {
+
+	int cpu;
+
+	if (proc_dir)
+		remove_proc_entry("futex", proc_dir);
+	for_each_possible_cpu(cpu) {
+		vfree(contention_cpu[cpu]);
+		contention_cpu[cpu] = NULL;
+	}
+}
+//----------------------------------------------------------------
+
+
+
+//----- Exit summaries -------------------------------------------
+/**
+ * With summaries turned on for an intercepted syscall, interceptor() also
+ * counts and times its calls per tgid, and when the process calls
+ * exit_group a single record with its whole profile is appended to
+ * SUMMARY_PATH (see interceptor.h for the format). As with the aggregate
+ * stats, the counters belong to the CPU they are updated on, so the hot
+ * path takes no lock; exit_group merges the process's slots from every
+ * CPU and frees them. A slot on another CPU may be claimed by a different
+ * process at the same time, so it is only freed with a cmpxchg of its
+ * tgid, which leaves it alone once someone else owns it. A process killed
+ * by a signal never calls exit_group, so its slots are simply reused once
+ * the table fills up.
+ */
+
+#define SUMMARY_SLOTS           256
+#define SUMMARY_PROBES          8
+#define SUMMARY_SYSCALLS        24
+#define SUMMARY_LINE_MAX        (64 + TASK_COMM_LEN + SUMMARY_SYSCALLS * 64)
+
+struct summary_entry {
+	u32 nr;
+	u32 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+struct proc_summary {
+	pid_t tgid;
+	int nsys;
+	u64 calls;
+	/* Calls to syscalls beyond the first SUMMARY_SYSCALLS */
+	u64 dropped;
+	struct summary_entry sys[SUMMARY_SYSCALLS];
+};
+
+struct cpu_summary {
+	struct proc_summary procs[SUMMARY_SLOTS];
+};
+
+static struct cpu_summary *summary_cpu[NR_CPUS];
+static struct session_buf summary_buf;
+/* Syscalls with summarized set; updated under calltable_lock */
+static int summarized_count;
+
+/* A tgid's slot in a CPU's table, or NULL; with claim, evicts the least used */
+static struct proc_summary *summary_slot(struct cpu_summary *cs, pid_t tgid, int claim) {
+
+	struct proc_summary *p, *victim = NULL;
+	unsigned long h = hash_long(tgid, 8);
+	int i;
+
+	for (i = 0; i < SUMMARY_PROBES; i++) {
+		p = &cs->procs[(h + i) % SUMMARY_SLOTS];
+		if (p->tgid == tgid)
+			return p;
+		if (p->tgid == 0 || !victim || p->calls < victim->calls)
+			victim = p;
+		if (p->tgid == 0)
+			break;
+	}
+	if (!claim)
+		return NULL;
+
+	victim->tgid = tgid;
+	victim->nsys = 0;
+	victim->calls = 0;
+	victim->dropped = 0;
+	return victim;
+}
+
+/* Add count calls of nr, taking total_ns and at most max_ns, to a summary */
+static void summary_add(struct proc_summary *p, u32 nr, u32 count, u64 total_ns, u64 max_ns) {
+
+	struct summary_entry *e;
+	int i;
+
+	p->calls += count;
+	for (i = 0; i < p->nsys && p->sys[i].nr != nr; i++)
+		;
+	if (i == p->nsys) {
+		if (i == SUMMARY_SYSCALLS) {
+			p->dropped += count;
+			return;
+		}
+		e = &p->sys[p->nsys++];
+		memset(e, 0, sizeof(*e));
+		e->nr = nr;
+	}
+	e = &p->sys[i];
+	e->count += count;
+	e->total_ns += total_ns;
+	if (max_ns > e->max_ns)
+		e->max_ns = max_ns;
+}
+
+/**
+ * Account one completed call of sysc that took ns nanoseconds to the
+ * current process.
+ */
+static void summary_account(int sysc, u64 ns) {
+
+	struct cpu_summary *cs = summary_cpu[get_cpu()];
+
+	summary_add(summary_slot(cs, current->tgid, 1), sysc, 1, ns, ns);
+	put_cpu();
+}
+
+/**
+ * Merge and free the current process's slots, and write out its record.
+ * Slots of threads still running on other CPUs can be torn; the rest of
+ * their calls is then lost.
+ */
+static void summary_exit_group(int status) {
+
+	struct proc_summary *merged, *p;
+	char *line;
+	int cpu, i, n;
+
+	// Most exits happen with no summary running; skip the allocation and probes
+	if (!summarized_count || !summary_buf.data)
+		return;
+	merged = kzalloc(sizeof(*merged), GFP_KERNEL);
+	if (!merged)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		p = summary_slot(summary_cpu[cpu], current->tgid, 0);
+		if (!p)
+			continue;
+		for (i = 0; i < p->nsys; i++)
+			summary_add(merged, p->sys[i].nr, p->sys[i].count, p->sys[i].total_ns, p->sys[i].max_ns);
+		merged->calls += p->dropped;
+		merged->dropped += p->dropped;
+		// Free the slot only if it is still ours
+		cmpxchg(&p->tgid, current->tgid, 0);
+	}
+
+	line = merged->calls ? kmalloc(SUMMARY_LINE_MAX, GFP_KERNEL) : NULL;
+	if (line) {
+		n = snprintf(line, SUMMARY_LINE_MAX, "exit %d ", current->tgid);
+		// Keep the record whitespace-separated
+		for (i = 0; i < TASK_COMM_LEN - 1 && current->comm[i]; i++)
+			line[n++] = current->comm[i] == ' ' ? '_' : current->comm[i];
+		n += snprintf(line + n, SUMMARY_LINE_MAX - n, " %d %llu", status,
+			(unsigned long long)merged->dropped);
+		for (i = 0; i < merged->nsys; i++) {
+			n += snprintf(line + n, SUMMARY_LINE_MAX - n, " %u:%u:%llu:%llu", merged->sys[i].nr,
+				merged->sys[i].count, (unsigned long long)merged->sys[i].total_ns,
+				(unsigned long long)merged->sys[i].max_ns);
+		}
+		n += snprintf(line + n, SUMMARY_LINE_MAX - n, "\n");
+		session_write(&summary_buf, line, n);
+		kfree(line);
 	}
-	return 0;
+	kfree(merged);
 }
-//----------------------------------------------------------------
 
-//----- Intercepting exit_group ----------------------------------
-/**
- * Since a process can exit without its owner specifically requesting
- * to stop monitoring it, we must intercept the exit_group system call
- * so that we can remove the exiting process's pid from *all* syscall lists.
- */
+static int summary_init(void) {
 
-/**
- * Stores original exit_group function - after all, we must restore it
- * when our kernel module exits.
- */
-void (*orig_exit_group)(int);
+	int cpu;
 
-/**
- * Our custom exit_group system call.
- *
- * TODO: When a process exits, make sure to remove that pid from all lists.
- * The exiting process's PID can be retrieved using the current variable (current->pid).
- * Don't forget to call the original exit_group.
- */
-void my_exit_group(int status)
-{
-	// Lock Access
-    spin_lock(&calltable_lock);
-    spin_lock(&pidlist_lock);
+	for_each_possible_cpu(cpu) {
+		summary_cpu[cpu] = vmalloc(sizeof(struct cpu_summary));
+		if (!summary_cpu[cpu])
+			return -ENOMEM;
+		memset(summary_cpu[cpu], 0, sizeof(struct cpu_summary));
+	}
 
-	// Delete the pid from all list of monitored pids.
-	del_pid(current->pid);
+	// Read and drained like a session buffer
+	spin_lock_init(&summary_buf.lock);
+	summary_buf.data = vmalloc(SESSION_BUF_SIZE);
+	if (!summary_buf.data)
+		return -ENOMEM;
+	if (!proc_create_data("summaries", 0400, proc_dir, &session_fops, &summary_buf))
+		return -ENOMEM;
+	return 0;
+}
 
-	// Unlock Access
-    spin_unlock(&pidlist_lock);
-    spin_unlock(&calltable_lock);
+static void summary_cleanup(void) {
 
-	// Original Exit Group Call
-	orig_exit_group(status);
+	int cpu;
+
+	if (proc_dir)
+		remove_proc_entry("summaries", proc_dir);
+	vfree(summary_buf.data);
+	summary_buf.data = NULL;
+	for_each_possible_cpu(cpu) {
+		vfree(summary_cpu[cpu]);
+		summary_cpu[cpu] = NULL;
+	}
 }
 //----------------------------------------------------------------
 
@@ -290,23 +3482,102 @@ void my_exit_group(int status)
  */
 asmlinkage long interceptor(struct pt_regs reg) {
 
-	int hasPid;
+	unsigned int listed, sessions;
+	int sysc = reg.ax;
+	struct pid *pid = task_pid(current);
+	pid_t vpid;
+	long ret;
+	s64 ns;
+	ktime_t start;
+	char line[LOG_LINE_MAX];
+	int len;
+	s64 wait = 0;
+	u64 delay = 0;
+	int extended = table[sysc].capture || table[sysc].decode || table[sysc].fdpath;
+	unsigned long brk = 0;
+
 	spin_lock(&calltable_lock);
 
-	// Read pid
+	// Take a token first if the call is rate limited
+	if (table[sysc].throttle)
+		wait = throttle_take(table[sysc].throttle);
+	// And work out any delay to inject
+	if (table[sysc].injection)
+		delay = injection_delay(table[sysc].injection);
+
+	// Read pid: the sessions that listed it, all in one walk
 	spin_lock(&pidlist_lock);	
-	hasPid = check_pid_monitored(reg.ax, current->pid);
+	listed = pid_sessions(sysc, pid);
 	spin_unlock(&pidlist_lock);
 
 	// Read monitored
 	spin_unlock(&calltable_lock);
 
-	// If monitoring all and not blacklisted, or is not monitoring all but whitelisted
-	if (((table[reg.ax].monitored == 2) && (hasPid == 0)) || ((table[reg.ax].monitored == 1) && (hasPid == 1))) {
-		log_message(current->pid, reg.ax, reg.bx, reg.cx, reg.dx, reg.si, reg.di, reg.bp);
+	if (wait) {
+		throttle_wait(sysc, wait);
+		if (wait < 0)
+			return wait;
+	}
+	if (delay)
+		sleep_ns(delay);
+
+	// Sessions monitoring all and not blacklisting it, or not monitoring all but whitelisting it
+	sessions = (table[sysc].all_mask & ~listed) | (table[sysc].some_mask & listed);
+	// Or is the process running as a monitored user or group?
+	if (table[sysc].nids)
+		sessions |= id_sessions(sysc);
+	// Or does its executable match a pattern? (cached per task and exec)
+	if (table[sysc].patterns)
+		sessions |= exec_sessions(sysc);
+	// Count down event budgets; the last event hands over to expire_work
+	if (sessions & table[sysc].budget_mask)
+		sessions = spend_budget(sysc, sessions);
+
+	// Pid as seen from the task's own namespace too, if it is not the initial one
+	vpid = pid->level ? pid->numbers[pid->level].nr : 0;
+	if (sessions) {
+		len = format_call(line, vpid, &reg);
+		if (extended)
+			log_line_extended(sessions, line, len, sysc, &reg, 0, 0);
+		else
+			log_line(sessions, line, len);
 	}
 	// Returns the original custom syscall.
-	return table[reg.ax].f(reg);
+	if (!sessions && !table[sysc].aggregated && !table[sysc].summarized &&
+			!(table[sysc].fdpath & FDPATH_TRACK) && !table[sysc].contention &&
+			!table[sysc].lineage && !table[sysc].fdlife)
+		return table[sysc].f(reg);
+
+	// brk returns the new break, so keep the old one to see the growth
+	if (sysc == __NR_brk && table[sysc].aggregated && current->mm)
+		brk = current->mm->brk;
+
+	// Time the original call for the per-CPU stats and the return record
+	start = ktime_get();
+	ret = table[sysc].f(reg);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (table[sysc].aggregated)
+		stats_account(sysc, ret, ns, memory_growth(sysc, &reg, ret, brk));
+	if (table[sysc].summarized)
+		summary_account(sysc, ns);
+	if (table[sysc].contention)
+		contention_account(&reg, ns);
+	// Before the return line, which may look the new fd up
+	if (table[sysc].fdpath & FDPATH_TRACK)
+		fdpath_update(sysc, &reg, ret);
+	if (table[sysc].fdlife)
+		fdlife_update(sysc, &reg, ret);
+	// Records of a new child or program go before the return line
+	if (table[sysc].lineage)
+		lineage_update(sysc, &reg, ret, sessions);
+	if (sessions) {
+		len = format_return(line, vpid, sysc, ret, ns);
+		if (extended)
+			log_line_extended(sessions, line, len, sysc, &reg, 1, ret);
+		else
+			log_line(sessions, line, len);
+	}
+	return ret;
 
 	// return 0; // Just a placeholder, so it compiles with no warnings!
 }
@@ -338,6 +3609,9 @@ static long request_syscall_intercept(int syscall) {
 
 static long request_syscall_release(int syscall) {
 
+	struct throttle *t;
+	struct injection *inj;
+
 	// Check if root
 	if (current_uid() != 0) {
 		return -EPERM;
@@ -355,51 +3629,67 @@ static long request_syscall_release(int syscall) {
 	sys_call_table[syscall] = table[syscall].f;
 	// Flag to intercept syscall
 	table[syscall].intercepted = 0;
+	table[syscall].aggregated = 0;
+	if (table[syscall].summarized)
+		summarized_count--;
+	table[syscall].summarized = 0;
+	table[syscall].capture = 0;
+	table[syscall].decode = 0;
+	table[syscall].fdpath = 0;
+	table[syscall].contention = 0;
+	table[syscall].lineage = 0;
+	table[syscall].fdlife = 0;
+	t = unset_throttle(syscall);
+	inj = unset_injection(syscall);
 	set_addr_ro((unsigned long) sys_call_table);
 	spin_unlock(&calltable_lock);
+	free_throttle(t);
+	free_injection(inj);
 	return 0;
 }
 
-static long request_start_monitoring(int syscall, int pid) {
+static long request_start_monitoring(int syscall, struct pid *pid, int session) {
 	int status = 0;
 	int hasPid;
 
 	// Check if root user, or if monitoring own process
 	if (
 		current_uid() != 0 &&
-		(pid == 0 || check_pid_from_list(pid, current->pid) != 0)
+		(!pid || check_pid_from_list(pid, task_pid(current)) != 0)
 	) {
 		return -EPERM;
 	}
 
 	spin_lock(&calltable_lock);
 
-	if (pid == 0) {
+	if (!pid) {
 		// If already monitoring all, no good
-		if (table[syscall].monitored == 2) {
+		if (table[syscall].monitored[session] == 2) {
 			status = -EBUSY;
 		} else {
 			// Reset list to blacklist and set to monitor all
 			spin_lock(&pidlist_lock);
-			destroy_list(syscall);
+			destroy_list(syscall, session);
 			spin_unlock(&pidlist_lock);
-			table[syscall].monitored = 2;
+			table[syscall].monitored[session] = 2;
+			update_masks(syscall);
 		}
 	} else {
 		spin_lock(&pidlist_lock);
 
 		// If not monitoring all, try to add to whitelist
-		if (table[syscall].monitored != 2) {
-			hasPid = check_pid_monitored(syscall, pid);
-			status = hasPid ? -EBUSY : add_pid_sysc(pid, syscall);
+		if (table[syscall].monitored[session] != 2) {
+			hasPid = check_pid_monitored(syscall, pid, session);
+			status = hasPid ? -EBUSY : add_pid_sysc(pid, syscall, session);
 
 			if (status == 0) {
-				table[syscall].monitored = 1;
+				table[syscall].monitored[session] = 1;
+				update_masks(syscall);
 			}
 
 		// If not, try to remove from whitelist
 		} else {
-			status = del_pid_sysc(pid, syscall);
+			status = del_pid_sysc(pid, syscall, session);
 		}
 
 		spin_unlock(&pidlist_lock);
@@ -409,45 +3699,46 @@ static long request_start_monitoring(int syscall, int pid) {
 	return status;
 }
 
-static long request_stop_monitoring(int syscall, int pid) {
+static long request_stop_monitoring(int syscall, struct pid *pid, int session) {
 	int status = 0;
 	int hasPid;
 
 	// Check if root user, or if monitoring own process
 	if (
 		current_uid() != 0 &&
-		(pid == 0 || check_pid_from_list(pid, current->pid) != 0)
+		(!pid || check_pid_from_list(pid, task_pid(current)) != 0)
 	) {
 		return -EPERM;
 	}
 
 	spin_lock(&calltable_lock);
 
-	if (pid == 0) {
+	if (!pid) {
 		// If already monitoring all, no good
-		if (table[syscall].monitored != 2) {
+		if (table[syscall].monitored[session] != 2) {
 			status = -EINVAL;
 		} else {
 			// Reset list to whitelist
 			spin_lock(&pidlist_lock);
-			destroy_list(syscall);
+			destroy_list(syscall, session);
 			spin_unlock(&pidlist_lock);
 		}
 	} else {
 		spin_lock(&pidlist_lock);
 
 		// If monitoring all, try to add to blacklist
-		if (table[syscall].monitored == 2) {
-			hasPid = check_pid_monitored(syscall, pid);
-			status = hasPid ? -EBUSY : add_pid_sysc(pid, syscall);
+		if (table[syscall].monitored[session] == 2) {
+			hasPid = check_pid_monitored(syscall, pid, session);
+			status = hasPid ? -EBUSY : add_pid_sysc(pid, syscall, session);
 
 			if (status == 0) {
-				table[syscall].monitored = 1;
+				table[syscall].monitored[session] = 1;
+				update_masks(syscall);
 			}
 
 		// If not, try to remove from blacklist
 		} else {
-			status = del_pid_sysc(pid, syscall);
+			status = del_pid_sysc(pid, syscall, session);
 		}
 
 		spin_unlock(&pidlist_lock);
@@ -457,6 +3748,240 @@ static long request_stop_monitoring(int syscall, int pid) {
 	return status;
 }
 
+static long request_start_id_monitoring(int syscall, int which, unsigned int id, int session) {
+
+	int status;
+
+	// Check if root user, or if monitoring own user or group
+	if (
+		current_uid() != 0 &&
+		(which == ID_UID ? id != current_uid() : !in_group_p(id))
+	) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+	status = add_id_sysc(syscall, which, id, session);
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static long request_stop_id_monitoring(int syscall, int which, unsigned int id, int session) {
+
+	int status;
+
+	// Check if root user, or if monitoring own user or group
+	if (
+		current_uid() != 0 &&
+		(which == ID_UID ? id != current_uid() : !in_group_p(id))
+	) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+	status = del_id_sysc(syscall, which, id, session);
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+/**
+ * Copy a pattern from user space into buf (MONITOR_PATTERN_LEN bytes).
+ */
+static long copy_pattern(char *buf, unsigned long upattern) {
+
+	long len = strncpy_from_user(buf, (const char __user *)upattern, MONITOR_PATTERN_LEN);
+
+	if (len < 0)
+		return len;
+	if (len == MONITOR_PATTERN_LEN)
+		return -ENAMETOOLONG;
+	if (len == 0)
+		return -EINVAL;
+	return 0;
+}
+
+static long request_start_exec_monitoring(int syscall, unsigned long upattern, int session) {
+
+	char pattern[MONITOR_PATTERN_LEN];
+	long status;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	// Copy before locking: this can fault
+	status = copy_pattern(pattern, upattern);
+	if (status) {
+		return status;
+	}
+
+	spin_lock(&calltable_lock);
+	status = add_pattern_sysc(syscall, pattern, session);
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static long request_stop_exec_monitoring(int syscall, unsigned long upattern, int session) {
+
+	char pattern[MONITOR_PATTERN_LEN];
+	long status;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	status = copy_pattern(pattern, upattern);
+	if (status) {
+		return status;
+	}
+
+	spin_lock(&calltable_lock);
+	status = del_pattern_sysc(syscall, pattern, session);
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static long request_monitoring_timeout(int syscall, int seconds, int session) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+	if (seconds > 0 && !is_monitored(syscall, session)) {
+		status = -EINVAL;
+	}
+	spin_unlock(&calltable_lock);
+
+	if (status == 0) {
+		// A new timeout replaces the old one; 0 just cancels it
+		cancel_delayed_work(&table[syscall].limits[session].expire_work);
+		if (seconds > 0)
+			schedule_delayed_work(&table[syscall].limits[session].expire_work, (unsigned long)seconds * HZ);
+	}
+	return status;
+}
+
+static long request_monitoring_budget(int syscall, int events, int session) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+	if (events > 0 && !is_monitored(syscall, session)) {
+		status = -EINVAL;
+	} else {
+		atomic_set(&table[syscall].limits[session].budget, events);
+		if (events > 0)
+			table[syscall].budget_mask |= SESSION_BIT(session);
+		else
+			table[syscall].budget_mask &= ~SESSION_BIT(session);
+	}
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static long request_start_aggregation(int syscall) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+
+	// Only intercepted calls pass through interceptor() to be counted
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else if (table[syscall].aggregated == 1) {
+		status = -EBUSY;
+	} else {
+		table[syscall].aggregated = 1;
+	}
+
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static long request_stop_aggregation(int syscall) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+
+	if (table[syscall].aggregated == 0) {
+		status = -EINVAL;
+	} else {
+		table[syscall].aggregated = 0;
+	}
+
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static long request_start_summary(int syscall) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+
+	// Only intercepted calls pass through interceptor() to be counted
+	if (table[syscall].intercepted == 0) {
+		status = -EINVAL;
+	} else if (table[syscall].summarized == 1) {
+		status = -EBUSY;
+	} else {
+		table[syscall].summarized = 1;
+		summarized_count++;
+	}
+
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
+static long request_stop_summary(int syscall) {
+
+	int status = 0;
+
+	// Check if root
+	if (current_uid() != 0) {
+		return -EPERM;
+	}
+
+	spin_lock(&calltable_lock);
+
+	if (table[syscall].summarized == 0) {
+		status = -EINVAL;
+	} else {
+		table[syscall].summarized = 0;
+		summarized_count--;
+	}
+
+	spin_unlock(&calltable_lock);
+	return status;
+}
+
 /**
  * My system call - this function is called whenever a user issues a MY_CUSTOM_SYSCALL system call.
  * When that happens, the parameters for this system call indicate one of 4 actions/commands:
@@ -464,7 +3989,48 @@ static long request_stop_monitoring(int syscall, int pid) {
  *      - REQUEST_SYSCALL_RELEASE to de-intercept the 'syscall' argument
  *      - REQUEST_START_MONITORING to start monitoring for 'pid' whenever it issues 'syscall'
  *      - REQUEST_STOP_MONITORING to stop monitoring for 'pid'
- *      For the last two, if pid=0, that translates to "all pids".
+ *      For the last two, if pid=0, that translates to "all pids". 'pid' is
+ *      a pid in the caller's pid namespace.
+ *      - REQUEST_START_AGGREGATION to time and count every call of an
+ *        intercepted 'syscall' in the per-CPU stats (root only)
+ *      - REQUEST_STOP_AGGREGATION to stop doing so
+ *      - REQUEST_START_SUMMARY to count and time every call of an intercepted
+ *        'syscall' per process, for the record written when it exits (root
+ *        only), and REQUEST_STOP_SUMMARY to stop doing so
+ *      - REQUEST_START_THROTTLE to limit the rate of an intercepted 'syscall'
+ *        as described by the struct throttle_request 'pid' points to (root
+ *        only), and REQUEST_STOP_THROTTLE to lift the limit
+ *      - REQUEST_START_INJECTION to delay calls of an intercepted 'syscall'
+ *        as described by the struct inject_request 'pid' points to (root
+ *        only), and REQUEST_STOP_INJECTION to stop
+ *      - REQUEST_SET_CAPTURE to log the first 'pid' bytes of the buffer of
+ *        a read/write-style 'syscall' with its events (root only; 0 stops)
+ *      - REQUEST_SET_DECODE to decode the struct arguments of 'syscall' into
+ *        its events if 'pid' is nonzero, or stop if it is 0 (root only)
+ *      - REQUEST_SET_FDPATH to tag the events of 'syscall' with the path ids
+ *        of its fds, or keep the fd cache from 'syscall' (open, close, dup),
+ *        if 'pid' is nonzero, or stop if it is 0 (root only)
+ *      - REQUEST_START_FUTEX_PROFILE to profile the waits of an intercepted
+ *        futex (root only), and REQUEST_STOP_FUTEX_PROFILE to stop
+ *      - REQUEST_SET_LINEAGE to keep the process lineage table from the calls
+ *        of 'syscall' if 'pid' is nonzero, or stop if it is 0 (root only)
+ *      - REQUEST_SET_FDLIFE to track the lifetimes of the fds 'syscall'
+ *        creates or closes if 'pid' is nonzero, or stop if it is 0 (root only)
+ *      - REQUEST_START_UID_MONITORING / REQUEST_STOP_UID_MONITORING to start or
+ *        stop monitoring every process running as uid 'pid' (root, or own uid)
+ *      - REQUEST_START_GID_MONITORING / REQUEST_STOP_GID_MONITORING, likewise
+ *        for gid 'pid' (root, or a member of the group)
+ *      - REQUEST_START_EXEC_MONITORING / REQUEST_STOP_EXEC_MONITORING to start
+ *        or stop monitoring every task whose command name (or executable
+ *        path, if it starts with '/') matches the pattern string that 'pid'
+ *        points to (root only)
+ *      - REQUEST_MONITORING_TIMEOUT to stop all monitoring of 'syscall' after
+ *        'pid' seconds, and REQUEST_MONITORING_BUDGET to stop it after 'pid'
+ *        more logged calls (root only; 0 removes the limit)
+ *      The monitoring commands above act on session 0, or on the session
+ *      encoded in 'cmd' by REQUEST_SESSION(cmd, session). Sessions have
+ *      separate targets and limits, and sessions above 0 log to their own
+ *      buffer (SESSION_PATH) instead of the kernel log.
  *
  * TODO: Implement this function, to handle all 4 commands correctly.
  *
@@ -508,6 +4074,18 @@ static long request_stop_monitoring(int syscall, int pid) {
  */
 asmlinkage long my_syscall(int cmd, int syscall, int pid) {
 
+	int session = cmd >> REQUEST_SESSION_SHIFT;
+	struct throttle_request rule;
+	struct inject_request inject;
+	struct pid *target;
+	long status;
+
+	// Split off the session a monitoring command is aimed at
+	cmd &= (1 << REQUEST_SESSION_SHIFT) - 1;
+	if (session < 0 || session >= MAX_SESSIONS) {
+		return -EINVAL;
+	}
+
 	// Check if syscall is valid
 	if (syscall <= 0 || syscall > NR_syscalls) {
 		return -EINVAL;
@@ -521,18 +4099,136 @@ asmlinkage long my_syscall(int cmd, int syscall, int pid) {
 			return request_syscall_release(syscall);
 
 		case REQUEST_START_MONITORING:
+		case REQUEST_STOP_MONITORING:
+			// Resolve the pid in the caller's namespace, and hold on to it
+			rcu_read_lock();
+			target = pid > 0 ? get_pid(find_vpid(pid)) : NULL;
+			rcu_read_unlock();
 			// Check if valid pid
-			if (pid != 0 && !pid_task(find_vpid(pid), PIDTYPE_PID)) {
+			if (pid != 0 && !pid_task(target, PIDTYPE_PID)) {
+				put_pid(target);
 				return -EINVAL;
 			}
-			return request_start_monitoring(syscall, pid);
+			if (cmd == REQUEST_START_MONITORING)
+				status = request_start_monitoring(syscall, target, session);
+			else
+				status = request_stop_monitoring(syscall, target, session);
+			put_pid(target);
+			return status;
 
-		case REQUEST_STOP_MONITORING:
-			// Check if valid pid
-			if (pid != 0 && !pid_task(find_vpid(pid), PIDTYPE_PID)) {
+		case REQUEST_START_AGGREGATION:
+			return request_start_aggregation(syscall);
+
+		case REQUEST_STOP_AGGREGATION:
+			return request_stop_aggregation(syscall);
+
+		case REQUEST_START_THROTTLE:
+			// The pid argument carries a pointer to the rule
+			if (copy_from_user(&rule, (const void __user *)(unsigned long)pid, sizeof(rule))) {
+				return -EFAULT;
+			}
+			if (rule.pid < 0) {
+				return -EINVAL;
+			}
+			// Resolve the pid in the caller's namespace, as for monitoring
+			rcu_read_lock();
+			target = rule.pid ? get_pid(find_vpid(rule.pid)) : NULL;
+			rcu_read_unlock();
+			if (rule.pid && !pid_task(target, PIDTYPE_PID)) {
+				put_pid(target);
+				return -EINVAL;
+			}
+			status = request_start_throttle(syscall, target, &rule);
+			put_pid(target);
+			return status;
+
+		case REQUEST_STOP_THROTTLE:
+			return request_stop_throttle(syscall);
+
+		case REQUEST_START_INJECTION:
+			// The pid argument carries a pointer to the rule
+			if (copy_from_user(&inject, (const void __user *)(unsigned long)pid, sizeof(inject))) {
+				return -EFAULT;
+			}
+			if (inject.pid < 0) {
+				return -EINVAL;
+			}
+			rcu_read_lock();
+			target = inject.pid ? get_pid(find_vpid(inject.pid)) : NULL;
+			rcu_read_unlock();
+			if (inject.pid && !pid_task(target, PIDTYPE_PID)) {
+				put_pid(target);
+				return -EINVAL;
+			}
+			status = request_start_injection(syscall, target, &inject);
+			put_pid(target);
+			return status;
+
+		case REQUEST_STOP_INJECTION:
+			return request_stop_injection(syscall);
+
+		case REQUEST_SET_CAPTURE:
+			// The pid argument carries the number of bytes
+			return request_set_capture(syscall, pid);
+
+		case REQUEST_SET_DECODE:
+			// The pid argument turns decoding on or off
+			return request_set_decode(syscall, pid);
+
+		case REQUEST_SET_FDPATH:
+			// The pid argument turns fd paths on or off
+			return request_set_fdpath(syscall, pid);
+
+		case REQUEST_SET_LINEAGE:
+			// The pid argument turns lineage on or off
+			return request_set_lineage(syscall, pid);
+
+		case REQUEST_SET_FDLIFE:
+			// The pid argument turns fd lifetimes on or off
+			return request_set_fdlife(syscall, pid);
+
+		case REQUEST_START_FUTEX_PROFILE:
+			return request_start_futex_profile(syscall);
+
+		case REQUEST_STOP_FUTEX_PROFILE:
+			return request_stop_futex_profile(syscall);
+
+		case REQUEST_START_SUMMARY:
+			return request_start_summary(syscall);
+
+		case REQUEST_STOP_SUMMARY:
+			return request_stop_summary(syscall);
+
+		case REQUEST_START_UID_MONITORING:
+		case REQUEST_STOP_UID_MONITORING:
+		case REQUEST_START_GID_MONITORING:
+		case REQUEST_STOP_GID_MONITORING:
+			// The pid argument carries the uid or gid; -1 is never a valid id
+			if (pid < 0) {
+				return -EINVAL;
+			}
+			if (cmd == REQUEST_START_UID_MONITORING || cmd == REQUEST_START_GID_MONITORING)
+				return request_start_id_monitoring(syscall,
+					cmd == REQUEST_START_UID_MONITORING ? ID_UID : ID_GID, pid, session);
+			return request_stop_id_monitoring(syscall,
+				cmd == REQUEST_STOP_UID_MONITORING ? ID_UID : ID_GID, pid, session);
+
+		case REQUEST_START_EXEC_MONITORING:
+			// The pid argument carries a pointer to the pattern
+			return request_start_exec_monitoring(syscall, (unsigned long)pid, session);
+
+		case REQUEST_STOP_EXEC_MONITORING:
+			return request_stop_exec_monitoring(syscall, (unsigned long)pid, session);
+
+		case REQUEST_MONITORING_TIMEOUT:
+		case REQUEST_MONITORING_BUDGET:
+			// The pid argument carries the limit
+			if (pid < 0) {
 				return -EINVAL;
 			}
-			return request_stop_monitoring(syscall, pid);
+			if (cmd == REQUEST_MONITORING_TIMEOUT)
+				return request_monitoring_timeout(syscall, pid, session);
+			return request_monitoring_budget(syscall, pid, session);
 
 		default:
 			return -EINVAL;
@@ -562,7 +4258,37 @@ long (*orig_custom_syscall)(void); // STORES FUNCTION OF ORGINAL SYSCALL
  */
 static int init_function(void) {
 
-	int syscall;
+	int syscall, i, s;
+	int status;
+
+	// Set up the stats before any syscall can reach interceptor()
+	status = stats_init();
+	if (!status)
+		status = exec_match_init();
+	if (!status)
+		status = sessions_init();
+	if (!status)
+		status = summary_init();
+	if (!status)
+		status = fdpath_init();
+	if (!status)
+		status = contention_init();
+	if (!status)
+		status = lineage_init();
+	if (!status)
+		status = fdlife_init();
+	if (status) {
+		fdlife_cleanup();
+		lineage_cleanup();
+		contention_cleanup();
+		fdpath_cleanup();
+		summary_cleanup();
+		sessions_exit();
+		exec_match_cleanup();
+		stats_exit();
+		return status;
+	}
+
     spin_lock(&calltable_lock);
     spin_lock(&pidlist_lock);
 
@@ -580,9 +4306,38 @@ static int init_function(void) {
 
 	// Map all the kernal syscall commands to our abstract data structure for conditional behaviour.
 	for (syscall = 0; syscall < NR_syscalls; syscall++) {
-		table[syscall].listcount = 0;
 		table[syscall].intercepted = 0;
-		table[syscall].monitored = 0;
+		table[syscall].aggregated = 0;
+		table[syscall].summarized = 0;
+		table[syscall].throttle = NULL;
+		table[syscall].injection = NULL;
+		table[syscall].capture = 0;
+		table[syscall].decode = 0;
+		table[syscall].fdpath = 0;
+		table[syscall].contention = 0;
+		table[syscall].lineage = 0;
+		table[syscall].fdlife = 0;
+		for (s = 0; s < MAX_SESSIONS; s++) {
+			table[syscall].listcount[s] = 0;
+			table[syscall].monitored[s] = 0;
+			table[syscall].limits[s].sysc = syscall;
+			table[syscall].limits[s].session = s;
+			atomic_set(&table[syscall].limits[s].budget, 0);
+			INIT_DELAYED_WORK(&table[syscall].limits[s].expire_work, monitoring_expire);
+		}
+		table[syscall].some_mask = 0;
+		table[syscall].all_mask = 0;
+		table[syscall].budget_mask = 0;
+		for (i = 0; i < MONITOR_IDS; i++) {
+			table[syscall].ids[ID_UID][i] = NO_ID;
+			table[syscall].ids[ID_GID][i] = NO_ID;
+			table[syscall].id_session[ID_UID][i] = 0;
+			table[syscall].id_session[ID_GID][i] = 0;
+		}
+		table[syscall].nids = 0;
+		table[syscall].patterns = 0;
+		for (i = 0; i < MONITOR_PATTERNS; i++)
+			table[syscall].pattern_sessions[i] = 0;
 		table[syscall].f = sys_call_table[syscall];
 	 	INIT_LIST_HEAD(&(table[syscall].my_list));
 	}
@@ -608,6 +4363,22 @@ static int init_function(void) {
  */
 static void exit_function(void)
 {
+	struct throttle *t;
+	struct injection *inj;
+	int syscall, s;
+
+	// No expiry may run once the module is gone
+	for (syscall = 0; syscall < NR_syscalls; syscall++) {
+		for (s = 0; s < MAX_SESSIONS; s++)
+			cancel_delayed_work_sync(&table[syscall].limits[s].expire_work);
+		// Intercepted calls may still be reading them; unset under the lock
+		spin_lock(&calltable_lock);
+		t = unset_throttle(syscall);
+		inj = unset_injection(syscall);
+		spin_unlock(&calltable_lock);
+		free_throttle(t);
+		free_injection(inj);
+	}
 
 	spin_lock(&calltable_lock);
 	spin_lock(&pidlist_lock);
@@ -624,6 +4395,14 @@ static void exit_function(void)
 	spin_unlock(&pidlist_lock);
     spin_unlock(&calltable_lock);
 
+	fdlife_cleanup();
+	lineage_cleanup();
+	contention_cleanup();
+	fdpath_cleanup();
+	summary_cleanup();
+	sessions_exit();
+	exec_match_cleanup();
+	stats_exit();
 }
 
 module_init(init_function);
@@ -5,18 +5,226 @@
 #define REQUEST_SYSCALL_RELEASE         2
 #define REQUEST_START_MONITORING        3
 #define REQUEST_STOP_MONITORING         4
+#define REQUEST_START_AGGREGATION       5
+#define REQUEST_STOP_AGGREGATION        6
+#define REQUEST_START_UID_MONITORING    7
+#define REQUEST_STOP_UID_MONITORING     8
+#define REQUEST_START_GID_MONITORING    9
+#define REQUEST_STOP_GID_MONITORING     10
+#define REQUEST_START_EXEC_MONITORING   11
+#define REQUEST_STOP_EXEC_MONITORING    12
+#define REQUEST_MONITORING_TIMEOUT      13
+#define REQUEST_MONITORING_BUDGET       14
+#define REQUEST_START_SUMMARY           15
+#define REQUEST_STOP_SUMMARY            16
+#define REQUEST_START_THROTTLE          17
+#define REQUEST_STOP_THROTTLE           18
+#define REQUEST_START_INJECTION         19
+#define REQUEST_STOP_INJECTION          20
+#define REQUEST_SET_CAPTURE             21
+#define REQUEST_SET_DECODE              22
+#define REQUEST_SET_FDPATH              23
+#define REQUEST_START_FUTEX_PROFILE     24
+#define REQUEST_STOP_FUTEX_PROFILE      25
+#define REQUEST_SET_LINEAGE             26
+#define REQUEST_SET_FDLIFE              27
 
 #define MY_CUSTOM_SYSCALL               0
 
+/**
+ * Monitoring commands (START/STOP_MONITORING and the uid, gid, exec and
+ * limit commands) apply to session 0 unless they are aimed at another
+ * one with REQUEST_SESSION(cmd, session). Each session has its own
+ * targets. Session 0 logs to the kernel log; session N > 0 logs the same
+ * lines into a buffer read from SESSION_PATH (as root).
+ */
+#define MAX_SESSIONS                    4
+#define REQUEST_SESSION_SHIFT           8
+#define REQUEST_SESSION(cmd, session)   ((cmd) | ((session) << REQUEST_SESSION_SHIFT))
+#define SESSION_PATH                    "/proc/interceptor/session%d"
+
+/**
+ * Aggregated counters are read from STATS_PATH as text, one record per line:
+ *
+ *   time <ns>
+ *   syscall <nr> <count> <errors> <total_ns> <max_ns> <bytes> [<bucket>:<n>]...
+ *   process <tgid> <comm> <count> <total_ns> <bytes>
+ *   memory <tgid> <calls> <mapped> <unmapped>
+ *   throttle <nr> <delayed> <rejected> <delay_ns>
+ *
+ * time is the monotonic clock when the snapshot was taken. Latency bucket b
+ * counts calls that took [2^(b-1), 2^b) ns (bucket 0 is 0 ns); only
+ * non-empty buckets are listed. bytes is the sum of positive return values
+ * of read/write-style calls. Spaces in comm are printed as '_'. throttle
+ * records count the calls a throttle delayed (and for how long in all) or
+ * failed, whether or not the syscall is aggregated. A memory record follows
+ * the process record of a process that made aggregated mmap, mmap2, munmap,
+ * mremap or brk calls: how many, and the bytes they mapped and unmapped
+ * (page-rounded lengths, and the moves of the break).
+ * Writing anything to STATS_PATH (as root) resets all counters.
+ */
+#define STATS_PATH                      "/proc/interceptor/stats"
+#define STATS_HIST_BUCKETS              64
+
+/**
+ * With summaries turned on for a syscall, each process that calls
+ * exit_group leaves one record in SUMMARY_PATH, read (and drained) as root:
+ *
+ *   exit <tgid> <comm> <status> <dropped> [<nr>:<count>:<total_ns>:<max_ns>]...
+ *
+ * with one entry per summarized syscall the process made. dropped counts
+ * calls to syscalls beyond the first 24 per process, which have no entry.
+ */
+#define SUMMARY_PATH                    "/proc/interceptor/summaries"
+
+/**
+ * With REQUEST_SET_CAPTURE, calls of read/write-style syscalls carry up to
+ * CAPTURE_MAX bytes of their buffer: " data=<hex>" before the newline of
+ * the call line (write, pwrite64, send, sendto) or the return line (read,
+ * pread64, recv, recvfrom).
+ */
+#define CAPTURE_MAX                     256
+
+/**
+ * With REQUEST_SET_DECODE, struct arguments are decoded into the events,
+ * appended before the newline like captured data: " sa=inet:<ip>:<port>"
+ * (also inet6, unix, or af<family>) for socketcall connect, bind and
+ * sendto, " iov=<count>:<len>,..." for readv, writev, preadv and pwritev,
+ * " ts=<sec>.<nsec>" for nanosleep, and " st=<octal mode>:<size>" on the
+ * return line of a successful stat64, lstat64 or fstat64.
+ */
+
+/**
+ * With REQUEST_SET_FDPATH, events of syscalls that take a file descriptor
+ * (read, write, close, fsync, ...) carry " path=<id>" on the call line,
+ * and opens carry the id of the new fd on the return line. Each path is
+ * written once to FDPATH_PATH, read (and drained) as root:
+ *
+ *   path <id> <path>
+ *
+ * The ids come from a cache filled by open, openat and creat and kept up
+ * by close, dup, dup2 and dup3, which need REQUEST_SET_FDPATH as well.
+ * Fds opened while FDPATH_PATH is full get no id, so every id a line
+ * carries has its path record.
+ */
+#define FDPATH_PATH                     "/proc/interceptor/paths"
+
+/**
+ * REQUEST_START_FUTEX_PROFILE times the waiting calls of an intercepted
+ * futex (FUTEX_WAIT, FUTEX_WAIT_BITSET, FUTEX_LOCK_PI, FUTEX_WAIT_REQUEUE_PI)
+ * per process and futex address. FUTEX_PATH lists the sites with the most
+ * time spent waiting, hottest first (writing to it resets):
+ *
+ *   futex <tgid> <uaddr hex> <count> <total_ns> <max_ns>
+ */
+#define FUTEX_PATH                      "/proc/interceptor/futex"
+
+/**
+ * With REQUEST_SET_LINEAGE on a syscall, its calls keep a table of the
+ * processes making them, and each change is logged to the sessions the
+ * call goes to as a record of its own, between the event lines:
+ *
+ *   fork <tgid> <ppid> <start_ns> <comm>
+ *   exec <tgid> <ppid> <start_ns> <exe id> <comm>
+ *   exit <tgid> <status>
+ *
+ * fork comes from fork, vfork and clone returns (not new threads). exec
+ * comes from the first call after an exec, and the first call a session
+ * logs from a process. The exe id is a path id of FDPATH_PATH (0 if not
+ * known), start_ns the task's monotonic start time, and spaces in comm
+ * are printed as '_'. Turning it on for brk catches execs early, since
+ * the dynamic loader calls brk first. LINEAGE_PATH lists the table:
+ *
+ *   proc <tgid> <ppid> <start_ns> <exe id> <comm>
+ */
+#define LINEAGE_PATH                    "/proc/interceptor/lineage"
+
+/**
+ * With REQUEST_SET_FDLIFE on the syscalls that create fds (open, openat,
+ * creat, socketcall socket/accept/accept4/socketpair, pipe, pipe2, dup,
+ * dup2, dup3, fcntl F_DUPFD) and on close, every open fd is tracked with
+ * the syscall that created it. FDLIFE_PATH reports, one record per line:
+ *
+ *   time <ns>
+ *   untracked <fds>
+ *   closed <kind> <count> [<bucket>:<n>]...
+ *   live <kind> <count> [<bucket>:<n>]...
+ *   oldest <tgid> <fd> <nr> <kind> <age_ns>
+ *
+ * kind is open, socket, accept, pipe or dup. closed is the histogram of
+ * the lifetimes of closed fds (including those closed by exit_group), and
+ * live that of the ages of the fds still open, in the latency buckets of
+ * STATS_PATH. oldest lists up to 32 of the longest-open fds, oldest first,
+ * with the number of the syscall that created them. untracked counts fds
+ * that did not fit in the table. Writing to FDLIFE_PATH (as root) resets
+ * closed and untracked.
+ */
+#define FDLIFE_PATH                     "/proc/interceptor/fds"
+
+/**
+ * REQUEST_START_THROTTLE limits the rate of an intercepted syscall. Its
+ * pid argument points to a throttle_request. Each process throttled gets
+ * its own token bucket of burst calls, refilled at rate calls per second;
+ * calls beyond that are delayed until they are due (THROTTLE_DELAY) or
+ * fail with -EAGAIN (THROTTLE_FAIL). A syscall has at most one throttle.
+ */
+#define THROTTLE_DELAY                  0
+#define THROTTLE_FAIL                   1
+
+struct throttle_request {
+	int pid;                /* in the caller's namespace; 0 for every process */
+	unsigned int rate;      /* calls per second */
+	unsigned int burst;     /* calls allowed back to back (0 counts as 1) */
+	int policy;
+};
+
+/**
+ * REQUEST_START_INJECTION delays calls of an intercepted syscall before
+ * the original runs. Its pid argument points to an inject_request. The
+ * delay is delay_us (INJECT_FIXED), delay_us plus up to spread_us
+ * (INJECT_UNIFORM), or delay_us plus an exponential tail with a mean of
+ * spread_us (INJECT_EXPONENTIAL), and at most 10s. A syscall has at most
+ * one injection.
+ */
+#define INJECT_FIXED                    0
+#define INJECT_UNIFORM                  1
+#define INJECT_EXPONENTIAL              2
+
+struct inject_request {
+	int pid;                /* in the caller's namespace; 0 for every process */
+	int distribution;
+	unsigned int delay_us;
+	unsigned int spread_us;
+	unsigned int percent;   /* share of the calls delayed; 0 for all */
+};
+
 #ifdef __KERNEL__
 
 asmlinkage long my_syscall(int cmd, int syscall, int pid);
 
+/**
+ * Tasks in a child pid namespace are logged with LOG_NS_PID_FMT instead
+ * of LOG_PID_FMT: their global pid, then their pid in their own namespace.
+ */
+#define LOG_PID_FMT     "[%x]"
+#define LOG_NS_PID_FMT  "[%x/%x]"
+#define LOG_CALL_FMT    "%lx(%lx,%lx,%lx,%lx,%lx,%lx)\n"
+#define LOG_RESULT_FMT  "%lx=%lx <%llu>\n"
+#define LOG_MESSAGE_FMT LOG_PID_FMT LOG_CALL_FMT
+#define LOG_RETURN_FMT  LOG_PID_FMT LOG_RESULT_FMT
+#define LOG_LINE_MAX    128
+
 #define log_message(pid, syscall, arg1, arg2, arg3, arg4, arg5, arg6) \
-	printk(KERN_DEBUG "[%x]%lx(%lx,%lx,%lx,%lx,%lx,%lx)\n", pid, \
+	printk(KERN_DEBUG LOG_MESSAGE_FMT, pid, \
 		syscall, \
 		arg1, arg2, arg3, arg4, arg5, arg6 \
 	);
+
+/* Logged when a monitored call returns: "[pid]nr=ret <ns>" */
+#define log_return(pid, syscall, ret, ns) \
+	printk(KERN_DEBUG LOG_RETURN_FMT, pid, \
+		(long)(syscall), (long)(ret), (unsigned long long)(ns) \
+	);
 #endif
 
 
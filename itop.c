@@ -0,0 +1,381 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <termios.h>
+#include <sys/select.h>
+#include <sys/syscall.h>
+#include "stats.h"
+#include "trace_reader.h"
+
+/**
+ * Live top-style viewer over the module's aggregate counters.
+ *
+ * Usage: ./itop [-d seconds] [-n rows] [-b iterations] [-e syscall]...
+ *   -d  refresh interval (default 1s)
+ *   -n  rows per table (default 15)
+ *   -b  batch mode: print this many plain-text updates and exit
+ *   -e  intercept a syscall (name or number) and turn on aggregation for
+ *       it while itop runs (root only); restored on exit
+ *
+ * Keys: c = sort by call rate, t = by time, b = by bytes, e = by errors,
+ * q = quit.
+ *
+ * itop only reads STATS_PATH once per interval. It never turns on
+ * monitoring, so no per-event log messages are produced while it runs.
+ */
+
+#define MAX_ENABLE 64
+
+enum sort_key { SORT_COUNT, SORT_TIME, SORT_BYTES, SORT_ERRORS };
+
+struct row {
+	char name[STATS_COMM_LEN];
+	int id;
+	double calls, time_ns, bytes, errors;
+};
+
+static enum sort_key sort_key = SORT_COUNT;
+static struct termios saved_tty;
+static int tty_raw;
+static volatile sig_atomic_t done;
+
+static int enabled[MAX_ENABLE], nenabled;
+static int released[MAX_ENABLE];
+static int aggregated[MAX_ENABLE];
+
+static void on_signal(int sig) {
+	done = 1;
+}
+
+static void tty_restore(void) {
+
+	if (tty_raw)
+		tcsetattr(STDIN_FILENO, TCSANOW, &saved_tty);
+	tty_raw = 0;
+}
+
+static void tty_setup(void) {
+
+	struct termios t;
+
+	if (tcgetattr(STDIN_FILENO, &saved_tty) != 0)
+		return;
+	t = saved_tty;
+	t.c_lflag &= ~(ICANON | ECHO);
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSANOW, &t) == 0)
+		tty_raw = 1;
+}
+
+static long request(int cmd, int sysc) {
+	long ret = syscall(MY_CUSTOM_SYSCALL, cmd, sysc, 0);
+	return ret ? -errno : 0;
+}
+
+/* Turn on aggregation for -e syscalls, intercepting them if needed */
+static int enable_aggregation(void) {
+
+	long status;
+	int i;
+
+	for (i = 0; i < nenabled; i++) {
+		status = request(REQUEST_SYSCALL_INTERCEPT, enabled[i]);
+		if (status != 0 && status != -EBUSY) {
+			fprintf(stderr, "cannot intercept syscall %d: %s\n", enabled[i], strerror(-status));
+			return -1;
+		}
+		// Only release on exit what itop intercepted itself
+		released[i] = (status == 0);
+		status = request(REQUEST_START_AGGREGATION, enabled[i]);
+		if (status != 0 && status != -EBUSY) {
+			fprintf(stderr, "cannot aggregate syscall %d: %s\n", enabled[i], strerror(-status));
+			return -1;
+		}
+		// Likewise, leave another reader's aggregation running
+		aggregated[i] = (status == 0);
+	}
+	return 0;
+}
+
+static void disable_aggregation(void) {
+
+	int i;
+
+	for (i = 0; i < nenabled; i++) {
+		if (aggregated[i])
+			request(REQUEST_STOP_AGGREGATION, enabled[i]);
+		if (released[i])
+			request(REQUEST_SYSCALL_RELEASE, enabled[i]);
+	}
+}
+
+static double sort_value(const struct row *r) {
+
+	switch (sort_key) {
+		case SORT_TIME:
+			return r->time_ns;
+		case SORT_BYTES:
+			return r->bytes;
+		case SORT_ERRORS:
+			return r->errors;
+		default:
+			return r->calls;
+	}
+}
+
+static int cmp_row(const void *a, const void *b) {
+	double x = sort_value(a), y = sort_value(b);
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void fmt_bytes(char *buf, double v) {
+
+	const char *unit = " KMGT";
+	int u = 0;
+
+	while (v >= 1024 && u < 4) {
+		v /= 1024;
+		u++;
+	}
+	sprintf(buf, u ? "%.1f%c" : "%.0f", v, unit[u]);
+}
+
+/* Rates between two snapshots, per syscall */
+static int syscall_rows(const struct stats_snapshot *prev, const struct stats_snapshot *cur,
+		double secs, struct row *rows) {
+
+	static const struct stats_syscall zero;
+	const char *name;
+	int nr, n = 0;
+
+	for (nr = 0; nr < STATS_MAX_SYSCALL; nr++) {
+		const struct stats_syscall *a = &prev->sys[nr], *b = &cur->sys[nr];
+		struct row *r = &rows[n];
+
+		// Counters go backwards after a reset; show the new totals then
+		if (b->count < a->count)
+			a = &zero;
+		if (b->count == a->count)
+			continue;
+
+		r->id = nr;
+		if ((name = trace_syscall_name(nr)))
+			snprintf(r->name, sizeof(r->name), "%s", name);
+		else
+			snprintf(r->name, sizeof(r->name), "%d", nr);
+		r->calls = (b->count - a->count) / secs;
+		r->time_ns = (b->total_ns - a->total_ns) / secs;
+		r->bytes = (b->bytes - a->bytes) / secs;
+		r->errors = (b->errors - a->errors) / secs;
+		n++;
+	}
+	return n;
+}
+
+/* Rates between two snapshots, per process; prev must be sorted by tgid */
+static int process_rows(const struct stats_snapshot *prev, const struct stats_snapshot *cur,
+		double secs, struct row *rows) {
+
+	static const struct stats_process zero;
+	const struct stats_process *a, *b;
+	int i, n = 0;
+
+	for (i = 0; i < cur->nprocs; i++) {
+		b = &cur->procs[i];
+		a = stats_find_process(prev, b->tgid);
+		if (!a || b->count < a->count)
+			a = &zero;
+		if (b->count == a->count)
+			continue;
+
+		rows[n].id = b->tgid;
+		snprintf(rows[n].name, sizeof(rows[n].name), "%s", b->comm);
+		rows[n].calls = (b->count - a->count) / secs;
+		rows[n].time_ns = (b->total_ns - a->total_ns) / secs;
+		rows[n].bytes = (b->bytes - a->bytes) / secs;
+		rows[n].errors = 0;
+		n++;
+	}
+	return n;
+}
+
+static void show(struct row *rows, int n, int max, int processes) {
+
+	char bytes[16];
+	int i;
+
+	qsort(rows, n, sizeof(*rows), cmp_row);
+	if (processes)
+		printf("%-8s %-16s %12s %12s %10s %10s\n", "PID", "COMMAND", "CALLS/s", "BUSY%", "BYTES/s", "AVG_us");
+	else
+		printf("%-8s %-16s %12s %12s %10s %10s %10s\n", "NR", "SYSCALL", "CALLS/s", "BUSY%", "BYTES/s", "AVG_us", "ERRORS/s");
+
+	for (i = 0; i < n && i < max; i++) {
+		struct row *r = &rows[i];
+		fmt_bytes(bytes, r->bytes);
+		// BUSY% is time spent in the call per second of wall time
+		printf("%-8d %-16s %12.0f %11.1f%% %10s %10.1f", r->id, r->name, r->calls,
+			r->time_ns / 1e7, bytes, r->calls ? r->time_ns / r->calls / 1000 : 0);
+		if (!processes)
+			printf(" %10.0f", r->errors);
+		putchar('\n');
+	}
+}
+
+static void poll_keys(void) {
+
+	char c;
+
+	while (tty_raw && read(STDIN_FILENO, &c, 1) == 1) {
+		switch (c) {
+			case 'c':
+				sort_key = SORT_COUNT;
+				break;
+			case 't':
+				sort_key = SORT_TIME;
+				break;
+			case 'b':
+				sort_key = SORT_BYTES;
+				break;
+			case 'e':
+				sort_key = SORT_ERRORS;
+				break;
+			case 'q':
+				done = 1;
+				break;
+		}
+	}
+}
+
+/* Sleep for secs, waking early to redraw when a key is pressed */
+static void wait_interval(double secs) {
+
+	struct timeval tv;
+	fd_set fds;
+
+	tv.tv_sec = (long)secs;
+	tv.tv_usec = (long)((secs - tv.tv_sec) * 1e6);
+	FD_ZERO(&fds);
+	if (tty_raw)
+		FD_SET(STDIN_FILENO, &fds);
+	if (select(tty_raw ? STDIN_FILENO + 1 : 0, &fds, NULL, NULL, &tv) > 0)
+		poll_keys();
+}
+
+int main(int argc, char **argv) {
+
+	struct stats_snapshot *prev, *cur, *tmp;
+	struct row *rows;
+	double interval = 1.0, secs;
+	int opt, max = 15, batch = 0, n, status, nr;
+	const char *keys[] = { "calls", "time", "bytes", "errors" };
+
+	while ((opt = getopt(argc, argv, "d:n:b:e:")) != -1) {
+		switch (opt) {
+			case 'd':
+				interval = atof(optarg);
+				break;
+			case 'n':
+				max = atoi(optarg);
+				break;
+			case 'b':
+				batch = atoi(optarg);
+				break;
+			case 'e':
+				nr = trace_syscall_lookup(optarg);
+				if (nr < 0)
+					nr = atoi(optarg);
+				if (nr <= 0 || nenabled == MAX_ENABLE) {
+					fprintf(stderr, "bad syscall %s\n", optarg);
+					return 1;
+				}
+				enabled[nenabled++] = nr;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-d seconds] [-n rows] [-b iterations] [-e syscall]...\n", argv[0]);
+				return 1;
+		}
+	}
+	if (interval <= 0)
+		interval = 1.0;
+
+	prev = calloc(1, sizeof(*prev));
+	cur = calloc(1, sizeof(*cur));
+	rows = malloc((STATS_MAX_SYSCALL + 1) * sizeof(*rows));
+	if (!prev || !cur || !rows) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	if (enable_aggregation() != 0) {
+		disable_aggregation();
+		return 1;
+	}
+	if ((status = stats_load(STATS_PATH, prev)) != 0) {
+		fprintf(stderr, "%s: %s\n", STATS_PATH, strerror(-status));
+		disable_aggregation();
+		return 1;
+	}
+	stats_sort_processes(prev);
+	if (!batch) {
+		tty_setup();
+		printf("\033[2J");
+	}
+
+	while (!done) {
+		if (batch)
+			usleep((useconds_t)(interval * 1e6));
+		else
+			wait_interval(interval);
+		if (done)
+			break;
+
+		if ((status = stats_load(STATS_PATH, cur)) != 0) {
+			fprintf(stderr, "%s: %s\n", STATS_PATH, strerror(-status));
+			break;
+		}
+		secs = cur->time_ns > prev->time_ns ? (cur->time_ns - prev->time_ns) / 1e9 : interval;
+
+		if (!batch)
+			printf("\033[H\033[J");
+		printf("itop - every %.1fs, sorted by %s%s\n\n", interval, keys[sort_key],
+			batch ? "" : "   [c]alls [t]ime [b]ytes [e]rrors [q]uit");
+
+		n = syscall_rows(prev, cur, secs, rows);
+		show(rows, n, max, 0);
+		putchar('\n');
+
+		// Processes have no error counts, so sorting by errors keeps their order
+		rows = realloc(rows, (cur->nprocs + STATS_MAX_SYSCALL + 1) * sizeof(*rows));
+		if (!rows)
+			break;
+		n = process_rows(prev, cur, secs, rows);
+		show(rows, n, max, 1);
+		fflush(stdout);
+
+		stats_free(prev);
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+		stats_sort_processes(prev);
+
+		if (batch && --batch == 0)
+			break;
+		if (!batch)
+			poll_keys();
+	}
+
+	tty_restore();
+	disable_aggregation();
+	stats_free(prev);
+	free(prev);
+	free(cur);
+	free(rows);
+	return 0;
+}
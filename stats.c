@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "stats.h"
+
+struct stats_process *stats_add_process(struct stats_snapshot *s, int tgid, const char *comm) {
+
+	struct stats_process *p;
+
+	if (s->nprocs == s->proccap) {
+		int cap = s->proccap ? s->proccap * 2 : 256;
+		if (!(p = realloc(s->procs, cap * sizeof(*p))))
+			return NULL;
+		s->procs = p;
+		s->proccap = cap;
+	}
+	p = &s->procs[s->nprocs++];
+	memset(p, 0, sizeof(*p));
+	p->tgid = tgid;
+	strncpy(p->comm, comm, STATS_COMM_LEN - 1);
+	return p;
+}
+
+/**
+ * Parse one "syscall ..." record; p points just past the keyword.
+ */
+static int parse_syscall(struct stats_snapshot *s, char *p) {
+
+	struct stats_syscall *e;
+	unsigned long long v[5];
+	int nr, n, b;
+	char *tok;
+
+	if (sscanf(p, "%d %llu %llu %llu %llu %llu%n", &nr, &v[0], &v[1], &v[2], &v[3], &v[4], &n) != 6 ||
+	    nr < 0 || nr >= STATS_MAX_SYSCALL)
+		return -EINVAL;
+
+	e = &s->sys[nr];
+	e->count = v[0];
+	e->errors = v[1];
+	e->total_ns = v[2];
+	e->max_ns = v[3];
+	e->bytes = v[4];
+	memset(e->hist, 0, sizeof(e->hist));
+
+	for (tok = strtok(p + n, " \n"); tok; tok = strtok(NULL, " \n")) {
+		if (sscanf(tok, "%d:%llu", &b, &v[0]) != 2 || b < 0 || b >= STATS_HIST_BUCKETS)
+			return -EINVAL;
+		e->hist[b] = v[0];
+	}
+	return 0;
+}
+
+int stats_parse(FILE *fp, struct stats_snapshot *s) {
+
+	struct stats_process *proc;
+	unsigned long long v[3];
+	char line[4096], comm[STATS_COMM_LEN];
+	int tgid, nr;
+
+	memset(s, 0, sizeof(*s));
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "time ", 5) == 0) {
+			s->time_ns = strtoull(line + 5, NULL, 10);
+		} else if (strncmp(line, "syscall ", 8) == 0) {
+			if (parse_syscall(s, line + 8) != 0)
+				return -EINVAL;
+		} else if (strncmp(line, "throttle ", 9) == 0) {
+			if (sscanf(line + 9, "%d %llu %llu %llu", &nr, &v[0], &v[1], &v[2]) != 4 ||
+			    nr < 0 || nr >= STATS_MAX_SYSCALL)
+				return -EINVAL;
+			s->sys[nr].delayed = v[0];
+			s->sys[nr].rejected = v[1];
+			s->sys[nr].delay_ns = v[2];
+		} else if (strncmp(line, "process ", 8) == 0) {
+			if (sscanf(line + 8, "%d %31s %llu %llu %llu", &tgid, comm, &v[0], &v[1], &v[2]) != 5)
+				return -EINVAL;
+			if (!(proc = stats_add_process(s, tgid, comm)))
+				return -ENOMEM;
+			proc->count = v[0];
+			proc->total_ns = v[1];
+			proc->bytes = v[2];
+		} else if (strncmp(line, "memory ", 7) == 0) {
+			if (sscanf(line + 7, "%d %llu %llu %llu", &tgid, &v[0], &v[1], &v[2]) != 4)
+				return -EINVAL;
+			// It follows its process record
+			proc = s->nprocs ? &s->procs[s->nprocs - 1] : NULL;
+			if (!proc || proc->tgid != tgid)
+				proc = stats_add_process(s, tgid, "-");
+			if (!proc)
+				return -ENOMEM;
+			proc->mem_calls = v[0];
+			proc->mapped = v[1];
+			proc->unmapped = v[2];
+		}
+		// Unknown records are skipped, so newer modules stay readable
+	}
+	return 0;
+}
+
+int stats_load(const char *path, struct stats_snapshot *s) {
+
+	FILE *fp = fopen(path, "r");
+	int status;
+
+	if (!fp)
+		return -errno;
+	status = stats_parse(fp, s);
+	fclose(fp);
+	return status;
+}
+
+void stats_free(struct stats_snapshot *s) {
+
+	free(s->procs);
+	s->procs = NULL;
+	s->nprocs = s->proccap = 0;
+}
+
+static int cmp_tgid(const void *a, const void *b) {
+	const struct stats_process *p = a, *q = b;
+	return p->tgid < q->tgid ? -1 : p->tgid > q->tgid;
+}
+
+void stats_sort_processes(struct stats_snapshot *s) {
+
+	qsort(s->procs, s->nprocs, sizeof(*s->procs), cmp_tgid);
+}
+
+struct stats_process *stats_find_process(const struct stats_snapshot *s, int tgid) {
+
+	struct stats_process key;
+
+	key.tgid = tgid;
+	return bsearch(&key, s->procs, s->nprocs, sizeof(*s->procs), cmp_tgid);
+}
+
+int stats_percentile_bucket(const struct stats_syscall *s, double q) {
+
+	uint64_t n = 0, rank, seen = 0;
+	int b;
+
+	for (b = 0; b < STATS_HIST_BUCKETS; b++)
+		n += s->hist[b];
+	if (!n)
+		return -1;
+
+	rank = (uint64_t)(q * (n - 1)) + 1;
+	for (b = 0; b < STATS_HIST_BUCKETS - 1; b++) {
+		seen += s->hist[b];
+		if (seen >= rank)
+			break;
+	}
+	return b;
+}
+
+uint64_t stats_percentile(const struct stats_syscall *s, double q) {
+
+	int b = stats_percentile_bucket(s, q);
+	uint64_t top;
+
+	if (b < 0)
+		return 0;
+	// Bucket b holds [2^(b-1), 2^b)
+	top = b ? ((b < 64 ? 1ull << b : ~0ull) - 1) : 0;
+	return top < s->max_ns ? top : s->max_ns;
+}
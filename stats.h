@@ -0,0 +1,75 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "interceptor.h"
+
+/**
+ * Parser for the module's aggregate snapshots (STATS_PATH, or a saved
+ * copy of it). See interceptor.h for the text format.
+ */
+
+#define STATS_MAX_SYSCALL       1024
+#define STATS_COMM_LEN          32
+
+struct stats_syscall {
+	uint64_t count;
+	uint64_t errors;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t bytes;
+	uint64_t hist[STATS_HIST_BUCKETS];
+	/* From the throttle record, if any */
+	uint64_t delayed;
+	uint64_t rejected;
+	uint64_t delay_ns;
+};
+
+struct stats_process {
+	int tgid;
+	char comm[STATS_COMM_LEN];
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t bytes;
+	/* From the memory record, if any */
+	uint64_t mem_calls;
+	uint64_t mapped;
+	uint64_t unmapped;
+};
+
+struct stats_snapshot {
+	uint64_t time_ns;
+	struct stats_syscall sys[STATS_MAX_SYSCALL];
+	struct stats_process *procs;
+	int nprocs, proccap;
+};
+
+/* Returns 0 or a negative errno; s must be freed with stats_free() */
+int stats_parse(FILE *fp, struct stats_snapshot *s);
+int stats_load(const char *path, struct stats_snapshot *s);
+void stats_free(struct stats_snapshot *s);
+
+/* Append a process record, returning it (zeroed apart from tgid/comm) or NULL */
+struct stats_process *stats_add_process(struct stats_snapshot *s, int tgid, const char *comm);
+
+/* Sort the process records by tgid, so they can be looked up with stats_find_process() */
+void stats_sort_processes(struct stats_snapshot *s);
+struct stats_process *stats_find_process(const struct stats_snapshot *s, int tgid);
+
+/* Latency bucket for a duration, as the module computes it */
+static inline int stats_bucket(uint64_t ns) {
+	int b = ns ? 64 - __builtin_clzll(ns) : 0;
+	return b < STATS_HIST_BUCKETS ? b : STATS_HIST_BUCKETS - 1;
+}
+
+/**
+ * Approximate q-quantile of a syscall's latency: the upper bound of the
+ * bucket holding it, capped at the observed maximum.
+ */
+uint64_t stats_percentile(const struct stats_syscall *s, double q);
+
+/* Bucket holding the q-quantile, or -1 if there are no samples */
+int stats_percentile_bucket(const struct stats_syscall *s, double q);
+
+#endif /* _STATS_H */
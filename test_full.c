@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <errno.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -11,8 +12,18 @@
 #include <time.h>
 #include <string.h>
 #include <assert.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sched.h>
 #include "interceptor.h"
 
+/* libc maps memory with mmap2 where there is one (i386) */
+#ifdef SYS_mmap2
+#define SYS_MAP SYS_mmap2
+#else
+#define SYS_MAP SYS_mmap
+#endif
+
 
 static int last_child;
 
@@ -127,6 +138,668 @@ int do_stop(int syscall, int pid, int status) {
 	return 0;
 }
 
+int do_start_aggregation(int syscall, int status) {
+	test("%d start aggregation", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_START_AGGREGATION, syscall, 0) == status);
+	return 0;
+}
+
+int do_stop_aggregation(int syscall, int status) {
+	test("%d stop aggregation", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_STOP_AGGREGATION, syscall, 0) == status);
+	return 0;
+}
+
+int do_start_uid(int syscall, int uid, int status) {
+	test("%d start uid", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_START_UID_MONITORING, syscall, uid) == status);
+	return 0;
+}
+
+int do_stop_uid(int syscall, int uid, int status) {
+	test("%d stop uid", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_STOP_UID_MONITORING, syscall, uid) == status);
+	return 0;
+}
+
+int do_start_gid(int syscall, int gid, int status) {
+	test("%d start gid", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_START_GID_MONITORING, syscall, gid) == status);
+	return 0;
+}
+
+int do_stop_gid(int syscall, int gid, int status) {
+	test("%d stop gid", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_STOP_GID_MONITORING, syscall, gid) == status);
+	return 0;
+}
+
+int do_start_exec(int syscall, const char *pattern, int status) {
+	test("%d start exec", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_START_EXEC_MONITORING, syscall, (long)pattern) == status);
+	return 0;
+}
+
+int do_stop_exec(int syscall, const char *pattern, int status) {
+	test("%d stop exec", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_STOP_EXEC_MONITORING, syscall, (long)pattern) == status);
+	return 0;
+}
+
+int do_timeout(int syscall, int seconds, int status) {
+	test("%d monitoring timeout", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_MONITORING_TIMEOUT, syscall, seconds) == status);
+	return 0;
+}
+
+int do_budget(int syscall, int events, int status) {
+	test("%d monitoring budget", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_MONITORING_BUDGET, syscall, events) == status);
+	return 0;
+}
+
+/**
+ * Check that monitoring all pids is switched off by a time limit and by
+ * an event budget
+ */
+int do_limits(int syscall) {
+	do_timeout(syscall, 1, -EINVAL);
+	do_budget(syscall, 1, -EINVAL);
+	do_start(syscall, 0, 0);
+	do_timeout(syscall, 1, 0);
+	sleep(2);
+	do_stop(syscall, 0, -EINVAL);
+	do_start(syscall, 0, 0);
+	do_budget(syscall, 2, 0);
+	close(open("/dev/null", O_RDONLY));
+	close(open("/dev/null", O_RDONLY));
+	sleep(1);
+	do_stop(syscall, 0, -EINVAL);
+	return 0;
+}
+
+/**
+ * Check if a session's buffer contains a call, as do_monitor makes it
+ */
+int find_session_log(int session, long sno, long *args) {
+	char message[1024], path[64], output[1024];
+	FILE *fp;
+	int found = -1;
+
+	sprintf(message, "[%lx]%lx(%lx,%lx,%lx,%lx,%lx,%lx)",
+	               (long)getpid(), sno, args[0], args[1], args[2], args[3], args[4], args[5]);
+	sprintf(path, SESSION_PATH, session);
+
+	fp = fopen(path, "r");
+	if(!fp)  return -1;
+
+	while(fgets(output, sizeof(output)-1, fp) != NULL) {
+		if(strstr(output, message))
+			found = 0;
+	}
+
+	fclose(fp);
+	return found;
+}
+
+int do_session(int syscall, int session, int pid, int status) {
+	test("%d session start", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3,
+		REQUEST_SESSION(REQUEST_START_MONITORING, session), syscall, pid) == status);
+	return 0;
+}
+
+int do_session_stop(int syscall, int session, int pid, int status) {
+	test("%d session stop", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3,
+		REQUEST_SESSION(REQUEST_STOP_MONITORING, session), syscall, pid) == status);
+	return 0;
+}
+
+/**
+ * Check that sessions have separate targets, and that a session other
+ * than 0 logs into its own buffer
+ */
+int do_sessions(int sysno) {
+	long args[6];
+	int i, ret;
+
+	do_session(sysno, MAX_SESSIONS, getpid(), -EINVAL);
+	do_session(sysno, 1, getpid(), 0);
+	do_session(sysno, 1, getpid(), -EBUSY);
+	do_start(sysno, getpid(), 0);
+
+	for(i = 0; i < 6; i++) {
+		args[i] = rand();
+	}
+	ret = syscall(sysno, args[0], args[1], args[2], args[3], args[4], args[5]);
+	if(ret) ret = -errno;
+	test("%d session log", sysno, find_session_log(1, sysno, args) == 0);
+	test("%d session 0 log", sysno, find_log(getpid(), sysno, args, ret) == 0);
+
+	do_stop(sysno, getpid(), 0);
+	do_session_stop(sysno, 1, getpid(), 0);
+	do_session_stop(sysno, 1, getpid(), -EINVAL);
+	return 0;
+}
+
+int do_start_summary(int syscall, int status) {
+	test("%d start summary", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_START_SUMMARY, syscall, 0) == status);
+	return 0;
+}
+
+int do_stop_summary(int syscall, int status) {
+	test("%d stop summary", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_STOP_SUMMARY, syscall, 0) == status);
+	return 0;
+}
+
+/**
+ * Check if a process's exit summary counts calls to a syscall
+ */
+int find_summary(int pid, int sysno, int count) {
+	char line[4096], prefix[64], entry[64];
+	FILE *fp = fopen(SUMMARY_PATH, "r");
+	int found = -1;
+
+	if (!fp) return -1;
+	sprintf(prefix, "exit %d ", pid);
+	sprintf(entry, " %d:%d:", sysno, count);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, prefix, strlen(prefix)) == 0 && strstr(line, entry))
+			found = 0;
+	}
+	fclose(fp);
+	return found;
+}
+
+/**
+ * Check that a child exiting leaves a summary of its calls
+ */
+int do_summary(int syscall) {
+	int child;
+
+	do_start_summary(syscall, 0);
+	do_start_summary(syscall, -EBUSY);
+	switch ((child = fork())) {
+		case -1:
+			assert(0);
+		case 0:
+			close(open("/dev/null", O_RDONLY));
+			close(open("/dev/null", O_RDONLY));
+			exit(0);
+		default:
+			waitpid(child, NULL, 0);
+	}
+	test("%d exit summary", syscall, find_summary(child, syscall, 2) == 0);
+	do_stop_summary(syscall, 0);
+	do_stop_summary(syscall, -EINVAL);
+	return 0;
+}
+
+int do_start_throttle(int syscall, int pid, int rate, int policy, int status) {
+	struct throttle_request rule = { pid, rate, 1, policy };
+	test("%d start throttle", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_START_THROTTLE, syscall, (long)&rule) == status);
+	return 0;
+}
+
+int do_stop_throttle(int syscall, int status) {
+	test("%d stop throttle", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_STOP_THROTTLE, syscall, 0) == status);
+	return 0;
+}
+
+/**
+ * Check that a throttled process gets -EAGAIN once its bucket is empty
+ */
+int do_throttle(int syscall) {
+	int fd;
+
+	do_start_throttle(syscall, getpid(), 0, THROTTLE_FAIL, -EINVAL);
+	do_start_throttle(syscall, getpid(), 1, THROTTLE_FAIL, 0);
+	do_start_throttle(syscall, getpid(), 1, THROTTLE_FAIL, -EBUSY);
+	fd = open("/dev/null", O_RDONLY);
+	close(fd);
+	test("%d throttle allows", syscall, fd >= 0);
+	fd = open("/dev/null", O_RDONLY);
+	test("%d throttle rejects", syscall, fd < 0 && errno == EAGAIN);
+	do_stop_throttle(syscall, 0);
+	do_stop_throttle(syscall, -EINVAL);
+	return 0;
+}
+
+int do_start_injection(int syscall, int pid, int delay_us, int status) {
+	struct inject_request rule = { pid, INJECT_FIXED, delay_us, 0, 0 };
+	test("%d start injection", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_START_INJECTION, syscall, (long)&rule) == status);
+	return 0;
+}
+
+int do_stop_injection(int syscall, int status) {
+	test("%d stop injection", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_STOP_INJECTION, syscall, 0) == status);
+	return 0;
+}
+
+/**
+ * Check that an injected delay slows the syscall down
+ */
+int do_injection(int syscall) {
+	struct timespec t0, t1;
+	long us;
+
+	do_start_injection(syscall, getpid(), 0, -EINVAL);
+	do_start_injection(syscall, getpid(), 20000, 0);
+	do_start_injection(syscall, getpid(), 20000, -EBUSY);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	close(open("/dev/null", O_RDONLY));
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	us = (t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000;
+	test("%d injected delay", syscall, us >= 20000);
+	do_stop_injection(syscall, 0);
+	do_stop_injection(syscall, -EINVAL);
+	return 0;
+}
+
+int do_set_capture(int syscall, int bytes, int status) {
+	test("%d set capture", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_SET_CAPTURE, syscall, bytes) == status);
+	return 0;
+}
+
+/**
+ * Check that capture can be set on read-style syscalls only
+ */
+int do_capture(int syscall) {
+	do_set_capture(syscall, 16, -EINVAL);
+	do_intercept(syscall, 0);
+	do_set_capture(syscall, CAPTURE_MAX + 1, -EINVAL);
+	do_set_capture(syscall, 16, 0);
+	do_set_capture(syscall, 0, 0);
+	do_release(syscall, 0);
+	return 0;
+}
+
+/**
+ * Check that a write logged to session 1 carries its bytes on the call
+ * line, and a read on its return line, limited to what the read returned
+ */
+int do_capture_data(void) {
+	char path[64], output[1024], buf[64];
+	char wline[64], rline[64];
+	int pipefd[2], wfound = 0, rfound = 0;
+	FILE *fp;
+
+	memset(buf, 'z', sizeof(buf));
+	if(pipe(pipefd) != 0)  return -1;
+	do_intercept(__NR_write, 0);
+	do_intercept(__NR_read, 0);
+	do_set_capture(__NR_write, 16, 0);
+	do_set_capture(__NR_read, 16, 0);
+	do_session(__NR_write, 1, getpid(), 0);
+	do_session(__NR_read, 1, getpid(), 0);
+	write(pipefd[1], "hello", 5);
+	// Asks for 16 bytes, but only the 5 read may be captured
+	read(pipefd[0], buf, 16);
+	do_session_stop(__NR_read, 1, getpid(), 0);
+	do_session_stop(__NR_write, 1, getpid(), 0);
+	close(pipefd[0]);
+	close(pipefd[1]);
+
+	sprintf(wline, "]%x(%x,", __NR_write, pipefd[1]);
+	sprintf(rline, "]%x=5 ", __NR_read);
+	sprintf(path, SESSION_PATH, 1);
+	fp = fopen(path, "r");
+	while(fp && fgets(output, sizeof(output)-1, fp) != NULL) {
+		if(strstr(output, wline) && strstr(output, " data=68656c6c6f\n"))
+			wfound = 1;
+		if(strstr(output, rline) && strstr(output, " data=68656c6c6f\n"))
+			rfound = 1;
+	}
+	if(fp)  fclose(fp);
+	test("%d captured call data", __NR_write, wfound);
+	test("%d captured return data", __NR_read, rfound);
+
+	do_set_capture(__NR_read, 0, 0);
+	do_set_capture(__NR_write, 0, 0);
+	do_release(__NR_read, 0);
+	do_release(__NR_write, 0);
+	return 0;
+}
+
+int do_set_decode(int syscall, int on, int status) {
+	test("%d set decode", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_SET_DECODE, syscall, on) == status);
+	return 0;
+}
+
+/**
+ * Check that a nanosleep logged to session 1 carries its decoded timespec
+ */
+int do_decode(void) {
+	struct timespec ts = { 0, 1000000 };
+	char path[64], output[1024];
+	int found = 0;
+	FILE *fp;
+
+	do_set_decode(__NR_nanosleep, 1, -EINVAL);
+	do_intercept(__NR_nanosleep, 0);
+	do_set_decode(__NR_nanosleep, 1, 0);
+	do_session(__NR_nanosleep, 1, getpid(), 0);
+	nanosleep(&ts, NULL);
+	do_session_stop(__NR_nanosleep, 1, getpid(), 0);
+
+	sprintf(path, SESSION_PATH, 1);
+	fp = fopen(path, "r");
+	while(fp && fgets(output, sizeof(output)-1, fp) != NULL) {
+		if(strstr(output, " ts=0.001000000\n")) {
+			found = 1;
+		}
+	}
+	if(fp)  fclose(fp);
+	test("%d decoded timespec", __NR_nanosleep, found);
+
+	do_set_decode(__NR_nanosleep, 0, 0);
+	do_release(__NR_nanosleep, 0);
+	return 0;
+}
+
+int do_set_fdpath(int syscall, int on, int status) {
+	test("%d set fdpath", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_SET_FDPATH, syscall, on) == status);
+	return 0;
+}
+
+/**
+ * Check that a read logged to session 1 carries the id of the path its fd
+ * was opened as, and that the path is in the dictionary
+ */
+int do_fdpath(void) {
+	char path[64], output[1024], *tag;
+	unsigned id = 0, dict_id;
+	int fd, found = 0;
+	FILE *fp;
+
+	do_set_fdpath(SYS_open, 1, -EINVAL);
+	do_intercept(SYS_open, 0);
+	do_intercept(__NR_read, 0);
+	do_set_fdpath(SYS_open, 1, 0);
+	do_set_fdpath(__NR_read, 1, 0);
+	do_session(__NR_read, 1, getpid(), 0);
+	fd = open("/etc/hostname", O_RDONLY);
+	read(fd, output, 1);
+	close(fd);
+	do_session_stop(__NR_read, 1, getpid(), 0);
+
+	sprintf(path, SESSION_PATH, 1);
+	fp = fopen(path, "r");
+	while(fp && fgets(output, sizeof(output)-1, fp) != NULL) {
+		if((tag = strstr(output, " path=")) != NULL) {
+			sscanf(tag, " path=%u", &id);
+		}
+	}
+	if(fp)  fclose(fp);
+	test("%d fd path tag", __NR_read, id != 0);
+
+	fp = fopen(FDPATH_PATH, "r");
+	while(fp && fgets(output, sizeof(output)-1, fp) != NULL) {
+		if(sscanf(output, "path %u /etc/hostname", &dict_id) == 1 && dict_id == id) {
+			found = 1;
+		}
+	}
+	if(fp)  fclose(fp);
+	test("%d fd path dictionary", __NR_read, found);
+
+	do_release(__NR_read, 0);
+	do_release(SYS_open, 0);
+	return 0;
+}
+
+int do_start_futex_profile(int syscall, int status) {
+	test("%d start futex profile", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_START_FUTEX_PROFILE, syscall, 0) == status);
+	return 0;
+}
+
+int do_stop_futex_profile(int syscall, int status) {
+	test("%d stop futex profile", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_STOP_FUTEX_PROFILE, syscall, 0) == status);
+	return 0;
+}
+
+/**
+ * Check that a futex wait that times out is listed as a contended site
+ */
+int do_futex_profile(void) {
+	struct timespec timeout = { 0, 1000000 };
+	char output[1024];
+	int word = 0, tgid, found = 0;
+	unsigned long uaddr;
+	unsigned long long count;
+	FILE *fp;
+
+	do_start_futex_profile(SYS_futex, -EINVAL);
+	do_intercept(SYS_futex, 0);
+	do_start_futex_profile(SYS_open, -EINVAL);
+	do_start_futex_profile(SYS_futex, 0);
+	do_start_futex_profile(SYS_futex, -EBUSY);
+	syscall(SYS_futex, &word, FUTEX_WAIT, 0, &timeout, NULL, 0);
+
+	fp = fopen(FUTEX_PATH, "r");
+	while(fp && fgets(output, sizeof(output)-1, fp) != NULL) {
+		if(sscanf(output, "futex %d %lx %llu", &tgid, &uaddr, &count) == 3 &&
+				tgid == getpid() && uaddr == (unsigned long)&word && count >= 1) {
+			found = 1;
+		}
+	}
+	if(fp)  fclose(fp);
+	test("%d futex site", SYS_futex, found);
+
+	do_stop_futex_profile(SYS_futex, 0);
+	do_stop_futex_profile(SYS_futex, -EINVAL);
+	do_release(SYS_futex, 0);
+	return 0;
+}
+
+/** 
+ * Check if the aggregate stats have counted calls to a syscall
+ */
+int find_stats(int sysno) {
+	char line[4096], prefix[64];
+	FILE *fp = fopen(STATS_PATH, "r");
+	unsigned long long count;
+
+	if (!fp) return -1;
+	sprintf(prefix, "syscall %d ", sysno);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, prefix, strlen(prefix)) == 0 &&
+		    sscanf(line + strlen(prefix), "%llu", &count) == 1 && count > 0) {
+			fclose(fp);
+			return 0;
+		}
+	}
+	fclose(fp);
+	return -1;
+}
+
+int do_aggregate(int syscall) {
+	do_start_aggregation(syscall, 0);
+	do_start_aggregation(syscall, -EBUSY);
+	close(open("/dev/null", O_RDONLY));
+	test("%d aggregated", syscall, find_stats(syscall) == 0);
+	do_stop_aggregation(syscall, 0);
+	do_stop_aggregation(syscall, -EINVAL);
+	return 0;
+}
+
+int do_set_lineage(int syscall, int on, int status) {
+	test("%d set lineage", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_SET_LINEAGE, syscall, on) == status);
+	return 0;
+}
+
+/**
+ * Check that a fork logged to session 1 is followed by records of the
+ * child's birth and exit
+ */
+int do_lineage(void) {
+	char path[64], output[1024];
+	int child, pid, ppid, forked = 0, exited = 0;
+	FILE *fp;
+
+	do_set_lineage(SYS_clone, 1, -EINVAL);
+	do_intercept(SYS_clone, 0);
+	do_set_lineage(SYS_clone, 1, 0);
+	do_session(SYS_clone, 1, getpid(), 0);
+	child = fork();
+	if (child == 0)
+		_exit(0);
+	waitpid(child, NULL, 0);
+	do_session_stop(SYS_clone, 1, getpid(), 0);
+
+	sprintf(path, SESSION_PATH, 1);
+	fp = fopen(path, "r");
+	while(fp && fgets(output, sizeof(output)-1, fp) != NULL) {
+		if(sscanf(output, "fork %d %d", &pid, &ppid) == 2 && pid == child && ppid == getpid())
+			forked = 1;
+		if(sscanf(output, "exit %d", &pid) == 1 && pid == child)
+			exited = 1;
+	}
+	if(fp)  fclose(fp);
+	test("%d lineage fork", SYS_clone, forked);
+	test("%d lineage exit", SYS_clone, exited);
+
+	do_set_lineage(SYS_clone, 0, 0);
+	do_release(SYS_clone, 0);
+	return 0;
+}
+
+/**
+ * Check that a task in a child pid namespace can target itself by the pid
+ * it sees there, and that its lines carry both of its pids. The child
+ * unshares a new pid namespace, so its own child is pid 1 in it.
+ */
+int do_pid_namespace(void) {
+	char path[64], output[1024], pid[64], call[64], tag[64];
+	int child, inner = 0, matched = 0, tagged = 0, fds[2];
+	FILE *fp;
+
+	if(pipe(fds) != 0)  return -1;
+	do_intercept(__NR_getppid, 0);
+	child = fork();
+	if (child == 0) {
+		close(fds[0]);
+		if (unshare(CLONE_NEWPID) == 0)
+			inner = fork();
+		if (inner == 0) {
+			// pid 1 here, and this process to the module
+			do_session(__NR_getppid, 1, 1, 0);
+			syscall(__NR_getppid);
+			do_session_stop(__NR_getppid, 1, 1, 0);
+			_exit(0);
+		}
+		// The pid of the new namespace's init, as seen from ours
+		if (inner > 0) {
+			write(fds[1], &inner, sizeof(inner));
+			waitpid(inner, NULL, 0);
+		}
+		_exit(inner < 0);
+	}
+	close(fds[1]);
+	if (read(fds[0], &inner, sizeof(inner)) != sizeof(inner))
+		inner = 0;
+	close(fds[0]);
+	waitpid(child, NULL, 0);
+
+	sprintf(pid, "[%x", inner);
+	sprintf(call, "]%x(", __NR_getppid);
+	sprintf(tag, "[%x/%x]%x(", inner, 1, __NR_getppid);
+	sprintf(path, SESSION_PATH, 1);
+	fp = fopen(path, "r");
+	while(inner > 0 && fp && fgets(output, sizeof(output)-1, fp) != NULL) {
+		// Pid 1 resolved in our namespace would have been init instead
+		if(strstr(output, pid) == output && strchr("/]", output[strlen(pid)]) &&
+		   strstr(output, call))
+			matched = 1;
+		if(strstr(output, tag) == output)
+			tagged = 1;
+	}
+	if(fp)  fclose(fp);
+	test("%d pid namespace target", __NR_getppid, matched);
+	test("%d pid namespace tag", __NR_getppid, tagged);
+
+	do_release(__NR_getppid, 0);
+	return 0;
+}
+
+int do_set_fdlife(int syscall, int on, int status) {
+	test("%d set fdlife", syscall, vsyscall_arg(MY_CUSTOM_SYSCALL, 3, REQUEST_SET_FDLIFE, syscall, on) == status);
+	return 0;
+}
+
+/**
+ * Look for an fd of this process among the oldest live ones, and count
+ * the closed fds created by open
+ */
+int find_fdlife(int fd, int *live, unsigned long long *closed) {
+	char line[4096], kind[16];
+	int tgid, ofd, nr;
+	FILE *fp = fopen(FDLIFE_PATH, "r");
+
+	*live = *closed = 0;
+	if (!fp) return -1;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "oldest %d %d %d %15s", &tgid, &ofd, &nr, kind) == 4 &&
+		    tgid == getpid() && ofd == fd && nr == SYS_open && strcmp(kind, "open") == 0)
+			*live = 1;
+		sscanf(line, "closed open %llu", closed);
+	}
+	fclose(fp);
+	return 0;
+}
+
+/**
+ * Check that an fd left open is reported with the syscall that created it,
+ * and that closing it adds its lifetime
+ */
+int do_fdlife(void) {
+	unsigned long long before, after;
+	int fd, live;
+
+	do_set_fdlife(SYS_open, 1, -EINVAL);
+	do_intercept(SYS_open, 0);
+	do_intercept(SYS_close, 0);
+	do_set_fdlife(SYS_open, 1, 0);
+	do_set_fdlife(SYS_close, 1, 0);
+
+	fd = open("/dev/null", O_RDONLY);
+	find_fdlife(fd, &live, &before);
+	test("%d fdlife live", SYS_open, live);
+	close(fd);
+	find_fdlife(fd, &live, &after);
+	// Reading the report opens and closes a file as well
+	test("%d fdlife closed", SYS_close, !live && after > before);
+
+	do_set_fdlife(SYS_close, 0, 0);
+	do_set_fdlife(SYS_open, 0, 0);
+	do_release(SYS_close, 0);
+	do_release(SYS_open, 0);
+	return 0;
+}
+
+/**
+ * Check that aggregated mmap2 and munmap calls show up as memory growth of
+ * this process
+ */
+int do_memory_growth(void) {
+	char line[4096];
+	unsigned long long calls = 0, mapped = 0, unmapped = 0;
+	size_t len = 1 << 20;
+	int tgid;
+	void *p;
+	FILE *fp;
+
+	do_intercept(SYS_MAP, 0);
+	do_intercept(SYS_munmap, 0);
+	do_start_aggregation(SYS_MAP, 0);
+	do_start_aggregation(SYS_munmap, 0);
+	p = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	munmap(p, len);
+
+	fp = fopen(STATS_PATH, "r");
+	while (fp && fgets(line, sizeof(line), fp) != NULL) {
+		if (sscanf(line, "memory %d %llu %llu %llu", &tgid, &calls, &mapped, &unmapped) == 4 &&
+		    tgid == getpid())
+			break;
+		calls = 0;
+	}
+	if (fp)  fclose(fp);
+	test("%d memory growth", SYS_MAP, calls >= 2 && mapped >= len && unmapped >= len);
+
+	do_stop_aggregation(SYS_munmap, 0);
+	do_stop_aggregation(SYS_MAP, 0);
+	do_release(SYS_munmap, 0);
+	do_release(SYS_MAP, 0);
+	return 0;
+}
 
 /** 
  * Run the tester as a non-root user, and basically run do_nonroot
@@ -153,6 +826,18 @@ void do_as_guest(const char *str, int args1, int args2) {
 int do_nonroot(int syscall) {
 	do_intercept(syscall, -EPERM);
 	do_release(syscall, -EPERM);
+	do_start_aggregation(syscall, -EPERM);
+	do_stop_aggregation(syscall, -EPERM);
+	do_start_summary(syscall, -EPERM);
+	do_start_throttle(syscall, 0, 1, THROTTLE_DELAY, -EPERM);
+	do_stop_throttle(syscall, -EPERM);
+	do_start_injection(syscall, 0, 1000, -EPERM);
+	do_set_capture(syscall, 0, -EPERM);
+	do_set_decode(syscall, 0, -EPERM);
+	do_set_fdpath(syscall, 0, -EPERM);
+	do_start_futex_profile(syscall, -EPERM);
+	do_set_lineage(syscall, 0, -EPERM);
+	do_set_fdlife(syscall, 0, -EPERM);
 	do_start(syscall, 0, -EPERM);
 	do_stop(syscall, 0, -EPERM);
 	do_start(syscall, 1, -EPERM);
@@ -162,6 +847,19 @@ int do_nonroot(int syscall) {
 	do_monitor(syscall);
 	do_stop(syscall, getpid(), 0);
 	do_stop(syscall, getpid(), -EINVAL);
+	do_start_uid(syscall, 0, -EPERM);
+	do_start_uid(syscall, getuid(), 0);
+	do_start_uid(syscall, getuid(), -EBUSY);
+	do_monitor(syscall);
+	do_stop_uid(syscall, getuid(), 0);
+	do_stop_uid(syscall, getuid(), -EINVAL);
+	do_start_gid(syscall, 0, -EPERM);
+	do_start_gid(syscall, getgid(), 0);
+	do_monitor(syscall);
+	do_stop_gid(syscall, getgid(), 0);
+	do_start_exec(syscall, "test_*", -EPERM);
+	do_timeout(syscall, 1, -EPERM);
+	do_budget(syscall, 1, -EPERM);
 	return 0;
 }
 
@@ -180,6 +878,21 @@ void test_syscall(int syscall) {
 	do_stop(syscall, 1, 0);
 	do_as_guest("./test_full start %d -1 %d", syscall, 0);
 	do_stop(syscall, last_child, -EINVAL);
+	do_start_uid(syscall, -1, -EINVAL);
+	do_start_exec(syscall, NULL, -EFAULT);
+	do_start_exec(syscall, "", -EINVAL);
+	do_start_exec(syscall, "test_f?ll", 0);
+	do_start_exec(syscall, "test_f?ll", -EBUSY);
+	do_monitor(syscall);
+	do_stop_exec(syscall, "test_f?ll", 0);
+	do_stop_exec(syscall, "test_f?ll", -EINVAL);
+	do_stop_gid(syscall, 0, -EINVAL);
+	do_aggregate(syscall);
+	do_limits(syscall);
+	do_sessions(syscall);
+	do_summary(syscall);
+	do_throttle(syscall);
+	do_injection(syscall);
 	do_release(syscall, 0);
 }
 
@@ -214,6 +927,19 @@ int main(int argc, char **argv) {
 	do_release(-1, -EINVAL);
 	do_intercept(__NR_exit, 0);
 	do_release(__NR_exit, 0);
+	do_start_aggregation(__NR_exit, -EINVAL);
+	do_capture(__NR_read);
+	do_set_capture(SYS_open, 16, -EINVAL);
+	do_capture_data();
+	do_decode();
+	do_set_decode(SYS_open, 1, -EINVAL);
+	do_fdpath();
+	do_set_fdpath(__NR_exit, 1, -EINVAL);
+	do_futex_profile();
+	do_memory_growth();
+	do_lineage();
+	do_fdlife();
+	do_pid_namespace();
 
 	test_syscall(SYS_open);
 	/* The above line of code tests SYS_open.
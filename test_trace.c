@@ -0,0 +1,178 @@
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace_format.h"
+#include "trace_reader.h"
+
+/**
+ * Round-trip tests for the trace format: events are written with the
+ * trace writer and read back both with trace_block_read() and with the
+ * libtrace iterator. Unlike test_full.c this needs no module.
+ *
+ * Usage: ./test_trace
+ */
+
+/* Three blocks' worth, so the last block is partial */
+#define NEVENTS         (TRACE_BLOCK_EVENTS * 2 + 100)
+
+static int failures;
+
+#define test(s, a, t) \
+({\
+	int i;\
+	char dummy[1024];\
+	\
+	sprintf(dummy, s, a);\
+	printf("test: %s", dummy); \
+	for(i=0; i<60-strlen(dummy); i++)\
+		putchar('.');\
+	if (!(t)) {\
+		printf("failed\n");\
+		failures++;\
+	} else\
+		printf("passed\n");\
+	fflush(stdout);\
+})
+
+
+/**
+ * The i-th test event. Every block mixes calls that returned (including
+ * with ret 0 after 0ns, and with an error) with calls that never did.
+ */
+void make_event(int i, struct trace_event *ev) {
+	int a;
+
+	memset(ev, 0, sizeof(*ev));
+	ev->pid = 1000 + i % 7;
+	ev->nr = i % 3 ? 3 : 5;
+	for(a = 0; a < TRACE_NARGS; a++)
+		ev->args[a] = (uint64_t)i * (a + 1);
+	ev->ts = 1000000000ull + (uint64_t)i * 1000;
+	ev->flags = TRACE_EV_TS;
+	switch(i % 4) {
+		case 0:
+			// Never returned
+			break;
+		case 1:
+			ev->ret = i;
+			ev->dur = 100 + i;
+			ev->flags |= TRACE_EV_RET | TRACE_EV_DUR;
+			break;
+		case 2:
+			ev->ret = -EBADF;
+			ev->dur = 7;
+			ev->flags |= TRACE_EV_RET | TRACE_EV_DUR;
+			break;
+		case 3:
+			ev->flags |= TRACE_EV_RET | TRACE_EV_DUR;
+			break;
+	}
+}
+
+int same_event(const struct trace_event *x, const struct trace_event *y) {
+	return x->pid == y->pid && x->nr == y->nr && x->ts == y->ts &&
+		x->ret == y->ret && x->dur == y->dur && x->flags == y->flags &&
+		!memcmp(x->args, y->args, sizeof(x->args));
+}
+
+int do_write(const char *path) {
+	static struct trace_writer w;
+	struct trace_event ev;
+	FILE *fp = fopen(path, "wb");
+	int i, status = 0;
+
+	if(!fp)  return -errno;
+	status = trace_writer_open(&w, fp);
+	for(i = 0; i < NEVENTS && !status; i++) {
+		make_event(i, &ev);
+		status = trace_writer_add(&w, &ev);
+	}
+	if(!status)  status = trace_writer_close(&w);
+	fclose(fp);
+	test("%s write", "mixed blocks", status == 0);
+	return status;
+}
+
+/**
+ * Decode whole blocks and compare each event's columns and presence
+ */
+int do_block_read(const char *path) {
+	struct trace_file_header fh;
+	struct trace_segment s;
+	struct trace_block b;
+	struct trace_event want;
+	FILE *fp = fopen(path, "rb");
+	int i = 0, ok = 1, k, a;
+	uint32_t j;
+
+	memset(&s, 0, sizeof(s));
+	memset(&b, 0, sizeof(b));
+	if(!fp || trace_read_header(fp, &fh) != 0)
+		ok = 0;
+	while(ok && trace_segment_read(fp, &s) == 1) {
+		for(k = 0; ok && k < (int)s.hdr.nblocks; k++) {
+			if(trace_block_read(fp, &b, TRACE_COL_ALL) != 1) {
+				ok = 0;
+				break;
+			}
+			for(j = 0; j < b.hdr.nevents; j++, i++) {
+				make_event(i, &want);
+				ok = ok && b.pids[b.pid_idx[j]] == want.pid && b.nr[j] == want.nr &&
+					b.ts[j] == want.ts && b.ret[j] == want.ret &&
+					b.dur[j] == want.dur && b.flags[j] == want.flags;
+				for(a = 0; a < TRACE_NARGS; a++)
+					ok = ok && b.args[a][j] == want.args[a];
+			}
+		}
+	}
+	trace_block_free(&b);
+	trace_segment_free(&s);
+	if(fp)  fclose(fp);
+	ok = ok && i == NEVENTS;
+	test("%s block decode", "mixed blocks", ok);
+	return 0;
+}
+
+/**
+ * Iterate the mapped trace and compare every event
+ */
+int do_iter(const char *path) {
+	static struct trace_iter it;
+	struct trace_reader r;
+	struct trace_event ev, want;
+	int i = 0, ok = 1, status;
+
+	if(trace_reader_open(&r, path) != 0) {
+		test("%s iterate", "mixed blocks", 0);
+		return 0;
+	}
+	trace_iter_init(&it, &r);
+	while(ok && (status = trace_iter_next(&it, &ev)) == 1) {
+		make_event(i++, &want);
+		ok = same_event(&ev, &want);
+	}
+	trace_reader_close(&r);
+	ok = ok && status == 0 && i == NEVENTS;
+	test("%s iterate", "mixed blocks", ok);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	char path[] = "/tmp/test_trace.XXXXXX";
+	int fd = mkstemp(path);
+
+	if(fd < 0) {
+		perror(path);
+		return 1;
+	}
+	close(fd);
+
+	if(do_write(path) == 0) {
+		do_block_read(path);
+		do_iter(path);
+	}
+	unlink(path);
+	return failures != 0;
+}
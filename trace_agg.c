@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "trace_agg.h"
+
+int trace_agg_init(struct trace_agg *a) {
+
+	memset(a, 0, sizeof(*a));
+	a->pidcap = 256;
+	a->pids = calloc(a->pidcap, sizeof(*a->pids));
+	return a->pids ? 0 : -ENOMEM;
+}
+
+void trace_agg_free(struct trace_agg *a) {
+
+	int s;
+
+	for (s = 0; s < TRACE_NR_SLOTS; s++)
+		free(a->sys[s].hist);
+	free(a->pids);
+	memset(a, 0, sizeof(*a));
+}
+
+static uint32_t pid_hash(uint32_t pid) {
+	return pid * 2654435761u;
+}
+
+/* Find or insert pid's entry, growing the table when it is 3/4 full */
+static struct trace_agg_pid *pid_entry(struct trace_agg *a, uint32_t pid) {
+
+	struct trace_agg_pid *e;
+	uint32_t i;
+
+	if ((a->npids + 1) * 4 > a->pidcap * 3) {
+		struct trace_agg_pid *old = a->pids;
+		uint32_t oldcap = a->pidcap;
+
+		a->pids = calloc(oldcap * 2, sizeof(*a->pids));
+		if (!a->pids) {
+			a->pids = old;
+			return NULL;
+		}
+		a->pidcap = oldcap * 2;
+		for (i = 0; i < oldcap; i++) {
+			if (!old[i].used)
+				continue;
+			e = &a->pids[pid_hash(old[i].pid) & (a->pidcap - 1)];
+			while (e->used)
+				e = (e == &a->pids[a->pidcap - 1]) ? a->pids : e + 1;
+			*e = old[i];
+		}
+		free(old);
+	}
+
+	e = &a->pids[pid_hash(pid) & (a->pidcap - 1)];
+	while (e->used && e->pid != pid)
+		e = (e == &a->pids[a->pidcap - 1]) ? a->pids : e + 1;
+	if (!e->used) {
+		e->used = 1;
+		e->pid = pid;
+		a->npids++;
+	}
+	return e;
+}
+
+static void sys_add(struct trace_agg_sys *s, uint64_t count, uint64_t total, uint64_t max) {
+
+	s->count += count;
+	s->total_ns += total;
+	if (max > s->max_ns)
+		s->max_ns = max;
+}
+
+int trace_agg_add(struct trace_agg *a, uint32_t pid, uint16_t nr, uint64_t dur, int has_dur) {
+
+	struct trace_agg_sys *s = &a->sys[nr & (TRACE_NR_SLOTS - 1)];
+	struct trace_agg_pid *p;
+
+	if (!has_dur)
+		dur = 0;
+	sys_add(s, 1, dur, dur);
+	if (has_dur) {
+		if (!s->hist && !(s->hist = calloc(TRACE_HIST_BUCKETS, sizeof(*s->hist))))
+			return -ENOMEM;
+		s->hist[trace_hist_bucket(dur)]++;
+	}
+
+	if (!(p = pid_entry(a, pid)))
+		return -ENOMEM;
+	p->count++;
+	p->total_ns += dur;
+	a->events++;
+	return 0;
+}
+
+int trace_agg_merge(struct trace_agg *dst, const struct trace_agg *src) {
+
+	struct trace_agg_pid *p;
+	uint32_t i, b;
+	int s;
+
+	for (s = 0; s < TRACE_NR_SLOTS; s++) {
+		const struct trace_agg_sys *from = &src->sys[s];
+
+		if (!from->count)
+			continue;
+		sys_add(&dst->sys[s], from->count, from->total_ns, from->max_ns);
+		if (from->hist) {
+			if (!dst->sys[s].hist &&
+			    !(dst->sys[s].hist = calloc(TRACE_HIST_BUCKETS, sizeof(uint64_t))))
+				return -ENOMEM;
+			for (b = 0; b < TRACE_HIST_BUCKETS; b++)
+				dst->sys[s].hist[b] += from->hist[b];
+		}
+	}
+
+	for (i = 0; i < src->pidcap; i++) {
+		if (!src->pids[i].used)
+			continue;
+		if (!(p = pid_entry(dst, src->pids[i].pid)))
+			return -ENOMEM;
+		p->count += src->pids[i].count;
+		p->total_ns += src->pids[i].total_ns;
+	}
+	dst->events += src->events;
+	return 0;
+}
+
+uint64_t trace_agg_percentile(const struct trace_agg_sys *s, double q) {
+
+	uint64_t n = 0, rank, seen = 0;
+	uint32_t b;
+
+	if (!s->hist)
+		return 0;
+	for (b = 0; b < TRACE_HIST_BUCKETS; b++)
+		n += s->hist[b];
+	if (!n)
+		return 0;
+
+	rank = (uint64_t)(q * (n - 1)) + 1;
+	for (b = 0; b < TRACE_HIST_BUCKETS; b++) {
+		seen += s->hist[b];
+		if (seen >= rank)
+			break;
+	}
+	// Report the top of the bucket, but never more than the observed maximum
+	if (b + 1 < TRACE_HIST_BUCKETS && trace_hist_value(b + 1) - 1 < s->max_ns)
+		return trace_hist_value(b + 1) - 1;
+	return s->max_ns;
+}
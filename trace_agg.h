@@ -0,0 +1,71 @@
+#ifndef _TRACE_AGG_H
+#define _TRACE_AGG_H
+
+#include <stdint.h>
+#include "trace_format.h"
+
+/**
+ * Mergeable per-syscall and per-pid aggregates over trace events.
+ *
+ * Latencies go into log-linear histograms (16 linear sub-buckets per
+ * power of two, so percentiles are within ~6%), which can be merged by
+ * adding buckets. Partial aggregates built by different threads over
+ * different segments are combined with trace_agg_merge().
+ */
+
+#define TRACE_HIST_SUB_BITS     4
+#define TRACE_HIST_SUB          (1 << TRACE_HIST_SUB_BITS)
+#define TRACE_HIST_BUCKETS      ((64 - TRACE_HIST_SUB_BITS + 1) * TRACE_HIST_SUB)
+
+struct trace_agg_sys {
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+	/* Allocated on the first event with a duration */
+	uint64_t *hist;
+};
+
+struct trace_agg_pid {
+	uint32_t pid;
+	uint32_t used;
+	uint64_t count;
+	uint64_t total_ns;
+};
+
+struct trace_agg {
+	uint64_t events;
+	struct trace_agg_sys sys[TRACE_NR_SLOTS];
+	/* Open-addressed hash of pids, pidcap is a power of 2 */
+	struct trace_agg_pid *pids;
+	uint32_t npids, pidcap;
+};
+
+int trace_agg_init(struct trace_agg *a);
+void trace_agg_free(struct trace_agg *a);
+int trace_agg_add(struct trace_agg *a, uint32_t pid, uint16_t nr, uint64_t dur, int has_dur);
+int trace_agg_merge(struct trace_agg *dst, const struct trace_agg *src);
+
+/* Approximate q-quantile (0 <= q <= 1) of the durations of s, in ns */
+uint64_t trace_agg_percentile(const struct trace_agg_sys *s, double q);
+
+static inline uint32_t trace_hist_bucket(uint64_t v) {
+	int e;
+
+	if (v < TRACE_HIST_SUB)
+		return (uint32_t)v;
+	e = 63 - __builtin_clzll(v);
+	return (uint32_t)((e - TRACE_HIST_SUB_BITS + 1) * TRACE_HIST_SUB +
+		((v >> (e - TRACE_HIST_SUB_BITS)) & (TRACE_HIST_SUB - 1)));
+}
+
+/* Smallest value that falls into bucket b */
+static inline uint64_t trace_hist_value(uint32_t b) {
+	uint32_t e;
+
+	if (b < TRACE_HIST_SUB)
+		return b;
+	e = b / TRACE_HIST_SUB + TRACE_HIST_SUB_BITS - 1;
+	return (1ull << e) | ((uint64_t)(b % TRACE_HIST_SUB) << (e - TRACE_HIST_SUB_BITS));
+}
+
+#endif /* _TRACE_AGG_H */
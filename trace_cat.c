@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace_reader.h"
+
+/**
+ * Print a trace file as text, one event per line, using libtrace.
+ *
+ * Usage: ./trace_cat file.trc
+ */
+
+static struct trace_iter it;
+
+int main(int argc, char **argv) {
+
+	struct trace_reader r;
+	struct trace_event ev;
+	const char *name;
+	char nrbuf[16];
+	int status;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file.trc\n", argv[0]);
+		return 1;
+	}
+	if ((status = trace_reader_open(&r, argv[1])) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(-status));
+		return 1;
+	}
+
+	trace_iter_init(&it, &r);
+	while ((status = trace_iter_next(&it, &ev)) == 1) {
+		if (!(name = trace_syscall_name(ev.nr))) {
+			sprintf(nrbuf, "%u", ev.nr);
+			name = nrbuf;
+		}
+		if (ev.flags & TRACE_EV_TS)
+			printf("%llu.%09llu ", (unsigned long long)ev.ts / 1000000000ull,
+				(unsigned long long)ev.ts % 1000000000ull);
+		printf("[%d] %s(%llx, %llx, %llx, %llx, %llx, %llx)", ev.pid, name,
+			(unsigned long long)ev.args[0], (unsigned long long)ev.args[1],
+			(unsigned long long)ev.args[2], (unsigned long long)ev.args[3],
+			(unsigned long long)ev.args[4], (unsigned long long)ev.args[5]);
+		if (ev.flags & TRACE_EV_RET)
+			printf(" = %lld", (long long)ev.ret);
+		if (ev.flags & TRACE_EV_DUR)
+			printf(" <%lluns>", (unsigned long long)ev.dur);
+		putchar('\n');
+	}
+	trace_reader_close(&r);
+
+	if (status < 0) {
+		fprintf(stderr, "%s: corrupt trace\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
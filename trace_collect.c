@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "trace_format.h"
+
+/**
+ * Trace collector.
+ *
+ * Reads interceptor log lines of the form
+ *     [ 1234.567890] [pid]nr(a1,a2,a3,a4,a5,a6)
+ *     [ 1234.567912] [pid]nr=ret <ns>
+ * (as produced by log_message and log_return and shown by dmesg,
+ * optionally with the printk timestamp) and writes them out in the
+ * columnar trace format. Tasks in a child pid namespace are logged as
+ * [pid/vpid]; their global pid is recorded, or with -n the pid in their
+ * own namespace (for a collector running in the same container).
+ *
+ * A thread is in at most one syscall at a time, so each return record is
+ * matched with the last call logged by the same pid, giving the event its
+ * return value and duration. Calls that never return (exit, or a lost
+ * message) are written out with their entry only.
+ *
+ * Usage: dmesg | ./trace_collect [-n] out.trc
+ *        ./trace_collect [-n] out.trc kern.log
+ */
+
+#define LINE_CALL       1
+#define LINE_RETURN     2
+
+/* A call waiting for its return record, one slot per pid seen */
+struct pending {
+	uint32_t pid;
+	int used;
+	int waiting;
+	struct trace_event ev;
+};
+
+static struct pending *pending;
+static uint32_t npending, pendcap;
+static int ns_pids;
+
+/**
+ * Parse the "[pid]" or "[pid/vpid]" tag at p.
+ * Returns a pointer just past it, or NULL if p is not a pid tag.
+ */
+static const char *parse_pid(const char *p, unsigned int *pid) {
+
+	unsigned long global, local;
+	char *end;
+
+	if (*p++ != '[')
+		return NULL;
+	global = strtoul(p, &end, 16);
+	if (end == p)
+		return NULL;
+	local = global;
+	if (*end == '/') {
+		p = end + 1;
+		local = strtoul(p, &end, 16);
+		if (end == p)
+			return NULL;
+	}
+	if (*end != ']')
+		return NULL;
+	*pid = ns_pids ? local : global;
+	return end + 1;
+}
+
+/**
+ * Parse one log line into ev.
+ * Returns LINE_CALL or LINE_RETURN, or 0 if the line is not an
+ * interceptor message.
+ */
+static int parse_line(const char *line, struct trace_event *ev) {
+
+	unsigned long sec, usec, nr, ret, a[TRACE_NARGS];
+	unsigned long long ns;
+	unsigned int pid;
+	const char *p, *q;
+	int i, kind = 0;
+
+	memset(ev, 0, sizeof(*ev));
+
+	// The message can be preceded by a printk timestamp and/or a syslog prefix
+	for (p = strchr(line, '['); p; p = strchr(p + 1, '[')) {
+		if (!(q = parse_pid(p, &pid)))
+			continue;
+		if (sscanf(q, "%lx(%lx,%lx,%lx,%lx,%lx,%lx)", &nr,
+			   &a[0], &a[1], &a[2], &a[3], &a[4], &a[5]) == 7) {
+			kind = LINE_CALL;
+			break;
+		}
+		if (sscanf(q, "%lx=%lx <%llu>", &nr, &ret, &ns) == 3) {
+			kind = LINE_RETURN;
+			break;
+		}
+	}
+	if (!p)
+		return 0;
+
+	ev->pid = pid;
+	ev->nr = (uint16_t)nr;
+	if (kind == LINE_CALL) {
+		for (i = 0; i < TRACE_NARGS; i++)
+			ev->args[i] = a[i];
+	} else {
+		// The module is 32-bit, so negative errnos arrive as 32-bit values
+		ev->ret = ret <= 0xffffffffUL ? (int32_t)ret : (long)ret;
+		ev->dur = ns;
+		ev->flags |= TRACE_EV_RET | TRACE_EV_DUR;
+	}
+
+	if (p != line && sscanf(line, " [%lu.%lu]", &sec, &usec) == 2) {
+		ev->ts = (uint64_t)sec * 1000000000ull + (uint64_t)usec * 1000ull;
+		ev->flags |= TRACE_EV_TS;
+	}
+	return kind;
+}
+
+/* Slot for pid in the pending table, or NULL if out of memory */
+static struct pending *pending_slot(uint32_t pid) {
+
+	struct pending *old;
+	uint32_t i, cap;
+
+	if ((npending + 1) * 2 > pendcap) {
+		old = pending;
+		cap = pendcap;
+		if (!(pending = calloc(cap ? cap * 2 : 1024, sizeof(*pending)))) {
+			pending = old;
+			return NULL;
+		}
+		pendcap = cap ? cap * 2 : 1024;
+		npending = 0;
+		for (i = 0; i < cap; i++) {
+			if (old[i].used)
+				*pending_slot(old[i].pid) = old[i];
+		}
+		free(old);
+	}
+
+	for (i = (pid * 2654435761u) & (pendcap - 1); pending[i].used; i = (i + 1) & (pendcap - 1)) {
+		if (pending[i].pid == pid)
+			return &pending[i];
+	}
+	pending[i].used = 1;
+	pending[i].pid = pid;
+	npending++;
+	return &pending[i];
+}
+
+/**
+ * Add a parsed line to the trace: calls are held back until their return
+ * record arrives or the same pid makes another call.
+ */
+static int collect(struct trace_writer *w, int kind, const struct trace_event *ev) {
+
+	struct pending *p = pending_slot(ev->pid);
+	int status = 0;
+
+	if (!p)
+		return -ENOMEM;
+
+	if (kind == LINE_RETURN) {
+		// A return without its call (e.g. the log started mid-call) is dropped
+		if (!p->waiting || p->ev.nr != ev->nr)
+			return 0;
+		p->ev.ret = ev->ret;
+		p->ev.dur = ev->dur;
+		p->ev.flags |= TRACE_EV_RET | TRACE_EV_DUR;
+		p->waiting = 0;
+		return trace_writer_add(w, &p->ev);
+	}
+
+	if (p->waiting)
+		status = trace_writer_add(w, &p->ev);
+	p->ev = *ev;
+	p->waiting = 1;
+	return status;
+}
+
+/* Write out the calls still waiting for a return */
+static int collect_flush(struct trace_writer *w) {
+
+	uint32_t i;
+	int status;
+
+	for (i = 0; i < pendcap; i++) {
+		if (pending[i].used && pending[i].waiting) {
+			if ((status = trace_writer_add(w, &pending[i].ev)) != 0)
+				return status;
+			pending[i].waiting = 0;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+
+	struct trace_writer *w;
+	struct trace_event ev;
+	char line[1024];
+	unsigned long long nevents = 0, inbytes = 0;
+	FILE *in = stdin, *out;
+	int status, kind, opt;
+
+	while ((opt = getopt(argc, argv, "n")) != -1) {
+		switch (opt) {
+			case 'n':
+				ns_pids = 1;
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-n] out.trc [logfile]\n", argv[0]);
+				return 1;
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s [-n] out.trc [logfile]\n", argv[0]);
+		return 1;
+	}
+	if (argc > 2 && !(in = fopen(argv[2], "r"))) {
+		perror(argv[2]);
+		return 1;
+	}
+	if (!(out = fopen(argv[1], "wb"))) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	w = malloc(sizeof(*w));
+	if (!w || trace_writer_open(w, out) != 0) {
+		fprintf(stderr, "%s: cannot start trace\n", argv[1]);
+		return 1;
+	}
+
+	while (fgets(line, sizeof(line), in)) {
+		if (!(kind = parse_line(line, &ev)))
+			continue;
+		inbytes += strlen(line);
+		nevents += kind == LINE_CALL;
+		if ((status = collect(w, kind, &ev)) != 0) {
+			fprintf(stderr, "%s: %s\n", argv[1], strerror(-status));
+			return 1;
+		}
+	}
+
+	if ((status = collect_flush(w)) != 0 || (status = trace_writer_close(w)) != 0 || fclose(out) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(status ? -status : errno));
+		return 1;
+	}
+
+	fprintf(stderr, "%llu events, %llu blocks in %llu segments, %llu -> %llu bytes (%.1fx)\n",
+		nevents, (unsigned long long)w->nblocks, (unsigned long long)w->nsegments, inbytes,
+		(unsigned long long)w->bytes,
+		w->bytes ? (double)inbytes / w->bytes : 0.0);
+	free(w);
+	free(pending);
+	return 0;
+}
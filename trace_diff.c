@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "stats.h"
+#include "trace_reader.h"
+
+/**
+ * Compare the syscall behaviour of two runs.
+ *
+ * Usage: ./trace_diff [-t percent] [-z score] [-n top] A B
+ *   A and B are each either a trace file (from trace_collect) or a
+ *   saved aggregate snapshot (cat /proc/interceptor/stats > run.stats).
+ *   -t  minimum relative change to report as a regression (default 10%)
+ *   -z  minimum z-score for a change to count as significant (default 3)
+ *   -n  number of processes to list (default 20)
+ *
+ * For every syscall the counts, errors, bytes and p50/p99/max latency of
+ * both runs are shown. Processes are matched by command name for
+ * snapshots, or by pid for traces. A change is flagged as a regression
+ * only if it is both larger than -t and statistically significant:
+ *   - counts: z = (B - A) / sqrt(A + B), treating counts as Poisson
+ *   - error rate and latency: two-proportion z-test on the fraction of
+ *     calls that failed, or that were slower than A's p50/p99 bucket
+ * The exit status is 1 if any regression was flagged, so CI can gate on it.
+ */
+
+static double min_change = 0.10;
+static double min_z = 3.0;
+
+/**
+ * Build a snapshot from a trace file. Durations and return values are
+ * only available if the trace carries them.
+ */
+static int load_trace(const char *path, struct stats_snapshot *s) {
+
+	static struct trace_iter it;
+	struct trace_reader r;
+	struct trace_event ev;
+	int *byproc = NULL;
+	int maxpid = 0, status, io[STATS_MAX_SYSCALL];
+	const char *io_names[] = { "read", "write", "pread64", "pwrite64", "readv",
+		"writev", "sendfile", "sendfile64", NULL };
+	char key[STATS_COMM_LEN];
+	int i, nr;
+
+	memset(s, 0, sizeof(*s));
+	memset(io, 0, sizeof(io));
+	for (i = 0; io_names[i]; i++) {
+		if ((nr = trace_syscall_lookup(io_names[i])) >= 0)
+			io[nr] = 1;
+	}
+
+	if ((status = trace_reader_open(&r, path)) != 0)
+		return status;
+
+	trace_iter_init(&it, &r);
+	while ((status = trace_iter_next(&it, &ev)) == 1) {
+		struct stats_syscall *e = &s->sys[ev.nr % STATS_MAX_SYSCALL];
+		struct stats_process *p;
+		uint64_t bytes = 0;
+
+		e->count++;
+		if (ev.flags & TRACE_EV_RET) {
+			if (ev.ret < 0 && ev.ret >= -4095)
+				e->errors++;
+			else if (ev.ret > 0 && io[ev.nr % STATS_MAX_SYSCALL])
+				bytes = ev.ret;
+		}
+		e->bytes += bytes;
+		if (ev.flags & TRACE_EV_DUR) {
+			e->total_ns += ev.dur;
+			if (ev.dur > e->max_ns)
+				e->max_ns = ev.dur;
+			e->hist[stats_bucket(ev.dur)]++;
+		}
+
+		// Pids index straight into a table of (process record + 1)
+		if ((int)ev.pid >= maxpid) {
+			int n = ev.pid * 2 + 64;
+			int *t = realloc(byproc, n * sizeof(*t));
+			if (!t) {
+				status = -1;
+				break;
+			}
+			memset(t + maxpid, 0, (n - maxpid) * sizeof(*t));
+			byproc = t;
+			maxpid = n;
+		}
+		if (!byproc[ev.pid]) {
+			snprintf(key, sizeof(key), "%d", ev.pid);
+			if (!stats_add_process(s, ev.pid, key)) {
+				status = -1;
+				break;
+			}
+			byproc[ev.pid] = s->nprocs;
+		}
+		p = &s->procs[byproc[ev.pid] - 1];
+		p->count++;
+		p->total_ns += (ev.flags & TRACE_EV_DUR) ? ev.dur : 0;
+		p->bytes += bytes;
+	}
+
+	free(byproc);
+	trace_reader_close(&r);
+	return status < 0 ? -1 : 0;
+}
+
+static int load(const char *path, struct stats_snapshot *s) {
+
+	struct trace_reader r;
+
+	// Anything that is not a trace file is taken to be a snapshot
+	if (trace_reader_open(&r, path) == 0) {
+		trace_reader_close(&r);
+		return load_trace(path, s);
+	}
+	return stats_load(path, s);
+}
+
+/* Poisson z-score of a count change */
+static double count_z(uint64_t a, uint64_t b) {
+	return (a + b) ? ((double)b - (double)a) / sqrt((double)a + (double)b) : 0;
+}
+
+/* Two-proportion z-score of B's rate ka/na -> kb/nb rising */
+static double prop_z(uint64_t ka, uint64_t na, uint64_t kb, uint64_t nb) {
+
+	double pa, pb, p, se;
+
+	if (!na || !nb)
+		return 0;
+	pa = (double)ka / na;
+	pb = (double)kb / nb;
+	p = (double)(ka + kb) / (na + nb);
+	se = sqrt(p * (1 - p) * (1.0 / na + 1.0 / nb));
+	return se > 0 ? (pb - pa) / se : 0;
+}
+
+static double change(uint64_t a, uint64_t b) {
+	return a ? ((double)b - (double)a) / a : (b ? INFINITY : 0);
+}
+
+static int regressed(double rel, double z) {
+	return rel > min_change && z > min_z;
+}
+
+/**
+ * Has latency at quantile q got worse: are more of B's calls slower than
+ * the bucket holding A's q-quantile?
+ */
+static int latency_regressed(const struct stats_syscall *a, const struct stats_syscall *b, double q) {
+
+	uint64_t na = 0, nb = 0, ka = 0, kb = 0;
+	int i, bq = stats_percentile_bucket(a, q);
+
+	if (bq < 0)
+		return 0;
+	for (i = 0; i < STATS_HIST_BUCKETS; i++) {
+		na += a->hist[i];
+		nb += b->hist[i];
+		if (i > bq) {
+			ka += a->hist[i];
+			kb += b->hist[i];
+		}
+	}
+	if (!nb)
+		return 0;
+	return (double)kb / nb > (double)ka / na * (1 + min_change) &&
+		prop_z(ka, na, kb, nb) > min_z;
+}
+
+static void fmt_name(char *buf, int nr) {
+
+	const char *name = trace_syscall_name(nr);
+
+	if (name)
+		snprintf(buf, 24, "%s", name);
+	else
+		snprintf(buf, 24, "%d", nr);
+}
+
+static int diff_syscalls(const struct stats_snapshot *A, const struct stats_snapshot *B) {
+
+	char name[24], flags[32];
+	int nr, flagged = 0;
+
+	printf("%-16s %10s %10s %7s %7s %8s %10s %10s %10s %10s %10s %10s  %s\n",
+		"syscall", "count_a", "count_b", "delta", "err", "bytes", "p50_a", "p50_b",
+		"p99_a", "p99_b", "max_a", "max_b", "flags");
+
+	for (nr = 0; nr < STATS_MAX_SYSCALL; nr++) {
+		const struct stats_syscall *a = &A->sys[nr], *b = &B->sys[nr];
+
+		if (!a->count && !b->count)
+			continue;
+
+		flags[0] = '\0';
+		if (regressed(change(a->count, b->count), count_z(a->count, b->count)))
+			strcat(flags, " COUNT");
+		if (b->errors && (double)b->errors / b->count >
+		    (a->count ? (double)a->errors / a->count : 0) * (1 + min_change) &&
+		    prop_z(a->errors, a->count, b->errors, b->count) > min_z)
+			strcat(flags, " ERRORS");
+		if (latency_regressed(a, b, 0.50))
+			strcat(flags, " P50");
+		if (latency_regressed(a, b, 0.99))
+			strcat(flags, " P99");
+		flagged |= flags[0] != '\0';
+
+		fmt_name(name, nr);
+		printf("%-16s %10llu %10llu %+6.0f%% %+6.0f%% %+7.0f%% %10llu %10llu %10llu %10llu %10llu %10llu %s\n",
+			name, (unsigned long long)a->count, (unsigned long long)b->count,
+			100 * change(a->count, b->count), 100 * change(a->errors, b->errors),
+			100 * change(a->bytes, b->bytes),
+			(unsigned long long)stats_percentile(a, 0.50), (unsigned long long)stats_percentile(b, 0.50),
+			(unsigned long long)stats_percentile(a, 0.99), (unsigned long long)stats_percentile(b, 0.99),
+			(unsigned long long)a->max_ns, (unsigned long long)b->max_ns, flags);
+	}
+	return flagged;
+}
+
+/* Processes of both runs, merged by name */
+struct proc_pair {
+	char comm[STATS_COMM_LEN];
+	struct stats_process a, b;
+};
+
+static struct proc_pair *find_pair(struct proc_pair *pairs, int *n, const char *comm) {
+
+	int i;
+
+	for (i = 0; i < *n; i++) {
+		if (strcmp(pairs[i].comm, comm) == 0)
+			return &pairs[i];
+	}
+	memset(&pairs[*n], 0, sizeof(pairs[*n]));
+	strcpy(pairs[*n].comm, comm);
+	return &pairs[(*n)++];
+}
+
+static int cmp_pair(const void *x, const void *y) {
+
+	const struct proc_pair *p = x, *q = y;
+	double dp = fabs((double)p->b.count - (double)p->a.count);
+	double dq = fabs((double)q->b.count - (double)q->a.count);
+	return dp < dq ? 1 : dp > dq ? -1 : 0;
+}
+
+static int diff_processes(const struct stats_snapshot *A, const struct stats_snapshot *B, int top) {
+
+	struct proc_pair *pairs, *p;
+	int i, n = 0, flagged = 0;
+
+	if (!(pairs = malloc((A->nprocs + B->nprocs + 1) * sizeof(*pairs))))
+		return 0;
+	for (i = 0; i < A->nprocs; i++) {
+		p = find_pair(pairs, &n, A->procs[i].comm);
+		p->a.count += A->procs[i].count;
+		p->a.total_ns += A->procs[i].total_ns;
+		p->a.bytes += A->procs[i].bytes;
+	}
+	for (i = 0; i < B->nprocs; i++) {
+		p = find_pair(pairs, &n, B->procs[i].comm);
+		p->b.count += B->procs[i].count;
+		p->b.total_ns += B->procs[i].total_ns;
+		p->b.bytes += B->procs[i].bytes;
+	}
+	qsort(pairs, n, sizeof(*pairs), cmp_pair);
+
+	printf("\n%-16s %10s %10s %7s %14s %14s %8s  %s\n",
+		"process", "count_a", "count_b", "delta", "time_a_ns", "time_b_ns", "bytes", "flags");
+	for (i = 0; i < n && i < top; i++) {
+		int bad;
+
+		p = &pairs[i];
+		bad = regressed(change(p->a.count, p->b.count), count_z(p->a.count, p->b.count));
+		flagged |= bad;
+		printf("%-16s %10llu %10llu %+6.0f%% %14llu %14llu %+7.0f%% %s\n", p->comm,
+			(unsigned long long)p->a.count, (unsigned long long)p->b.count,
+			100 * change(p->a.count, p->b.count),
+			(unsigned long long)p->a.total_ns, (unsigned long long)p->b.total_ns,
+			100 * change(p->a.bytes, p->b.bytes), bad ? " COUNT" : "");
+	}
+	free(pairs);
+	return flagged;
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-t percent] [-z score] [-n top] A B\n", prog);
+}
+
+int main(int argc, char **argv) {
+
+	struct stats_snapshot *a, *b;
+	int opt, top = 20, flagged;
+
+	while ((opt = getopt(argc, argv, "t:z:n:")) != -1) {
+		switch (opt) {
+			case 't':
+				min_change = atof(optarg) / 100;
+				break;
+			case 'z':
+				min_z = atof(optarg);
+				break;
+			case 'n':
+				top = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 2;
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	a = malloc(sizeof(*a));
+	b = malloc(sizeof(*b));
+	if (!a || !b) {
+		fprintf(stderr, "out of memory\n");
+		return 2;
+	}
+	if (load(argv[optind], a) != 0) {
+		fprintf(stderr, "%s: cannot read trace or snapshot\n", argv[optind]);
+		return 2;
+	}
+	if (load(argv[optind + 1], b) != 0) {
+		fprintf(stderr, "%s: cannot read trace or snapshot\n", argv[optind + 1]);
+		return 2;
+	}
+
+	flagged = diff_syscalls(a, b);
+	flagged |= diff_processes(a, b, top);
+	printf("\n%s\n", flagged ? "REGRESSIONS FOUND" : "no significant regressions");
+
+	stats_free(a);
+	stats_free(b);
+	free(a);
+	free(b);
+	return flagged ? 1 : 0;
+}
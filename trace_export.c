@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "trace_reader.h"
+
+/**
+ * Convert a trace file to a timeline for chrome://tracing or Perfetto.
+ *
+ * Usage: ./trace_export [-f json|perfetto] file.trc [out]
+ *   -f json      Chrome Trace Event JSON (default)
+ *   -f perfetto  Perfetto protobuf trace (ui.perfetto.dev, trace_processor)
+ *
+ * Every syscall with a duration becomes a slice on its thread's track,
+ * from entry to return, with its arguments and return value attached.
+ * Calls without a duration (they never returned) are instant events, and
+ * events without a timestamp are skipped. Output is written event by
+ * event as the trace is read, so memory use does not depend on the size
+ * of the trace; the only state kept is which pids already have a track.
+ */
+
+enum format { FORMAT_JSON, FORMAT_PERFETTO };
+
+static struct trace_iter it;
+static unsigned char *seen;
+static uint32_t seencap;
+
+/**
+ * Has pid been seen before? Marks it as seen.
+ * Returns 1 if seen, 0 if new, or -ENOMEM.
+ */
+static int pid_seen(uint32_t pid) {
+
+	unsigned char *t;
+	uint32_t cap;
+
+	if (pid / 8 >= seencap) {
+		cap = pid / 8 * 2 + 64;
+		if (!(t = realloc(seen, cap)))
+			return -ENOMEM;
+		memset(t + seencap, 0, cap - seencap);
+		seen = t;
+		seencap = cap;
+	}
+	if (seen[pid / 8] & (1 << (pid % 8)))
+		return 1;
+	seen[pid / 8] |= 1 << (pid % 8);
+	return 0;
+}
+
+static const char *event_name(const struct trace_event *ev, char *buf) {
+
+	const char *name = trace_syscall_name(ev->nr);
+
+	if (name)
+		return name;
+	sprintf(buf, "syscall_%u", ev->nr);
+	return buf;
+}
+
+//----- Chrome Trace Event JSON ------------------------------------
+static void json_begin(FILE *out) {
+
+	fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+}
+
+/* Timestamps are in microseconds; keep the nanoseconds as a fraction */
+static void json_us(FILE *out, uint64_t ns) {
+
+	fprintf(out, "%llu.%03llu", (unsigned long long)ns / 1000, (unsigned long long)ns % 1000);
+}
+
+static int json_event(FILE *out, const struct trace_event *ev, int first) {
+
+	char buf[24];
+	int i, status;
+
+	// Name each thread's track once, before its first event
+	if ((status = pid_seen(ev->pid)) < 0)
+		return status;
+	if (!status) {
+		fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,"
+			"\"args\":{\"name\":\"pid %u\"}}", first ? "" : ",\n", ev->pid, ev->pid, ev->pid);
+		first = 0;
+	}
+
+	fprintf(out, "%s{\"name\":\"%s\",\"cat\":\"syscall\",\"pid\":%u,\"tid\":%u,\"ts\":",
+		first ? "" : ",\n", event_name(ev, buf), ev->pid, ev->pid);
+	json_us(out, ev->ts);
+	if (ev->flags & TRACE_EV_DUR) {
+		fprintf(out, ",\"ph\":\"X\",\"dur\":");
+		json_us(out, ev->dur);
+	} else {
+		fprintf(out, ",\"ph\":\"i\",\"s\":\"t\"");
+	}
+
+	fprintf(out, ",\"args\":{\"nr\":%u", ev->nr);
+	for (i = 0; i < TRACE_NARGS; i++)
+		fprintf(out, ",\"arg%d\":\"0x%llx\"", i, (unsigned long long)ev->args[i]);
+	if (ev->flags & TRACE_EV_RET)
+		fprintf(out, ",\"ret\":%lld", (long long)ev->ret);
+	fprintf(out, "}}");
+	return 0;
+}
+
+static void json_end(FILE *out) {
+
+	fprintf(out, "\n]}\n");
+}
+//------------------------------------------------------------------
+
+
+
+//----- Perfetto protobuf ------------------------------------------
+/**
+ * A Perfetto trace is a protobuf "Trace" message: a sequence of
+ * TracePacket fields (field 1), which can simply be concatenated. Only
+ * the handful of fields needed for thread tracks and slices are written.
+ */
+#define PB_VARINT               0
+#define PB_BYTES                2
+
+#define PB_TRACE_PACKET         1
+
+#define PB_PACKET_TIMESTAMP     8
+#define PB_PACKET_SEQUENCE_ID   10
+#define PB_PACKET_TRACK_EVENT   11
+#define PB_PACKET_TRACK         60
+
+#define PB_TRACK_UUID           1
+#define PB_TRACK_NAME           2
+#define PB_TRACK_THREAD         4
+#define PB_THREAD_PID           1
+#define PB_THREAD_TID           2
+
+#define PB_EVENT_ANNOTATION     4
+#define PB_EVENT_TYPE           9
+#define PB_EVENT_TRACK_UUID     11
+#define PB_EVENT_CATEGORY       22
+#define PB_EVENT_NAME           23
+#define PB_SLICE_BEGIN          1
+#define PB_SLICE_END            2
+#define PB_INSTANT              3
+
+#define PB_ANNOTATION_INT       4
+#define PB_ANNOTATION_POINTER   7
+#define PB_ANNOTATION_NAME      10
+
+/* Any nonzero id will do; all packets come from one writer */
+#define PB_SEQUENCE             1
+
+/* Large enough for the biggest packet we write (a slice with its args) */
+#define PB_PACKET_MAX           512
+
+static unsigned char *pb_varint(unsigned char *p, int field, uint64_t v) {
+
+	p = trace_put_varint(p, (uint64_t)field << 3 | PB_VARINT);
+	return trace_put_varint(p, v);
+}
+
+static unsigned char *pb_bytes(unsigned char *p, int field, const void *data, size_t len) {
+
+	p = trace_put_varint(p, (uint64_t)field << 3 | PB_BYTES);
+	p = trace_put_varint(p, len);
+	memcpy(p, data, len);
+	return p + len;
+}
+
+static unsigned char *pb_string(unsigned char *p, int field, const char *s) {
+
+	return pb_bytes(p, field, s, strlen(s));
+}
+
+/* Wrap a TracePacket and write it out */
+static int pb_packet(FILE *out, const unsigned char *packet, size_t len) {
+
+	unsigned char buf[PB_PACKET_MAX + 16], *p;
+
+	p = pb_bytes(buf, PB_TRACE_PACKET, packet, len);
+	return fwrite(buf, 1, p - buf, out) == (size_t)(p - buf) ? 0 : -EIO;
+}
+
+/* Track uuids must be nonzero */
+static uint64_t pb_track(uint32_t pid) {
+
+	return (uint64_t)pid + 1;
+}
+
+/* TrackDescriptor for a thread's track */
+static int pb_thread_track(FILE *out, uint32_t pid) {
+
+	unsigned char thread[32], track[96], packet[128], *p, *q;
+	char name[24];
+
+	q = pb_varint(thread, PB_THREAD_PID, pid);
+	q = pb_varint(q, PB_THREAD_TID, pid);
+
+	snprintf(name, sizeof(name), "pid %u", pid);
+	p = pb_varint(track, PB_TRACK_UUID, pb_track(pid));
+	p = pb_string(p, PB_TRACK_NAME, name);
+	p = pb_bytes(p, PB_TRACK_THREAD, thread, q - thread);
+
+	q = pb_bytes(packet, PB_PACKET_TRACK, track, p - track);
+	q = pb_varint(q, PB_PACKET_SEQUENCE_ID, PB_SEQUENCE);
+	return pb_packet(out, packet, q - packet);
+}
+
+static unsigned char *pb_annotation(unsigned char *p, const char *name, int type, uint64_t v) {
+
+	unsigned char ann[48], *q;
+
+	q = pb_string(ann, PB_ANNOTATION_NAME, name);
+	q = pb_varint(q, type, v);
+	return pb_bytes(p, PB_EVENT_ANNOTATION, ann, q - ann);
+}
+
+/* One TrackEvent packet; names and annotations are left off slice ends */
+static int pb_track_event(FILE *out, const struct trace_event *ev, uint64_t ts, int type) {
+
+	unsigned char event[PB_PACKET_MAX - 32], packet[PB_PACKET_MAX], *p, *q;
+	char buf[24], arg[8];
+	int i;
+
+	p = pb_varint(event, PB_EVENT_TYPE, type);
+	p = pb_varint(p, PB_EVENT_TRACK_UUID, pb_track(ev->pid));
+	if (type != PB_SLICE_END) {
+		p = pb_string(p, PB_EVENT_CATEGORY, "syscall");
+		p = pb_string(p, PB_EVENT_NAME, event_name(ev, buf));
+		p = pb_annotation(p, "nr", PB_ANNOTATION_INT, ev->nr);
+		for (i = 0; i < TRACE_NARGS; i++) {
+			sprintf(arg, "arg%d", i);
+			p = pb_annotation(p, arg, PB_ANNOTATION_POINTER, ev->args[i]);
+		}
+		if (ev->flags & TRACE_EV_RET)
+			p = pb_annotation(p, "ret", PB_ANNOTATION_INT, (uint64_t)ev->ret);
+	}
+
+	q = pb_varint(packet, PB_PACKET_TIMESTAMP, ts);
+	q = pb_bytes(q, PB_PACKET_TRACK_EVENT, event, p - event);
+	q = pb_varint(q, PB_PACKET_SEQUENCE_ID, PB_SEQUENCE);
+	return pb_packet(out, packet, q - packet);
+}
+
+static int pb_event(FILE *out, const struct trace_event *ev) {
+
+	int status;
+
+	if ((status = pid_seen(ev->pid)) < 0)
+		return status;
+	if (!status && (status = pb_thread_track(out, ev->pid)) != 0)
+		return status;
+
+	if (!(ev->flags & TRACE_EV_DUR))
+		return pb_track_event(out, ev, ev->ts, PB_INSTANT);
+	if ((status = pb_track_event(out, ev, ev->ts, PB_SLICE_BEGIN)) != 0)
+		return status;
+	return pb_track_event(out, ev, ev->ts + ev->dur, PB_SLICE_END);
+}
+//------------------------------------------------------------------
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-f json|perfetto] file.trc [out]\n", prog);
+}
+
+int main(int argc, char **argv) {
+
+	struct trace_reader r;
+	struct trace_event ev;
+	enum format format = FORMAT_JSON;
+	unsigned long long nevents = 0, skipped = 0;
+	FILE *out = stdout;
+	int opt, status;
+
+	while ((opt = getopt(argc, argv, "f:")) != -1) {
+		switch (opt) {
+			case 'f':
+				if (strcmp(optarg, "json") == 0) {
+					format = FORMAT_JSON;
+				} else if (strcmp(optarg, "perfetto") == 0) {
+					format = FORMAT_PERFETTO;
+				} else {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc || argc - optind > 2) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if ((status = trace_reader_open(&r, argv[optind])) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-status));
+		return 1;
+	}
+	if (optind + 1 < argc && !(out = fopen(argv[optind + 1], "wb"))) {
+		perror(argv[optind + 1]);
+		return 1;
+	}
+
+	if (format == FORMAT_JSON)
+		json_begin(out);
+	trace_iter_init(&it, &r);
+	while ((status = trace_iter_next(&it, &ev)) == 1) {
+		if (!(ev.flags & TRACE_EV_TS)) {
+			skipped++;
+			continue;
+		}
+		if (format == FORMAT_JSON)
+			status = json_event(out, &ev, nevents == 0);
+		else
+			status = pb_event(out, &ev);
+		if (status != 0)
+			break;
+		nevents++;
+	}
+	if (format == FORMAT_JSON)
+		json_end(out);
+	trace_reader_close(&r);
+	free(seen);
+
+	if (status < 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], status == -EINVAL ? "corrupt trace" : strerror(-status));
+		return 1;
+	}
+	if (fclose(out) != 0) {
+		perror(optind + 1 < argc ? argv[optind + 1] : "stdout");
+		return 1;
+	}
+	fprintf(stderr, "%llu events exported, %llu without timestamps skipped\n", nevents, skipped);
+	return 0;
+}
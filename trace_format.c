@@ -0,0 +1,700 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "trace_format.h"
+
+/**
+ * Encoder/decoder for the columnar trace format described in trace_format.h.
+ */
+
+//----- Writer -----------------------------------------------------
+
+int trace_writer_open(struct trace_writer *w, FILE *fp) {
+
+	struct trace_file_header h;
+
+	memset(w, 0, sizeof(*w));
+	w->fp = fp;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = TRACE_MAGIC;
+	h.version = TRACE_VERSION;
+	h.block_events = TRACE_BLOCK_EVENTS;
+
+	if (fwrite(&h, sizeof(h), 1, fp) != 1)
+		return -EIO;
+	w->bytes = sizeof(h);
+	return 0;
+}
+
+/* Append len bytes to the segment being built */
+static int seg_append(struct trace_writer *w, const void *data, size_t len) {
+
+	if (w->seglen + len > w->segcap) {
+		size_t cap = w->segcap ? w->segcap * 2 : 1 << 20;
+		unsigned char *buf;
+
+		while (cap < w->seglen + len)
+			cap *= 2;
+		if (!(buf = realloc(w->segbuf, cap)))
+			return -ENOMEM;
+		w->segbuf = buf;
+		w->segcap = cap;
+	}
+	memcpy(w->segbuf + w->seglen, data, len);
+	w->seglen += len;
+	return 0;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Sort and de-duplicate n pids in place, returning the new count */
+static uint32_t sort_unique(uint32_t *pids, uint32_t n) {
+
+	uint32_t i, m = 0;
+
+	qsort(pids, n, sizeof(*pids), cmp_u32);
+	for (i = 0; i < n; i++) {
+		if (m == 0 || pids[m - 1] != pids[i])
+			pids[m++] = pids[i];
+	}
+	return m;
+}
+
+/**
+ * Write out the segment built so far: header, pid dictionary, block
+ * index and then the encoded blocks.
+ */
+static int write_segment(struct trace_writer *w) {
+
+	struct trace_segment_header *h = &w->seg;
+	unsigned char *dict, *p;
+	uint64_t base;
+	uint32_t i;
+	int status = 0;
+
+	if (h->nblocks == 0)
+		return 0;
+
+	h->magic = TRACE_SEGMENT_MAGIC;
+	h->npids = sort_unique(w->segpids, h->npids);
+	if (!(dict = malloc((size_t)h->npids * 5 + 1)))
+		return -ENOMEM;
+	for (i = 0, p = dict; i < h->npids; i++)
+		p = trace_put_varint(p, w->segpids[i] - (i ? w->segpids[i - 1] : 0));
+	h->dict_bytes = p - dict;
+
+	base = sizeof(*h) + h->dict_bytes + h->nblocks * sizeof(w->idx[0]);
+	for (i = 0; i < h->nblocks; i++)
+		w->idx[i].offset += base;
+	h->bytes = base + w->seglen;
+
+	if (fwrite(h, sizeof(*h), 1, w->fp) != 1 ||
+	    (h->dict_bytes && fwrite(dict, h->dict_bytes, 1, w->fp) != 1) ||
+	    fwrite(w->idx, sizeof(w->idx[0]), h->nblocks, w->fp) != h->nblocks ||
+	    fwrite(w->segbuf, w->seglen, 1, w->fp) != 1)
+		status = -EIO;
+	free(dict);
+
+	w->bytes += h->bytes;
+	w->nsegments++;
+	memset(h, 0, sizeof(*h));
+	w->seglen = 0;
+	return status;
+}
+
+int trace_writer_add(struct trace_writer *w, const struct trace_event *ev) {
+
+	w->ev[w->n++] = *ev;
+	if (w->n == TRACE_BLOCK_EVENTS)
+		return trace_writer_flush(w);
+	return 0;
+}
+
+/* Index of pid in the sorted dictionary */
+static uint16_t dict_index(const uint32_t *dict, uint32_t n, uint32_t pid) {
+
+	uint32_t lo = 0, hi = n;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (dict[mid] < pid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (uint16_t)lo;
+}
+
+/**
+ * Encode the buffered events as one block and add it to the current
+ * segment, writing the segment out once it is full.
+ */
+int trace_writer_flush(struct trace_writer *w) {
+
+	struct trace_block_header h;
+	unsigned char *col[TRACE_NCOLS], *p;
+	uint32_t *dict;
+	uint64_t (*last)[TRACE_NARGS];
+	uint64_t prev_ts;
+	uint32_t i, npids, flags = 0;
+	int c, a, status = 0;
+	size_t cap;
+
+	if (w->n == 0)
+		return 0;
+
+	// Worst case a varint is 10 bytes; the pid column also carries the dictionary
+	cap = (size_t)w->n * 10 + (size_t)w->n * 2;
+	for (c = 0; c < TRACE_NCOLS; c++)
+		col[c] = NULL;
+	dict = malloc(w->n * sizeof(*dict));
+	last = calloc(TRACE_NR_SLOTS, sizeof(*last));
+	for (c = 0; c < TRACE_NCOLS; c++) {
+		col[c] = malloc(cap);
+		if (!col[c])
+			status = -ENOMEM;
+	}
+	if (!dict || !last || status) {
+		status = -ENOMEM;
+		goto out;
+	}
+
+	memset(&h, 0, sizeof(h));
+	h.magic = TRACE_BLOCK_MAGIC;
+	h.nevents = w->n;
+
+	// Build the pid dictionary
+	for (i = 0; i < w->n; i++) {
+		dict[i] = w->ev[i].pid;
+		flags |= w->ev[i].flags;
+		w->seg.nr_mask[(w->ev[i].nr & (TRACE_NR_SLOTS - 1)) / 64] |=
+			1ull << (w->ev[i].nr % 64);
+		if (w->ev[i].flags & TRACE_EV_TS) {
+			if (!w->seg.ts_min || w->ev[i].ts < w->seg.ts_min)
+				w->seg.ts_min = w->ev[i].ts;
+			if (w->ev[i].ts > w->seg.ts_max)
+				w->seg.ts_max = w->ev[i].ts;
+		}
+	}
+	npids = sort_unique(dict, w->n);
+	h.npids = npids;
+
+	// Add this block's pids to the segment dictionary
+	if (w->seg.npids + npids > w->segpidcap) {
+		uint32_t cap = (w->seg.npids + npids) * 2;
+		uint32_t *segpids = realloc(w->segpids, cap * sizeof(*segpids));
+		if (!segpids) {
+			status = -ENOMEM;
+			goto out;
+		}
+		w->segpids = segpids;
+		w->segpidcap = cap;
+	}
+	memcpy(w->segpids + w->seg.npids, dict, npids * sizeof(*dict));
+	w->seg.npids += npids;
+
+	h.present = TRACE_COL(TRACE_COL_PID) | TRACE_COL(TRACE_COL_NR) | TRACE_COL_ARGS;
+	if (flags & TRACE_EV_TS)
+		h.present |= TRACE_COL(TRACE_COL_TS);
+	if (flags & TRACE_EV_RET)
+		h.present |= TRACE_COL(TRACE_COL_RET);
+	if (flags & TRACE_EV_DUR)
+		h.present |= TRACE_COL(TRACE_COL_DUR);
+
+	// TS
+	h.ts_base = w->ev[0].ts;
+	prev_ts = h.ts_base;
+	p = col[TRACE_COL_TS];
+	if (h.present & TRACE_COL(TRACE_COL_TS)) {
+		for (i = 0; i < w->n; i++) {
+			p = trace_put_varint(p, trace_zigzag((int64_t)(w->ev[i].ts - prev_ts)));
+			prev_ts = w->ev[i].ts;
+		}
+	}
+	h.col_bytes[TRACE_COL_TS] = p - col[TRACE_COL_TS];
+
+	// PID: dictionary, then fixed-width indices
+	p = col[TRACE_COL_PID];
+	for (i = 0; i < npids; i++)
+		p = trace_put_varint(p, dict[i] - (i ? dict[i - 1] : 0));
+	for (i = 0; i < w->n; i++) {
+		uint16_t idx = dict_index(dict, npids, w->ev[i].pid);
+		memcpy(p, &idx, sizeof(idx));
+		p += sizeof(idx);
+	}
+	h.col_bytes[TRACE_COL_PID] = p - col[TRACE_COL_PID];
+
+	// NR
+	p = col[TRACE_COL_NR];
+	for (i = 0; i < w->n; i++) {
+		memcpy(p, &w->ev[i].nr, sizeof(uint16_t));
+		p += sizeof(uint16_t);
+	}
+	h.col_bytes[TRACE_COL_NR] = p - col[TRACE_COL_NR];
+
+	// ARG0..ARG5, predicted from the previous call of the same syscall
+	for (a = 0; a < TRACE_NARGS; a++) {
+		p = col[TRACE_COL_ARG0 + a];
+		for (i = 0; i < w->n; i++) {
+			uint64_t *l = &last[w->ev[i].nr & (TRACE_NR_SLOTS - 1)][a];
+			p = trace_put_varint(p, trace_zigzag((int64_t)(w->ev[i].args[a] - *l)));
+			*l = w->ev[i].args[a];
+		}
+		h.col_bytes[TRACE_COL_ARG0 + a] = p - col[TRACE_COL_ARG0 + a];
+	}
+
+	// RET
+	p = col[TRACE_COL_RET];
+	if (h.present & TRACE_COL(TRACE_COL_RET)) {
+		for (i = 0; i < w->n; i++)
+			p = trace_put_varint(p, (w->ev[i].flags & TRACE_EV_RET) ? trace_zigzag(w->ev[i].ret) + 1 : 0);
+	}
+	h.col_bytes[TRACE_COL_RET] = p - col[TRACE_COL_RET];
+
+	// DUR
+	p = col[TRACE_COL_DUR];
+	if (h.present & TRACE_COL(TRACE_COL_DUR)) {
+		for (i = 0; i < w->n; i++)
+			p = trace_put_varint(p, (w->ev[i].flags & TRACE_EV_DUR) ? w->ev[i].dur + 1 : 0);
+	}
+	h.col_bytes[TRACE_COL_DUR] = p - col[TRACE_COL_DUR];
+
+	// Offsets are relative to the first block until the segment is written
+	w->idx[w->seg.nblocks].offset = w->seglen;
+	w->idx[w->seg.nblocks].nevents = w->n;
+	if ((status = seg_append(w, &h, sizeof(h))) != 0)
+		goto out;
+	for (c = 0; c < TRACE_NCOLS; c++) {
+		if ((status = seg_append(w, col[c], h.col_bytes[c])) != 0)
+			goto out;
+	}
+	w->idx[w->seg.nblocks].bytes = w->seglen - w->idx[w->seg.nblocks].offset;
+
+	w->seg.nblocks++;
+	w->seg.nevents += w->n;
+	w->nblocks++;
+	w->n = 0;
+
+	if (w->seg.nblocks == TRACE_SEGMENT_BLOCKS)
+		status = write_segment(w);
+
+out:
+	for (c = 0; c < TRACE_NCOLS; c++)
+		free(col[c]);
+	free(last);
+	free(dict);
+	return status;
+}
+
+int trace_writer_close(struct trace_writer *w) {
+
+	int status = trace_writer_flush(w);
+
+	if (status == 0)
+		status = write_segment(w);
+	if (fflush(w->fp) != 0 && status == 0)
+		status = -EIO;
+
+	free(w->segbuf);
+	free(w->segpids);
+	w->segbuf = NULL;
+	w->segpids = NULL;
+	w->segcap = w->segpidcap = 0;
+	return status;
+}
+//------------------------------------------------------------------
+
+
+//----- Reader -----------------------------------------------------
+
+int trace_read_header(FILE *fp, struct trace_file_header *h) {
+
+	if (fread(h, sizeof(*h), 1, fp) != 1)
+		return -EIO;
+	if (h->magic != TRACE_MAGIC || h->version != TRACE_VERSION)
+		return -EINVAL;
+	return 0;
+}
+
+/**
+ * Decode the pid dictionary and block index that follow a segment header.
+ * s->hdr must already be filled in; data holds len bytes following it.
+ */
+int trace_segment_decode(struct trace_segment *s, const unsigned char *data, size_t len) {
+
+	const unsigned char *p = data, *end;
+	uint64_t v;
+	uint32_t i, pid = 0;
+	size_t need;
+
+	if (s->hdr.magic != TRACE_SEGMENT_MAGIC || s->hdr.nblocks > TRACE_SEGMENT_BLOCKS)
+		return -EINVAL;
+	need = (size_t)s->hdr.dict_bytes + s->hdr.nblocks * sizeof(*s->index);
+	if (len < need)
+		return -EINVAL;
+
+	free(s->pids);
+	free(s->index);
+	s->pids = malloc(((size_t)s->hdr.npids + 1) * sizeof(*s->pids));
+	s->index = malloc(((size_t)s->hdr.nblocks + 1) * sizeof(*s->index));
+	if (!s->pids || !s->index)
+		return -ENOMEM;
+
+	end = p + s->hdr.dict_bytes;
+	for (i = 0; i < s->hdr.npids; i++) {
+		if (!(p = trace_get_varint(p, end, &v)))
+			return -EINVAL;
+		pid += (uint32_t)v;
+		s->pids[i] = pid;
+	}
+	memcpy(s->index, end, s->hdr.nblocks * sizeof(*s->index));
+	return 0;
+}
+
+/**
+ * Read the segment header, pid dictionary and block index at the current
+ * position of fp, leaving fp at the segment's first block.
+ * Returns 1 if a segment was read, 0 at end of file, or a negative errno.
+ */
+int trace_segment_read(FILE *fp, struct trace_segment *s) {
+
+	unsigned char *buf;
+	size_t len;
+	int status;
+
+	s->offset = ftell(fp);
+	if (fread(&s->hdr, sizeof(s->hdr), 1, fp) != 1)
+		return 0;
+	if (s->hdr.magic != TRACE_SEGMENT_MAGIC || s->hdr.nblocks > TRACE_SEGMENT_BLOCKS)
+		return -EINVAL;
+
+	len = (size_t)s->hdr.dict_bytes + s->hdr.nblocks * sizeof(*s->index);
+	if (!(buf = malloc(len + 1)))
+		return -ENOMEM;
+	if (len && fread(buf, len, 1, fp) != 1) {
+		free(buf);
+		return -EIO;
+	}
+	status = trace_segment_decode(s, buf, len);
+	free(buf);
+	return status ? status : 1;
+}
+
+int trace_segment_has_pid(const struct trace_segment *s, uint32_t pid) {
+
+	uint32_t lo = 0, hi = s->hdr.npids;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (s->pids[mid] < pid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < s->hdr.npids && s->pids[lo] == pid;
+}
+
+int trace_segment_has_nr(const struct trace_segment *s, uint16_t nr) {
+
+	return (s->hdr.nr_mask[(nr & (TRACE_NR_SLOTS - 1)) / 64] >> (nr % 64)) & 1;
+}
+
+void trace_segment_free(struct trace_segment *s) {
+
+	free(s->pids);
+	free(s->index);
+	s->pids = NULL;
+	s->index = NULL;
+}
+
+/**
+ * Allocate the decoded arrays for a block of n events.
+ * Arrays for columns not in cols are left NULL.
+ */
+static int block_alloc(struct trace_block *b, uint32_t cols) {
+
+	uint32_t n = b->hdr.nevents;
+	size_t sz = 0;
+	unsigned char *m;
+	int a;
+
+	// Every array is 8-byte aligned because they are laid out by decreasing element size
+	sz += (cols & TRACE_COL(TRACE_COL_TS)) ? n * 8 : 0;
+	sz += (cols & TRACE_COL(TRACE_COL_RET)) ? n * 8 : 0;
+	sz += (cols & TRACE_COL(TRACE_COL_DUR)) ? n * 8 : 0;
+	for (a = 0; a < TRACE_NARGS; a++)
+		sz += (cols & TRACE_COL(TRACE_COL_ARG0 + a)) ? n * 8 : 0;
+	sz += (cols & TRACE_COL(TRACE_COL_PID)) ? b->hdr.npids * 4 + n * 2 : 0;
+	sz += (cols & TRACE_COL(TRACE_COL_NR)) ? n * 2 : 0;
+	sz += n * 2;
+
+	free(b->mem);
+	b->mem = m = malloc(sz ? sz : 1);
+	if (!m)
+		return -ENOMEM;
+
+	b->ts = NULL;
+	b->ret = NULL;
+	b->dur = NULL;
+	b->pids = NULL;
+	b->pid_idx = NULL;
+	b->nr = NULL;
+	b->flags = NULL;
+	for (a = 0; a < TRACE_NARGS; a++)
+		b->args[a] = NULL;
+
+	if (cols & TRACE_COL(TRACE_COL_TS)) {
+		b->ts = (uint64_t *)m;
+		m += n * 8;
+	}
+	if (cols & TRACE_COL(TRACE_COL_RET)) {
+		b->ret = (int64_t *)m;
+		m += n * 8;
+	}
+	if (cols & TRACE_COL(TRACE_COL_DUR)) {
+		b->dur = (uint64_t *)m;
+		m += n * 8;
+	}
+	for (a = 0; a < TRACE_NARGS; a++) {
+		if (cols & TRACE_COL(TRACE_COL_ARG0 + a)) {
+			b->args[a] = (uint64_t *)m;
+			m += n * 8;
+		}
+	}
+	if (cols & TRACE_COL(TRACE_COL_PID)) {
+		b->pids = (uint32_t *)m;
+		m += b->hdr.npids * 4;
+		b->pid_idx = (uint16_t *)m;
+		m += n * 2;
+	}
+	if (cols & TRACE_COL(TRACE_COL_NR)) {
+		b->nr = (uint16_t *)m;
+		m += n * 2;
+	}
+	b->flags = (uint16_t *)m;
+	memset(b->flags, 0, n * 2);
+
+	return 0;
+}
+
+static int decode_varints(const unsigned char *p, uint32_t len, uint32_t n, uint64_t *out) {
+
+	const unsigned char *end = p + len;
+	uint32_t i;
+
+	for (i = 0; i < n; i++) {
+		p = trace_get_varint(p, end, &out[i]);
+		if (!p)
+			return -EINVAL;
+	}
+	return 0;
+}
+
+/**
+ * Decode the requested columns. col[c] points to the encoded bytes of
+ * column c; entries for columns that are not requested may be NULL.
+ * Argument columns need the syscall column to undo prediction, so NR is
+ * decoded whenever any argument is requested.
+ */
+static int decode_columns(struct trace_block *b, const unsigned char **col, uint32_t cols) {
+
+	struct trace_block_header *h = &b->hdr;
+	uint32_t n = h->nevents, i;
+	uint64_t *last = NULL;
+	int a, status;
+
+	if (cols & TRACE_COL_ARGS)
+		cols |= TRACE_COL(TRACE_COL_NR);
+	// Columns the block does not carry are decoded as zeroes
+	status = block_alloc(b, cols);
+	if (status)
+		return status;
+
+	if (b->ts) {
+		if (h->present & TRACE_COL(TRACE_COL_TS)) {
+			uint64_t ts = h->ts_base;
+			if (decode_varints(col[TRACE_COL_TS], h->col_bytes[TRACE_COL_TS], n, b->ts))
+				return -EINVAL;
+			for (i = 0; i < n; i++) {
+				ts += trace_unzigzag(b->ts[i]);
+				b->ts[i] = ts;
+				b->flags[i] |= TRACE_EV_TS;
+			}
+		} else {
+			memset(b->ts, 0, n * sizeof(*b->ts));
+		}
+	}
+
+	if (b->pids) {
+		const unsigned char *p = col[TRACE_COL_PID];
+		const unsigned char *end = p + h->col_bytes[TRACE_COL_PID];
+		uint64_t v;
+		uint32_t pid = 0;
+
+		for (i = 0; i < h->npids; i++) {
+			p = trace_get_varint(p, end, &v);
+			if (!p)
+				return -EINVAL;
+			pid += (uint32_t)v;
+			b->pids[i] = pid;
+		}
+		if ((size_t)(end - p) != (size_t)n * 2)
+			return -EINVAL;
+		memcpy(b->pid_idx, p, n * 2);
+		// Every index must land in the block's pid table
+		for (i = 0; i < n; i++) {
+			if (b->pid_idx[i] >= h->npids)
+				return -EINVAL;
+		}
+	}
+
+	if (b->nr) {
+		if (h->col_bytes[TRACE_COL_NR] != n * 2)
+			return -EINVAL;
+		memcpy(b->nr, col[TRACE_COL_NR], n * 2);
+	}
+
+	for (a = 0; a < TRACE_NARGS; a++) {
+		uint64_t *v = b->args[a];
+		if (!v)
+			continue;
+		if (!last) {
+			last = calloc(TRACE_NR_SLOTS, sizeof(*last));
+			if (!last)
+				return -ENOMEM;
+		}
+		memset(last, 0, TRACE_NR_SLOTS * sizeof(*last));
+		if (decode_varints(col[TRACE_COL_ARG0 + a], h->col_bytes[TRACE_COL_ARG0 + a], n, v)) {
+			free(last);
+			return -EINVAL;
+		}
+		for (i = 0; i < n; i++) {
+			uint64_t *l = &last[b->nr[i] & (TRACE_NR_SLOTS - 1)];
+			v[i] = *l + (uint64_t)trace_unzigzag(v[i]);
+			*l = v[i];
+		}
+	}
+	free(last);
+
+	if (b->ret) {
+		if (h->present & TRACE_COL(TRACE_COL_RET)) {
+			if (decode_varints(col[TRACE_COL_RET], h->col_bytes[TRACE_COL_RET], n, (uint64_t *)b->ret))
+				return -EINVAL;
+			for (i = 0; i < n; i++) {
+				uint64_t v = (uint64_t)b->ret[i];
+				b->ret[i] = v ? trace_unzigzag(v - 1) : 0;
+				b->flags[i] |= v ? TRACE_EV_RET : 0;
+			}
+		} else {
+			memset(b->ret, 0, n * sizeof(*b->ret));
+		}
+	}
+
+	if (b->dur) {
+		if (h->present & TRACE_COL(TRACE_COL_DUR)) {
+			if (decode_varints(col[TRACE_COL_DUR], h->col_bytes[TRACE_COL_DUR], n, b->dur))
+				return -EINVAL;
+			for (i = 0; i < n; i++) {
+				b->flags[i] |= b->dur[i] ? TRACE_EV_DUR : 0;
+				b->dur[i] -= b->dur[i] != 0;
+			}
+		} else {
+			memset(b->dur, 0, n * sizeof(*b->dur));
+		}
+	}
+
+	return 0;
+}
+
+static int check_block_header(const struct trace_block_header *h) {
+
+	if (h->magic != TRACE_BLOCK_MAGIC || h->nevents > TRACE_BLOCK_EVENTS ||
+	    h->npids > h->nevents)
+		return -EINVAL;
+	return 0;
+}
+
+/**
+ * Decode a block whose header has already been copied into b->hdr and
+ * whose columns follow contiguously at data.
+ */
+int trace_block_decode(struct trace_block *b, const unsigned char *data, uint32_t cols) {
+
+	const unsigned char *col[TRACE_NCOLS];
+	int c;
+
+	if (check_block_header(&b->hdr))
+		return -EINVAL;
+	for (c = 0; c < TRACE_NCOLS; c++) {
+		col[c] = data;
+		data += b->hdr.col_bytes[c];
+	}
+	return decode_columns(b, col, cols);
+}
+
+/**
+ * Read the next block from fp, decoding only the columns in cols.
+ * Unwanted columns are skipped without being read.
+ * Returns 1 if a block was read, 0 at end of file, or a negative errno.
+ */
+int trace_block_read(FILE *fp, struct trace_block *b, uint32_t cols) {
+
+	const unsigned char *col[TRACE_NCOLS];
+	uint32_t need = cols, off[TRACE_NCOLS];
+	size_t total = 0;
+	int c;
+
+	if (fread(&b->hdr, sizeof(b->hdr), 1, fp) != 1)
+		return 0;
+	if (check_block_header(&b->hdr))
+		return -EINVAL;
+
+	if (need & TRACE_COL_ARGS)
+		need |= TRACE_COL(TRACE_COL_NR);
+	for (c = 0; c < TRACE_NCOLS; c++) {
+		if (need & TRACE_COL(c))
+			total += b->hdr.col_bytes[c];
+	}
+	if (total > b->rawcap) {
+		unsigned char *raw = realloc(b->raw, total);
+		if (!raw)
+			return -ENOMEM;
+		b->raw = raw;
+		b->rawcap = total;
+	}
+
+	total = 0;
+	for (c = 0; c < TRACE_NCOLS; c++) {
+		uint32_t len = b->hdr.col_bytes[c];
+		col[c] = NULL;
+		off[c] = total;
+		if (!(need & TRACE_COL(c))) {
+			if (len && fseek(fp, len, SEEK_CUR) != 0)
+				return -EIO;
+			continue;
+		}
+		if (len && fread(b->raw + total, len, 1, fp) != 1)
+			return -EIO;
+		total += len;
+	}
+	for (c = 0; c < TRACE_NCOLS; c++) {
+		if (need & TRACE_COL(c))
+			col[c] = b->raw + off[c];
+	}
+
+	return decode_columns(b, col, cols) ? -EINVAL : 1;
+}
+
+void trace_block_free(struct trace_block *b) {
+
+	free(b->raw);
+	free(b->mem);
+	b->raw = NULL;
+	b->mem = NULL;
+	b->rawcap = 0;
+}
+//------------------------------------------------------------------
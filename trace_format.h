@@ -0,0 +1,243 @@
+#ifndef _TRACE_FORMAT_H
+#define _TRACE_FORMAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * On-disk trace format written by the collector.
+ *
+ * A trace file is a trace_file_header followed by a sequence of segments.
+ * Each segment is self-contained and can be decoded independently of the
+ * rest of the file, so segments can be processed in parallel:
+ *
+ *   trace_segment_header
+ *   pid dictionary - every pid in the segment, ascending varint deltas
+ *   block index    - one trace_block_index per block
+ *   blocks
+ *
+ * The segment header carries the segment's total length, so the segments
+ * of a file can be listed by hopping from header to header, and a bitmap
+ * of the syscalls it contains, so that together with the pid dictionary a
+ * query can skip segments that cannot match.
+ *
+ * Each block holds up to TRACE_BLOCK_EVENTS events stored column by column
+ * (struct-of-arrays), so that a scan only has to read the columns it needs:
+ *
+ *   trace_block_header
+ *   TS    - zigzag varint deltas from hdr.ts_base (ns)
+ *   PID   - pid dictionary (npids ascending varint deltas), then one
+ *           uint16_t dictionary index per event
+ *   NR    - one uint16_t syscall number per event
+ *   ARG0..ARG5 - zigzag varint deltas from the same argument of the
+ *           previous event with the same syscall number in this block
+ *   RET   - varint of zigzag(return value) + 1, 0 for an event without one
+ *   DUR   - varint of syscall duration (ns) + 1, 0 for an event without one
+ *
+ * Every column's byte length is recorded in the block header, so columns
+ * that are not wanted can be skipped with a single seek. Optional columns
+ * (TS, RET, DUR) that no event in the block carries have zero length and
+ * their bit cleared in hdr.present. A block can mix calls that returned
+ * with calls that did not, so RET and DUR record presence per event. All
+ * prediction state is reset at the start of a block, so blocks can be
+ * decoded independently.
+ *
+ * Multi-byte header fields are stored in host (little-endian) byte order.
+ */
+
+#define TRACE_MAGIC             0x43525449      /* "ITRC" */
+#define TRACE_BLOCK_MAGIC       0x304b4c42      /* "BLK0" */
+#define TRACE_SEGMENT_MAGIC     0x30474553      /* "SEG0" */
+#define TRACE_VERSION           3
+
+#define TRACE_BLOCK_EVENTS      4096
+#define TRACE_SEGMENT_BLOCKS    64
+#define TRACE_NARGS             6
+/* Size of the per-syscall argument prediction table (power of 2) */
+#define TRACE_NR_SLOTS          1024
+
+enum trace_column {
+	TRACE_COL_TS = 0,
+	TRACE_COL_PID,
+	TRACE_COL_NR,
+	TRACE_COL_ARG0,
+	TRACE_COL_ARG1,
+	TRACE_COL_ARG2,
+	TRACE_COL_ARG3,
+	TRACE_COL_ARG4,
+	TRACE_COL_ARG5,
+	TRACE_COL_RET,
+	TRACE_COL_DUR,
+	TRACE_NCOLS
+};
+
+#define TRACE_COL(c)            (1u << (c))
+#define TRACE_COL_ARGS          (0x3fu << TRACE_COL_ARG0)
+#define TRACE_COL_ALL           ((1u << TRACE_NCOLS) - 1)
+
+/* Per-event flags: which of the optional fields carry data */
+#define TRACE_EV_TS             0x1
+#define TRACE_EV_RET            0x2
+#define TRACE_EV_DUR            0x4
+
+struct trace_file_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t flags;
+	uint32_t block_events;
+	uint32_t reserved;
+};
+
+struct trace_segment_header {
+	uint32_t magic;
+	uint32_t nblocks;
+	uint64_t nevents;
+	/* Total length of the segment, including this header */
+	uint64_t bytes;
+	/* Range of event timestamps, 0 if the segment has none */
+	uint64_t ts_min;
+	uint64_t ts_max;
+	uint32_t npids;
+	uint32_t dict_bytes;
+	/* Bit (nr & (TRACE_NR_SLOTS - 1)) set if the segment has syscall nr */
+	uint64_t nr_mask[TRACE_NR_SLOTS / 64];
+};
+
+struct trace_block_index {
+	/* Offset of the block from the start of its segment */
+	uint64_t offset;
+	uint32_t nevents;
+	uint32_t bytes;
+};
+
+struct trace_block_header {
+	uint32_t magic;
+	uint32_t nevents;
+	uint32_t npids;
+	/* Bitmask of TRACE_COL() for columns that carry data */
+	uint32_t present;
+	uint64_t ts_base;
+	uint32_t col_bytes[TRACE_NCOLS];
+	uint32_t reserved;
+};
+
+/* A single decoded (or to-be-encoded) event */
+struct trace_event {
+	uint64_t ts;
+	uint64_t dur;
+	int64_t ret;
+	uint64_t args[TRACE_NARGS];
+	uint32_t pid;
+	uint16_t nr;
+	uint16_t flags;
+};
+
+/**
+ * A decoded block. Only the columns requested from trace_block_read()
+ * are filled in; the others are left NULL. flags holds the TRACE_EV_*
+ * bits of each event for the optional columns that were requested.
+ */
+struct trace_block {
+	struct trace_block_header hdr;
+	uint64_t *ts;
+	uint32_t *pids;
+	uint16_t *pid_idx;
+	uint16_t *nr;
+	uint64_t *args[TRACE_NARGS];
+	int64_t *ret;
+	uint64_t *dur;
+	uint16_t *flags;
+
+	/* Backing storage, reused between calls */
+	unsigned char *raw;
+	size_t rawcap;
+	void *mem;
+};
+
+/* A segment header with its decoded pid dictionary and block index */
+struct trace_segment {
+	struct trace_segment_header hdr;
+	uint32_t *pids;
+	struct trace_block_index *index;
+	/* File offset of the segment header */
+	long offset;
+};
+
+struct trace_writer {
+	FILE *fp;
+	uint32_t n;
+	uint64_t nblocks;
+	uint64_t nsegments;
+	uint64_t bytes;
+	struct trace_event ev[TRACE_BLOCK_EVENTS];
+
+	/* Encoded blocks of the segment being built */
+	struct trace_segment_header seg;
+	struct trace_block_index idx[TRACE_SEGMENT_BLOCKS];
+	unsigned char *segbuf;
+	size_t seglen, segcap;
+	uint32_t *segpids;
+	uint32_t segpidcap;
+};
+
+//----- Varint helpers ---------------------------------------------
+static inline uint64_t trace_zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t trace_unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static inline unsigned char *trace_put_varint(unsigned char *p, uint64_t v) {
+	while (v >= 0x80) {
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+	return p;
+}
+
+/* Returns NULL if the varint runs past end */
+static inline const unsigned char *trace_get_varint(const unsigned char *p,
+		const unsigned char *end, uint64_t *v) {
+	uint64_t r = 0;
+	int shift = 0;
+
+	while (p < end && shift < 64) {
+		unsigned char c = *p++;
+		r |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80)) {
+			*v = r;
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+//------------------------------------------------------------------
+
+int trace_writer_open(struct trace_writer *w, FILE *fp);
+int trace_writer_add(struct trace_writer *w, const struct trace_event *ev);
+int trace_writer_flush(struct trace_writer *w);
+int trace_writer_close(struct trace_writer *w);
+
+int trace_read_header(FILE *fp, struct trace_file_header *h);
+int trace_segment_read(FILE *fp, struct trace_segment *s);
+int trace_segment_decode(struct trace_segment *s, const unsigned char *data, size_t len);
+int trace_segment_has_pid(const struct trace_segment *s, uint32_t pid);
+int trace_segment_has_nr(const struct trace_segment *s, uint16_t nr);
+void trace_segment_free(struct trace_segment *s);
+int trace_block_read(FILE *fp, struct trace_block *b, uint32_t cols);
+int trace_block_decode(struct trace_block *b, const unsigned char *data, uint32_t cols);
+void trace_block_free(struct trace_block *b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRACE_FORMAT_H */
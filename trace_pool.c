@@ -0,0 +1,138 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "trace_pool.h"
+
+/* Tasks are never added after the start, so an empty deque stays empty */
+struct deque {
+	pthread_mutex_t lock;
+	int top, bottom;
+	int *tasks;
+};
+
+struct pool {
+	int nworkers;
+	struct deque *q;
+	trace_task_fn fn;
+	void *arg;
+};
+
+struct worker {
+	struct pool *pool;
+	int id;
+};
+
+int trace_pool_cpus(void) {
+
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+}
+
+/* Owner end: tasks run in order, so a single worker preserves task order */
+static int pop_top(struct deque *d, int *task) {
+
+	int ok = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->bottom > d->top) {
+		*task = d->tasks[d->top++];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return ok;
+}
+
+/* Thief end: take the task furthest from where the owner is working */
+static int steal_bottom(struct deque *d, int *task) {
+
+	int ok = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->bottom > d->top) {
+		*task = d->tasks[--d->bottom];
+		ok = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return ok;
+}
+
+static void *worker_main(void *p) {
+
+	struct worker *w = p;
+	struct pool *pool = w->pool;
+	int task = 0, v;
+
+	for (;;) {
+		if (pop_top(&pool->q[w->id], &task)) {
+			pool->fn(pool->arg, w->id, task);
+			continue;
+		}
+		for (v = 1; v < pool->nworkers; v++) {
+			if (steal_bottom(&pool->q[(w->id + v) % pool->nworkers], &task))
+				break;
+		}
+		if (v == pool->nworkers)
+			break;
+		pool->fn(pool->arg, w->id, task);
+	}
+	return NULL;
+}
+
+int trace_pool_run(int nworkers, int ntasks, trace_task_fn fn, void *arg) {
+
+	struct pool pool;
+	struct worker *workers;
+	pthread_t *threads;
+	int *tasks, i, t, started = 0, status = 0;
+
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > ntasks)
+		nworkers = ntasks > 0 ? ntasks : 1;
+
+	pool.nworkers = nworkers;
+	pool.fn = fn;
+	pool.arg = arg;
+	pool.q = calloc(nworkers, sizeof(*pool.q));
+	workers = calloc(nworkers, sizeof(*workers));
+	threads = calloc(nworkers, sizeof(*threads));
+	tasks = malloc((ntasks + 1) * sizeof(*tasks));
+	if (!pool.q || !workers || !threads || !tasks) {
+		status = -ENOMEM;
+		goto out;
+	}
+
+	// Deal contiguous runs; each deque points into the shared task array
+	for (t = 0; t < ntasks; t++)
+		tasks[t] = t;
+	for (i = 0; i < nworkers; i++) {
+		pthread_mutex_init(&pool.q[i].lock, NULL);
+		pool.q[i].tasks = tasks;
+		pool.q[i].top = (int)((long)ntasks * i / nworkers);
+		pool.q[i].bottom = (int)((long)ntasks * (i + 1) / nworkers);
+		workers[i].pool = &pool;
+		workers[i].id = i;
+	}
+
+	// The calling thread acts as worker 0
+	for (i = 1; i < nworkers; i++) {
+		if (pthread_create(&threads[i], NULL, worker_main, &workers[i]) != 0) {
+			status = -EAGAIN;
+			break;
+		}
+		started = i;
+	}
+	worker_main(&workers[0]);
+	for (i = 1; i <= started; i++)
+		pthread_join(threads[i], NULL);
+	for (i = 0; i < nworkers; i++)
+		pthread_mutex_destroy(&pool.q[i].lock);
+
+out:
+	free(tasks);
+	free(threads);
+	free(workers);
+	free(pool.q);
+	return status;
+}
@@ -0,0 +1,25 @@
+#ifndef _TRACE_POOL_H
+#define _TRACE_POOL_H
+
+/**
+ * Work-stealing thread pool for running a fixed set of independent tasks
+ * (e.g. one per trace segment).
+ *
+ * Tasks are dealt out to per-worker deques in contiguous runs. A worker
+ * takes tasks from the top of its own deque and, once that is empty,
+ * steals from the bottom of the others', so uneven segments still keep
+ * every thread busy. With one worker, tasks run in order.
+ */
+
+typedef void (*trace_task_fn)(void *arg, int worker, int task);
+
+/* Default number of workers: the number of online CPUs */
+int trace_pool_cpus(void);
+
+/**
+ * Run fn(arg, worker, task) for every task in [0, ntasks) on nworkers
+ * threads, and wait for them all to finish. Returns 0 or a negative errno.
+ */
+int trace_pool_run(int nworkers, int ntasks, trace_task_fn fn, void *arg);
+
+#endif /* _TRACE_POOL_H */
@@ -0,0 +1,318 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "trace_format.h"
+#include "trace_scan.h"
+#include "trace_agg.h"
+#include "trace_pool.h"
+
+/**
+ * Trace query tool.
+ *
+ * Usage: ./trace_query [-p pid]... [-s syscall]... [-c | -a] [-j threads] [-n top] file.trc
+ *   -p  select events of this pid (may be repeated)
+ *   -s  select events of this syscall number (may be repeated)
+ *   -c  only print the number of selected events
+ *   -a  print per-syscall counts and latency percentiles, and the
+ *       busiest pids, for the selected events
+ *   -j  number of worker threads for -c/-a (default: all CPUs)
+ *   -n  number of pids to list with -a (default 20)
+ *
+ * Without -c or -a, selected events are printed in file order in the
+ * log_message format. Counting and aggregation run over the trace's
+ * segments in parallel, and segments whose pid dictionary or syscall
+ * bitmap rule out the filter are skipped without reading their blocks.
+ */
+
+#define MAX_FILTER 64
+
+enum mode { MODE_PRINT, MODE_COUNT, MODE_AGG };
+
+struct query {
+	const char *path;
+	enum mode mode;
+	struct trace_filter f;
+	uint32_t cols;
+	long *segments;
+	int nsegments;
+	int nworkers;
+	/* Per-worker state */
+	FILE **fp;
+	struct trace_block *b;
+	struct trace_segment *s;
+	struct trace_agg *agg;
+	unsigned long long *selected;
+	unsigned long long *total;
+	int *failed;
+};
+
+static void print_event(const struct trace_block *b, uint32_t i) {
+
+	printf("[%x]%x(%llx,%llx,%llx,%llx,%llx,%llx)\n",
+		b->pids[b->pid_idx[i]], b->nr[i],
+		(unsigned long long)b->args[0][i], (unsigned long long)b->args[1][i],
+		(unsigned long long)b->args[2][i], (unsigned long long)b->args[3][i],
+		(unsigned long long)b->args[4][i], (unsigned long long)b->args[5][i]);
+}
+
+/**
+ * List the file offsets of all segments by hopping between headers.
+ * Returns how many there are, or a negative errno.
+ */
+static int list_segments(FILE *fp, long **out) {
+
+	struct trace_segment_header h;
+	long off = ftell(fp), *segs = NULL, *grown;
+	int n = 0, cap = 0;
+
+	while (fseek(fp, off, SEEK_SET) == 0 && fread(&h, sizeof(h), 1, fp) == 1) {
+		if (h.magic != TRACE_SEGMENT_MAGIC || h.bytes < sizeof(h)) {
+			free(segs);
+			return -EINVAL;
+		}
+		if (n == cap) {
+			cap = cap ? cap * 2 : 64;
+			if (!(grown = realloc(segs, cap * sizeof(*segs)))) {
+				free(segs);
+				return -ENOMEM;
+			}
+			segs = grown;
+		}
+		segs[n++] = off;
+		off += h.bytes;
+	}
+	*out = segs;
+	return n;
+}
+
+/* Can segment s contain events selected by f? */
+static int segment_matches(const struct trace_segment *s, const struct trace_filter *f) {
+
+	int i, ok;
+
+	for (i = 0, ok = !f->npids; i < f->npids && !ok; i++)
+		ok = trace_segment_has_pid(s, f->pids[i]);
+	if (!ok)
+		return 0;
+	for (i = 0, ok = !f->nnrs; i < f->nnrs && !ok; i++)
+		ok = trace_segment_has_nr(s, f->nrs[i]);
+	return ok;
+}
+
+/**
+ * Process one segment on worker w.
+ */
+static void run_segment(void *arg, int w, int task) {
+
+	struct query *q = arg;
+	struct trace_block *b = &q->b[w];
+	struct trace_segment *s = &q->s[w];
+	trace_bitmap bm;
+	uint32_t k, i, n;
+	int status;
+
+	if (!q->fp[w] && !(q->fp[w] = fopen(q->path, "rb"))) {
+		q->failed[w] = 1;
+		return;
+	}
+	if (fseek(q->fp[w], q->segments[task], SEEK_SET) != 0 ||
+	    trace_segment_read(q->fp[w], s) != 1) {
+		q->failed[w] = 1;
+		return;
+	}
+	q->total[w] += s->hdr.nevents;
+	if (!segment_matches(s, &q->f))
+		return;
+
+	for (k = 0; k < s->hdr.nblocks; k++) {
+		if ((status = trace_block_read(q->fp[w], b, q->cols)) != 1) {
+			q->failed[w] = 1;
+			return;
+		}
+		n = trace_scan_block(b, &q->f, bm);
+		q->selected[w] += n;
+		if (q->mode == MODE_COUNT || n == 0)
+			continue;
+
+		for (i = 0; i < b->hdr.nevents; i++) {
+			if (!trace_bitmap_test(bm, i))
+				continue;
+			if (q->mode == MODE_PRINT)
+				print_event(b, i);
+			else if (trace_agg_add(&q->agg[w], b->pids[b->pid_idx[i]], b->nr[i], b->dur[i],
+					       (b->flags[i] & TRACE_EV_DUR) != 0))
+				q->failed[w] = 1;
+		}
+	}
+}
+
+static const struct trace_agg_pid *pid_sort_base;
+
+static int cmp_pid_count(const void *a, const void *b) {
+	uint64_t x = pid_sort_base[*(const uint32_t *)a].count;
+	uint64_t y = pid_sort_base[*(const uint32_t *)b].count;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_report(const struct trace_agg *a, int top) {
+
+	uint32_t *order, i, n = 0;
+	int s;
+
+	printf("%-8s %12s %12s %12s %12s %12s\n", "syscall", "count", "total_ns", "p50_ns", "p99_ns", "max_ns");
+	for (s = 0; s < TRACE_NR_SLOTS; s++) {
+		const struct trace_agg_sys *e = &a->sys[s];
+		if (!e->count)
+			continue;
+		printf("%-8d %12llu %12llu %12llu %12llu %12llu\n", s,
+			(unsigned long long)e->count, (unsigned long long)e->total_ns,
+			(unsigned long long)trace_agg_percentile(e, 0.50),
+			(unsigned long long)trace_agg_percentile(e, 0.99),
+			(unsigned long long)e->max_ns);
+	}
+
+	if (!(order = malloc((a->npids + 1) * sizeof(*order))))
+		return;
+	for (i = 0; i < a->pidcap; i++) {
+		if (a->pids[i].used)
+			order[n++] = i;
+	}
+	pid_sort_base = a->pids;
+	qsort(order, n, sizeof(*order), cmp_pid_count);
+
+	printf("\n%-8s %12s %12s\n", "pid", "count", "total_ns");
+	for (i = 0; i < n && (int)i < top; i++) {
+		const struct trace_agg_pid *p = &a->pids[order[i]];
+		printf("%-8x %12llu %12llu\n", p->pid,
+			(unsigned long long)p->count, (unsigned long long)p->total_ns);
+	}
+	free(order);
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-p pid]... [-s syscall]... [-c | -a] [-j threads] [-n top] file.trc\n", prog);
+}
+
+int main(int argc, char **argv) {
+
+	uint32_t pids[MAX_FILTER];
+	uint16_t nrs[MAX_FILTER];
+	struct query q;
+	struct trace_file_header h;
+	unsigned long long total = 0, selected = 0;
+	int opt, i, top = 20, failed = 0;
+	FILE *fp;
+
+	memset(&q, 0, sizeof(q));
+	q.f.pids = pids;
+	q.f.nrs = nrs;
+	q.mode = MODE_PRINT;
+	q.nworkers = trace_pool_cpus();
+
+	while ((opt = getopt(argc, argv, "p:s:caj:n:")) != -1) {
+		switch (opt) {
+			case 'p':
+				if (q.f.npids < MAX_FILTER)
+					pids[q.f.npids++] = strtoul(optarg, NULL, 0);
+				break;
+			case 's':
+				if (q.f.nnrs < MAX_FILTER)
+					nrs[q.f.nnrs++] = strtoul(optarg, NULL, 0);
+				break;
+			case 'c':
+				q.mode = MODE_COUNT;
+				break;
+			case 'a':
+				q.mode = MODE_AGG;
+				break;
+			case 'j':
+				q.nworkers = atoi(optarg);
+				break;
+			case 'n':
+				top = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	q.path = argv[optind];
+
+	if (!(fp = fopen(q.path, "rb"))) {
+		perror(q.path);
+		return 1;
+	}
+	if (trace_read_header(fp, &h) != 0 || (q.nsegments = list_segments(fp, &q.segments)) < 0) {
+		fprintf(stderr, "%s: not a trace file\n", q.path);
+		return 1;
+	}
+	fclose(fp);
+
+	q.cols = trace_filter_columns(&q.f);
+	if (q.mode == MODE_PRINT)
+		q.cols |= TRACE_COL(TRACE_COL_PID) | TRACE_COL(TRACE_COL_NR) | TRACE_COL_ARGS;
+	if (q.mode == MODE_AGG)
+		q.cols |= TRACE_COL(TRACE_COL_PID) | TRACE_COL(TRACE_COL_NR) | TRACE_COL(TRACE_COL_DUR);
+	// Printing must keep file order
+	if (q.mode == MODE_PRINT || q.nworkers < 1)
+		q.nworkers = 1;
+
+	q.fp = calloc(q.nworkers, sizeof(*q.fp));
+	q.b = calloc(q.nworkers, sizeof(*q.b));
+	q.s = calloc(q.nworkers, sizeof(*q.s));
+	q.agg = calloc(q.nworkers, sizeof(*q.agg));
+	q.selected = calloc(q.nworkers, sizeof(*q.selected));
+	q.total = calloc(q.nworkers, sizeof(*q.total));
+	q.failed = calloc(q.nworkers, sizeof(*q.failed));
+	if (!q.fp || !q.b || !q.s || !q.agg || !q.selected || !q.total || !q.failed) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < q.nworkers; i++) {
+		if (q.mode == MODE_AGG && trace_agg_init(&q.agg[i]) != 0) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+	}
+
+	if (trace_pool_run(q.nworkers, q.nsegments, run_segment, &q) != 0) {
+		fprintf(stderr, "cannot start worker threads\n");
+		return 1;
+	}
+
+	// Merge the partial results into worker 0's
+	for (i = 0; i < q.nworkers; i++) {
+		total += q.total[i];
+		selected += q.selected[i];
+		failed |= q.failed[i];
+		if (q.mode == MODE_AGG && i > 0 && trace_agg_merge(&q.agg[0], &q.agg[i]) != 0)
+			failed = 1;
+		if (q.fp[i])
+			fclose(q.fp[i]);
+		trace_block_free(&q.b[i]);
+		trace_segment_free(&q.s[i]);
+	}
+	if (failed) {
+		fprintf(stderr, "%s: corrupt or unreadable segment\n", q.path);
+		return 1;
+	}
+
+	if (q.mode == MODE_COUNT)
+		printf("%llu\n", selected);
+	if (q.mode == MODE_AGG)
+		print_report(&q.agg[0], top);
+	fprintf(stderr, "%llu of %llu events selected in %d segments (%d threads, %s scan)\n",
+		selected, total, q.nsegments, q.nworkers, trace_scan_impl());
+
+	for (i = 0; i < q.nworkers; i++) {
+		if (q.mode == MODE_AGG)
+			trace_agg_free(&q.agg[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,203 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace_reader.h"
+
+int trace_reader_open(struct trace_reader *r, const char *path) {
+
+	struct trace_file_header h;
+	struct stat st;
+	void *map;
+	int fd;
+
+	r->base = NULL;
+	r->len = 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -errno;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -errno;
+	}
+	if ((size_t)st.st_size < sizeof(h)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	memcpy(&h, map, sizeof(h));
+	if (h.magic != TRACE_MAGIC || h.version != TRACE_VERSION) {
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+
+	r->base = map;
+	r->len = st.st_size;
+	return 0;
+}
+
+void trace_reader_close(struct trace_reader *r) {
+
+	if (r->base)
+		munmap((void *)r->base, r->len);
+	r->base = NULL;
+	r->len = 0;
+}
+
+void trace_iter_init(struct trace_iter *it, const struct trace_reader *r) {
+
+	it->r = r;
+	it->seg = sizeof(struct trace_file_header);
+	it->block = 0;
+	it->i = 0;
+	// No current segment or block yet
+	memset(&it->sh, 0, sizeof(it->sh));
+	memset(&it->bh, 0, sizeof(it->bh));
+}
+
+/**
+ * Point the column cursors at the next block, moving on to the next
+ * segment when the current one is exhausted.
+ * Returns 1, 0 at the end of the trace, or -EINVAL.
+ */
+static int next_block(struct trace_iter *it) {
+
+	const struct trace_reader *r = it->r;
+	struct trace_block_index idx;
+	const unsigned char *p, *end;
+	uint64_t v;
+	uint32_t k, pid = 0;
+	size_t off;
+	int c;
+
+	while (it->block >= it->sh.nblocks) {
+		if (it->sh.magic)
+			it->seg += it->sh.bytes;
+		if (it->seg + sizeof(it->sh) > r->len) {
+			memset(&it->sh, 0, sizeof(it->sh));
+			return 0;
+		}
+		memcpy(&it->sh, r->base + it->seg, sizeof(it->sh));
+		if (it->sh.magic != TRACE_SEGMENT_MAGIC || it->sh.nblocks > TRACE_SEGMENT_BLOCKS ||
+		    it->sh.bytes > r->len - it->seg || it->sh.bytes < sizeof(it->sh))
+			return -EINVAL;
+		it->block = 0;
+	}
+
+	// The block index sits between the segment's pid dictionary and its blocks
+	off = it->seg + sizeof(it->sh) + it->sh.dict_bytes + it->block * sizeof(idx);
+	if (off + sizeof(idx) > it->seg + it->sh.bytes)
+		return -EINVAL;
+	memcpy(&idx, r->base + off, sizeof(idx));
+	if (idx.offset + idx.bytes > it->sh.bytes || idx.bytes < sizeof(it->bh))
+		return -EINVAL;
+
+	p = r->base + it->seg + idx.offset;
+	end = p + idx.bytes;
+	memcpy(&it->bh, p, sizeof(it->bh));
+	if (it->bh.magic != TRACE_BLOCK_MAGIC || it->bh.nevents > TRACE_BLOCK_EVENTS ||
+	    it->bh.npids > it->bh.nevents)
+		return -EINVAL;
+	p += sizeof(it->bh);
+
+	for (c = 0; c < TRACE_NCOLS; c++) {
+		if (it->bh.col_bytes[c] > (size_t)(end - p))
+			return -EINVAL;
+		it->col[c] = p;
+		p += it->bh.col_bytes[c];
+		it->end[c] = p;
+	}
+
+	// The pid dictionary is the only part decoded up front
+	p = it->col[TRACE_COL_PID];
+	for (k = 0; k < it->bh.npids; k++) {
+		if (!(p = trace_get_varint(p, it->end[TRACE_COL_PID], &v)))
+			return -EINVAL;
+		pid += (uint32_t)v;
+		it->pids[k] = pid;
+	}
+	it->col[TRACE_COL_PID] = p;
+	if ((size_t)(it->end[TRACE_COL_PID] - p) != (size_t)it->bh.nevents * 2 ||
+	    it->bh.col_bytes[TRACE_COL_NR] != it->bh.nevents * 2)
+		return -EINVAL;
+
+	memset(it->last, 0, sizeof(it->last));
+	it->ts = it->bh.ts_base;
+	it->i = 0;
+	it->block++;
+	return 1;
+}
+
+/* Decode the next varint of column c into v */
+#define COL_VARINT(it, c, v) \
+	((it)->col[c] = trace_get_varint((it)->col[c], (it)->end[c], (v)))
+
+int trace_iter_next(struct trace_iter *it, struct trace_event *ev) {
+
+	uint16_t idx;
+	uint64_t v;
+	int a, status;
+
+	while (it->i >= it->bh.nevents) {
+		if ((status = next_block(it)) != 1)
+			return status;
+	}
+
+	memcpy(&idx, it->col[TRACE_COL_PID], sizeof(idx));
+	it->col[TRACE_COL_PID] += sizeof(idx);
+	if (idx >= it->bh.npids)
+		return -EINVAL;
+	ev->pid = it->pids[idx];
+	memcpy(&ev->nr, it->col[TRACE_COL_NR], sizeof(ev->nr));
+	it->col[TRACE_COL_NR] += sizeof(ev->nr);
+	ev->flags = 0;
+
+	for (a = 0; a < TRACE_NARGS; a++) {
+		uint64_t *l = &it->last[ev->nr & (TRACE_NR_SLOTS - 1)][a];
+		if (!COL_VARINT(it, TRACE_COL_ARG0 + a, &v))
+			return -EINVAL;
+		*l += (uint64_t)trace_unzigzag(v);
+		ev->args[a] = *l;
+	}
+
+	ev->ts = 0;
+	if (it->bh.present & TRACE_COL(TRACE_COL_TS)) {
+		if (!COL_VARINT(it, TRACE_COL_TS, &v))
+			return -EINVAL;
+		it->ts += trace_unzigzag(v);
+		ev->ts = it->ts;
+		ev->flags |= TRACE_EV_TS;
+	}
+
+	ev->ret = 0;
+	if (it->bh.present & TRACE_COL(TRACE_COL_RET)) {
+		if (!COL_VARINT(it, TRACE_COL_RET, &v))
+			return -EINVAL;
+		// 0 marks an event that has no return value
+		if (v) {
+			ev->ret = trace_unzigzag(v - 1);
+			ev->flags |= TRACE_EV_RET;
+		}
+	}
+
+	ev->dur = 0;
+	if (it->bh.present & TRACE_COL(TRACE_COL_DUR)) {
+		if (!COL_VARINT(it, TRACE_COL_DUR, &v))
+			return -EINVAL;
+		if (v) {
+			ev->dur = v - 1;
+			ev->flags |= TRACE_EV_DUR;
+		}
+	}
+
+	it->i++;
+	return 1;
+}
@@ -0,0 +1,78 @@
+#ifndef _TRACE_READER_H
+#define _TRACE_READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "trace_format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Zero-copy trace reader library (libtrace.a).
+ *
+ * A trace file is mmapped read-only and events are decoded straight out
+ * of the mapped columns, one at a time, into a caller-supplied
+ * trace_event. Neither trace_reader nor trace_iter allocate memory after
+ * trace_reader_open(); all iteration state lives in the trace_iter the
+ * caller provides (it is fairly large, so prefer static or heap storage
+ * over the stack).
+ *
+ *	struct trace_reader r;
+ *	static struct trace_iter it;
+ *	struct trace_event ev;
+ *
+ *	trace_reader_open(&r, "out.trc");
+ *	trace_iter_init(&it, &r);
+ *	while (trace_iter_next(&it, &ev) == 1)
+ *		printf("%s\n", trace_syscall_name(ev.nr));
+ *	trace_reader_close(&r);
+ */
+
+struct trace_reader {
+	const unsigned char *base;
+	size_t len;
+};
+
+struct trace_iter {
+	const struct trace_reader *r;
+
+	/* Current segment and the next block in it */
+	size_t seg;
+	struct trace_segment_header sh;
+	uint32_t block;
+
+	/* Current block: column cursors and the next event */
+	struct trace_block_header bh;
+	const unsigned char *col[TRACE_NCOLS];
+	const unsigned char *end[TRACE_NCOLS];
+	uint32_t i;
+	uint64_t ts;
+	uint32_t pids[TRACE_BLOCK_EVENTS];
+	uint64_t last[TRACE_NR_SLOTS][TRACE_NARGS];
+};
+
+/* Returns 0, or a negative errno if the file cannot be mapped or is not a trace */
+int trace_reader_open(struct trace_reader *r, const char *path);
+void trace_reader_close(struct trace_reader *r);
+
+void trace_iter_init(struct trace_iter *it, const struct trace_reader *r);
+
+/**
+ * Decode the next event into ev.
+ * Returns 1 on success, 0 at the end of the trace, or -EINVAL if the
+ * trace is corrupt. Optional fields are flagged in ev->flags.
+ */
+int trace_iter_next(struct trace_iter *it, struct trace_event *ev);
+
+/* Syscall name for nr, or NULL if unknown */
+const char *trace_syscall_name(unsigned int nr);
+/* Syscall number for name, or -1 if unknown */
+int trace_syscall_lookup(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _TRACE_READER_H */
@@ -0,0 +1,382 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "trace_reader.h"
+
+/**
+ * Replay a recorded process's file I/O against a scratch directory.
+ *
+ * Usage: ./trace_replay [-f] [-s speed] -p pid file.trc dir
+ *   -p  the (thread) pid whose calls are replayed
+ *   -f  run as fast as possible instead of keeping the recorded timing
+ *   -s  scale the recorded gaps between calls (2 = twice as fast)
+ *
+ * open/creat, read/write, pread64/pwrite64, lseek, close, fsync,
+ * fdatasync, stat/lstat/fstat (and their 64-bit variants) are replayed,
+ * everything else is skipped. Calls that failed when recorded are skipped
+ * too. The trace has to carry return values, since they say which fd an
+ * open produced and how many bytes were actually moved. Calls on fds the
+ * trace never opened (stdin/stdout/stderr, inherited fds, sockets and
+ * pipes) have no scratch file to act on; they are not replayed and are
+ * counted in the report's skipped column.
+ *
+ * The module logs argument registers, not the strings they point to, so
+ * recorded paths are unknown: every fd number gets its own file in dir
+ * (fd3, fd4, ...), reused whenever an open returns that fd again, and
+ * stat/lstat look up dir itself. Before the replay starts, each file is
+ * filled with as much data as the recorded reads will consume, so reads
+ * hit real data rather than holes.
+ */
+
+#define MAX_FDS                 1024
+#define MAX_IO                  (16 << 20)
+
+enum op {
+	OP_NONE, OP_OPEN, OP_CREAT, OP_READ, OP_WRITE, OP_PREAD, OP_PWRITE,
+	OP_LSEEK, OP_CLOSE, OP_FSYNC, OP_FDATASYNC, OP_STAT, OP_FSTAT, NOPS
+};
+
+static const char *op_syscalls[][3] = {
+	[OP_OPEN] = { "open" },
+	[OP_CREAT] = { "creat" },
+	[OP_READ] = { "read" },
+	[OP_WRITE] = { "write" },
+	[OP_PREAD] = { "pread64" },
+	[OP_PWRITE] = { "pwrite64" },
+	[OP_LSEEK] = { "lseek" },
+	[OP_CLOSE] = { "close" },
+	[OP_FSYNC] = { "fsync" },
+	[OP_FDATASYNC] = { "fdatasync" },
+	[OP_STAT] = { "stat", "lstat", "stat64" },
+	[OP_FSTAT] = { "fstat", "fstat64" },
+};
+
+/* Per-op results of the replay */
+struct op_stats {
+	uint64_t count, errors, skipped, bytes, ns;
+};
+
+/* A recorded fd: the file behind it and, during the sizing pass, its offset */
+struct fd_state {
+	int open;
+	int fd;
+	uint64_t offset;
+};
+
+static enum op ops[TRACE_NR_SLOTS];
+static struct fd_state fds[MAX_FDS];
+static uint64_t need[MAX_FDS];
+static struct op_stats results[NOPS];
+static struct trace_iter it;
+static const char *dir;
+static char *buf;
+
+static void init_ops(void) {
+
+	int op, i, nr;
+
+	for (op = 0; op < NOPS; op++) {
+		for (i = 0; i < 3 && op_syscalls[op][i]; i++) {
+			if ((nr = trace_syscall_lookup(op_syscalls[op][i])) >= 0 && nr < TRACE_NR_SLOTS)
+				ops[nr] = op;
+		}
+	}
+}
+
+static uint64_t now_ns(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Recorded fd argument, or -1 if it is out of range or not open */
+static int recorded_fd(const struct trace_event *ev) {
+
+	uint64_t fd = ev->args[0];
+
+	return fd < MAX_FDS && fds[fd].open ? (int)fd : -1;
+}
+
+/* pread64/pwrite64 take a 64-bit offset split over two registers on i386 */
+static uint64_t io_offset(const struct trace_event *ev) {
+
+	return (ev->args[3] & 0xffffffffull) | ev->args[4] << 32;
+}
+
+static enum op event_op(const struct trace_event *ev) {
+
+	if (ev->nr >= TRACE_NR_SLOTS || !(ev->flags & TRACE_EV_RET) || ev->ret < 0)
+		return OP_NONE;
+	return ops[ev->nr];
+}
+
+/**
+ * Sizing pass: follow the recorded offsets to find out how large each
+ * file must be for the reads to be satisfied.
+ */
+static void size_event(const struct trace_event *ev) {
+
+	enum op op = event_op(ev);
+	int fd = op == OP_OPEN || op == OP_CREAT ? (int)ev->ret : recorded_fd(ev);
+	uint64_t end;
+
+	if (op == OP_NONE || fd < 0 || fd >= MAX_FDS)
+		return;
+
+	switch (op) {
+		case OP_OPEN:
+		case OP_CREAT:
+			fds[fd].open = 1;
+			fds[fd].offset = 0;
+			break;
+		case OP_READ:
+			fds[fd].offset += ev->ret;
+			if (fds[fd].offset > need[fd])
+				need[fd] = fds[fd].offset;
+			break;
+		case OP_WRITE:
+			fds[fd].offset += ev->ret;
+			break;
+		case OP_PREAD:
+			end = io_offset(ev) + ev->ret;
+			if (end > need[fd])
+				need[fd] = end;
+			break;
+		case OP_LSEEK:
+			fds[fd].offset = ev->ret;
+			break;
+		case OP_CLOSE:
+			fds[fd].open = 0;
+			break;
+		default:
+			break;
+	}
+}
+
+static int scratch_path(char *path, size_t len, int fd) {
+
+	return snprintf(path, len, "%s/fd%d", dir, fd) < (int)len ? 0 : -ENAMETOOLONG;
+}
+
+/* Create the scratch files with the data the replay will read */
+static int populate(void) {
+
+	char path[4096];
+	uint64_t left;
+	ssize_t n;
+	int fd, out;
+
+	memset(buf, 'x', MAX_IO);
+	for (fd = 0; fd < MAX_FDS; fd++) {
+		if (!need[fd])
+			continue;
+		if (scratch_path(path, sizeof(path), fd) != 0 ||
+		    (out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+			return -errno;
+		for (left = need[fd]; left; left -= n) {
+			if ((n = write(out, buf, left < MAX_IO ? left : MAX_IO)) <= 0) {
+				close(out);
+				return n < 0 ? -errno : -EIO;
+			}
+		}
+		fsync(out);
+		close(out);
+	}
+	return 0;
+}
+
+/* Translate recorded open flags (i386 and the host share O_* values) */
+static int open_flags(uint64_t flags) {
+
+	return (flags & (O_ACCMODE | O_TRUNC | O_APPEND | O_SYNC | O_DSYNC)) | O_CREAT;
+}
+
+static size_t io_len(const struct trace_event *ev) {
+
+	return ev->ret < MAX_IO ? (size_t)ev->ret : MAX_IO;
+}
+
+/* Replay one event; returns the result of the replayed call */
+static long replay_event(const struct trace_event *ev, enum op op) {
+
+	char path[4096];
+	struct stat st;
+	int fd = op == OP_OPEN || op == OP_CREAT ? (int)ev->ret : recorded_fd(ev);
+	long ret;
+
+	if (fd < 0 || fd >= MAX_FDS)
+		return -EBADF;
+
+	switch (op) {
+		case OP_OPEN:
+		case OP_CREAT:
+			if (fds[fd].open)
+				close(fds[fd].fd);
+			if (scratch_path(path, sizeof(path), fd) != 0)
+				return -ENAMETOOLONG;
+			ret = op == OP_OPEN ? open(path, open_flags(ev->args[1]), 0644) :
+				open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			fds[fd].open = ret >= 0;
+			fds[fd].fd = ret;
+			return ret;
+		case OP_READ:
+			return read(fds[fd].fd, buf, io_len(ev));
+		case OP_WRITE:
+			return write(fds[fd].fd, buf, io_len(ev));
+		case OP_PREAD:
+			return pread(fds[fd].fd, buf, io_len(ev), io_offset(ev));
+		case OP_PWRITE:
+			return pwrite(fds[fd].fd, buf, io_len(ev), io_offset(ev));
+		case OP_LSEEK:
+			return lseek(fds[fd].fd, ev->ret, SEEK_SET);
+		case OP_CLOSE:
+			fds[fd].open = 0;
+			return close(fds[fd].fd);
+		case OP_FSYNC:
+			return fsync(fds[fd].fd);
+		case OP_FDATASYNC:
+			return fdatasync(fds[fd].fd);
+		case OP_FSTAT:
+			return fstat(fds[fd].fd, &st);
+		default:
+			return -EINVAL;
+	}
+}
+
+static void usage(const char *prog) {
+	fprintf(stderr, "usage: %s [-f] [-s speed] -p pid file.trc dir\n", prog);
+}
+
+int main(int argc, char **argv) {
+
+	struct trace_reader r;
+	struct trace_event ev;
+	struct op_stats *st;
+	struct stat dst;
+	uint64_t first_ts = 0, start = 0, due, t0, total;
+	double speed = 1.0;
+	int opt, pid = -1, fast = 0, status, op, fd;
+	long ret;
+
+	while ((opt = getopt(argc, argv, "fs:p:")) != -1) {
+		switch (opt) {
+			case 'f':
+				fast = 1;
+				break;
+			case 's':
+				speed = atof(optarg);
+				break;
+			case 'p':
+				pid = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (argc - optind != 2 || pid < 0 || speed <= 0) {
+		usage(argv[0]);
+		return 1;
+	}
+	dir = argv[optind + 1];
+
+	if ((status = trace_reader_open(&r, argv[optind])) != 0) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(-status));
+		return 1;
+	}
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		perror(dir);
+		return 1;
+	}
+	if (!(buf = malloc(MAX_IO))) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	init_ops();
+
+	trace_iter_init(&it, &r);
+	while ((status = trace_iter_next(&it, &ev)) == 1) {
+		if (ev.pid == (uint32_t)pid)
+			size_event(&ev);
+	}
+	if (status < 0) {
+		fprintf(stderr, "%s: corrupt trace\n", argv[optind]);
+		return 1;
+	}
+	if ((status = populate()) != 0) {
+		fprintf(stderr, "%s: %s\n", dir, strerror(-status));
+		return 1;
+	}
+	memset(fds, 0, sizeof(fds));
+
+	trace_iter_init(&it, &r);
+	while ((status = trace_iter_next(&it, &ev)) == 1) {
+		if (ev.pid != (uint32_t)pid || (op = event_op(&ev)) == OP_NONE)
+			continue;
+		// Not an fd of ours: replaying it could only fail
+		fd = op == OP_OPEN || op == OP_CREAT ? (int)ev.ret : op == OP_STAT ? 0 : recorded_fd(&ev);
+		if (fd < 0 || fd >= MAX_FDS) {
+			results[op].skipped++;
+			continue;
+		}
+
+		// Sleep until the call is due, relative to the first one
+		if (!start) {
+			start = now_ns();
+			first_ts = ev.ts;
+		} else if (!fast && (ev.flags & TRACE_EV_TS) && ev.ts > first_ts) {
+			due = start + (uint64_t)((ev.ts - first_ts) / speed);
+			t0 = now_ns();
+			if (due > t0) {
+				struct timespec ts = { (due - t0) / 1000000000ull, (due - t0) % 1000000000ull };
+				nanosleep(&ts, NULL);
+			}
+		}
+
+		t0 = now_ns();
+		if (op == OP_STAT)
+			ret = stat(dir, &dst);
+		else
+			ret = replay_event(&ev, op);
+		st = &results[op];
+		st->ns += now_ns() - t0;
+		st->count++;
+		if (ret < 0)
+			st->errors++;
+		else if (op == OP_READ || op == OP_WRITE || op == OP_PREAD || op == OP_PWRITE)
+			st->bytes += ret;
+	}
+	total = start ? now_ns() - start : 0;
+
+	for (fd = 0; fd < MAX_FDS; fd++) {
+		if (fds[fd].open)
+			close(fds[fd].fd);
+	}
+	trace_reader_close(&r);
+	free(buf);
+	if (status < 0) {
+		fprintf(stderr, "%s: corrupt trace\n", argv[optind]);
+		return 1;
+	}
+
+	printf("%-10s %10s %8s %8s %14s %12s %10s\n", "op", "calls", "errors", "skipped", "bytes",
+		"total_us", "avg_us");
+	for (op = OP_OPEN; op < NOPS; op++) {
+		st = &results[op];
+		if (!st->count && !st->skipped)
+			continue;
+		printf("%-10s %10llu %8llu %8llu %14llu %12.0f %10.1f\n", op_syscalls[op][0],
+			(unsigned long long)st->count, (unsigned long long)st->errors,
+			(unsigned long long)st->skipped, (unsigned long long)st->bytes, st->ns / 1e3,
+			st->count ? st->ns / 1e3 / st->count : 0);
+	}
+	printf("elapsed %.3fs\n", total / 1e9);
+	return 0;
+}
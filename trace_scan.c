@@ -0,0 +1,169 @@
+#include <string.h>
+#include <pthread.h>
+#include "trace_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRACE_SCAN_X86
+#endif
+
+//----- Compare kernels --------------------------------------------
+
+/* Each kernel handles events i0..n-1; i0 is a multiple of its lane count */
+static void scan_u16_eq_scalar(const uint16_t *col, uint32_t i0, uint32_t n, uint16_t v, uint64_t *bm) {
+
+	uint32_t i;
+
+	for (i = i0; i < n; i++)
+		bm[i / 64] |= (uint64_t)(col[i] == v) << (i % 64);
+}
+
+#ifdef TRACE_SCAN_X86
+/**
+ * 16 lanes per iteration: two 8-lane compares packed down to bytes, so a
+ * single movemask yields one bit per event, in order.
+ */
+__attribute__((target("sse2")))
+static void scan_u16_eq_sse2(const uint16_t *col, uint32_t i0, uint32_t n, uint16_t v, uint64_t *bm) {
+
+	__m128i key = _mm_set1_epi16((short)v);
+	uint32_t i;
+
+	for (i = i0; i + 16 <= n; i += 16) {
+		__m128i a = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(col + i)), key);
+		__m128i b = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(col + i + 8)), key);
+		uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(a, b));
+		bm[i / 64] |= (uint64_t)m << (i % 64);
+	}
+	scan_u16_eq_scalar(col, i, n, v, bm);
+}
+
+/**
+ * 32 lanes per iteration. packs works within 128-bit halves, so the
+ * 64-bit quarters are permuted back into event order before movemask.
+ */
+__attribute__((target("avx2")))
+static void scan_u16_eq_avx2(const uint16_t *col, uint32_t i0, uint32_t n, uint16_t v, uint64_t *bm) {
+
+	__m256i key = _mm256_set1_epi16((short)v);
+	uint32_t i;
+
+	for (i = i0; i + 32 <= n; i += 32) {
+		__m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(col + i)), key);
+		__m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(col + i + 16)), key);
+		__m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xd8);
+		uint32_t m = (uint32_t)_mm256_movemask_epi8(p);
+		bm[i / 64] |= (uint64_t)m << (i % 64);
+	}
+	scan_u16_eq_sse2(col, i, n, v, bm);
+}
+#endif
+
+typedef void (*scan_u16_fn)(const uint16_t *, uint32_t, uint32_t, uint16_t, uint64_t *);
+
+static scan_u16_fn scan_u16;
+static const char *scan_name;
+// Pool workers scan concurrently, so selection must happen exactly once
+static pthread_once_t scan_once = PTHREAD_ONCE_INIT;
+
+static void scan_select(void) {
+
+	scan_u16 = scan_u16_eq_scalar;
+	scan_name = "scalar";
+#ifdef TRACE_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		scan_u16 = scan_u16_eq_avx2;
+		scan_name = "avx2";
+	} else if (__builtin_cpu_supports("sse2")) {
+		scan_u16 = scan_u16_eq_sse2;
+		scan_name = "sse2";
+	}
+#endif
+}
+
+void trace_scan_u16_eq(const uint16_t *col, uint32_t n, uint16_t v, uint64_t *bm) {
+
+	pthread_once(&scan_once, scan_select);
+	scan_u16(col, 0, n, v, bm);
+}
+
+const char *trace_scan_impl(void) {
+
+	pthread_once(&scan_once, scan_select);
+	return scan_name;
+}
+//------------------------------------------------------------------
+
+
+//----- Block predicates -------------------------------------------
+
+uint32_t trace_filter_columns(const struct trace_filter *f) {
+
+	uint32_t cols = 0;
+
+	if (f->npids)
+		cols |= TRACE_COL(TRACE_COL_PID);
+	if (f->nnrs)
+		cols |= TRACE_COL(TRACE_COL_NR);
+	return cols;
+}
+
+/* Dictionary index of pid in block b, or -1 if the block has no such pid */
+static int pid_lookup(const struct trace_block *b, uint32_t pid) {
+
+	uint32_t lo = 0, hi = b->hdr.npids;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (b->pids[mid] < pid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return (lo < b->hdr.npids && b->pids[lo] == pid) ? (int)lo : -1;
+}
+
+static void bitmap_fill(uint64_t *bm, uint32_t n) {
+
+	uint32_t w;
+
+	memset(bm, 0, TRACE_BITMAP_WORDS * sizeof(*bm));
+	for (w = 0; w < n / 64; w++)
+		bm[w] = ~0ull;
+	if (n % 64)
+		bm[w] = (1ull << (n % 64)) - 1;
+}
+
+uint32_t trace_scan_block(const struct trace_block *b, const struct trace_filter *f, uint64_t *bm) {
+
+	uint64_t sel[TRACE_BITMAP_WORDS];
+	uint32_t n = b->hdr.nevents, words = (n + 63) / 64, count = 0, w;
+	int i, idx;
+
+	bitmap_fill(bm, n);
+
+	if (f->npids) {
+		memset(sel, 0, sizeof(sel));
+		for (i = 0; i < f->npids; i++) {
+			// Pids are dictionary-encoded: a pid absent from the dictionary cannot match
+			if ((idx = pid_lookup(b, f->pids[i])) >= 0)
+				trace_scan_u16_eq(b->pid_idx, n, (uint16_t)idx, sel);
+		}
+		for (w = 0; w < words; w++)
+			bm[w] &= sel[w];
+	}
+
+	if (f->nnrs) {
+		memset(sel, 0, sizeof(sel));
+		for (i = 0; i < f->nnrs; i++)
+			trace_scan_u16_eq(b->nr, n, f->nrs[i], sel);
+		for (w = 0; w < words; w++)
+			bm[w] &= sel[w];
+	}
+
+	for (w = 0; w < words; w++)
+		count += __builtin_popcountll(bm[w]);
+	return count;
+}
+//------------------------------------------------------------------
@@ -0,0 +1,49 @@
+#ifndef _TRACE_SCAN_H
+#define _TRACE_SCAN_H
+
+#include <stdint.h>
+#include "trace_format.h"
+
+/**
+ * Block filter kernels for the trace reader.
+ *
+ * Predicates are evaluated over whole fixed-width columns of a decoded
+ * block and produce selection bitmaps (bit i set => event i selected),
+ * one uint64_t word per 64 events. The compare kernels use AVX2 or SSE2
+ * when the CPU has them, selected once at runtime, and fall back to a
+ * scalar loop otherwise.
+ */
+
+#define TRACE_BITMAP_WORDS      ((TRACE_BLOCK_EVENTS + 63) / 64)
+
+typedef uint64_t trace_bitmap[TRACE_BITMAP_WORDS];
+
+/* A set of pids and/or syscall numbers to select; empty sets match all */
+struct trace_filter {
+	uint32_t *pids;
+	int npids;
+	uint16_t *nrs;
+	int nnrs;
+};
+
+/* OR into bm the events i < n with col[i] == v */
+void trace_scan_u16_eq(const uint16_t *col, uint32_t n, uint16_t v, uint64_t *bm);
+
+/**
+ * Compute the selection bitmap of a block for filter f.
+ * The block must have the PID column decoded if f has pids, and the NR
+ * column if f has syscalls. Returns the number of selected events.
+ */
+uint32_t trace_scan_block(const struct trace_block *b, const struct trace_filter *f, uint64_t *bm);
+
+/* Columns trace_scan_block needs for filter f */
+uint32_t trace_filter_columns(const struct trace_filter *f);
+
+static inline int trace_bitmap_test(const uint64_t *bm, uint32_t i) {
+	return (bm[i / 64] >> (i % 64)) & 1;
+}
+
+/* Name of the compare kernel in use, for diagnostics */
+const char *trace_scan_impl(void);
+
+#endif /* _TRACE_SCAN_H */